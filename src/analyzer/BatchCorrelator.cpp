@@ -0,0 +1,63 @@
+#include "BatchCorrelator.h"
+#include <algorithm>
+#include <cmath>
+
+namespace analyzer {
+
+BatchCorrelator::BatchCorrelator() = default;
+BatchCorrelator::BatchCorrelator(const Options &options) : m_options(options) {}
+
+float BatchCorrelator::Weight(uint64_t peakTime, uint64_t eventTime) const {
+  if (eventTime <= peakTime) {
+    float dt = (float)(peakTime - eventTime);
+    return std::exp2(-dt / m_options.HalfLifeBefore);
+  }
+  float dt = (float)(eventTime - peakTime);
+  return std::exp2(-dt / m_options.HalfLifeAfter);
+}
+
+std::vector<PeakWindow>
+BatchCorrelator::Assign(const std::vector<TrafficPeak> &peaks,
+                        const std::vector<LogEntry> &entries) const {
+  // Sort (timestamp, index) pairs rather than the entries themselves so the
+  // wide strings never move
+  std::vector<std::pair<uint64_t, uint32_t>> peakOrder(peaks.size());
+  for (uint32_t i = 0; i < (uint32_t)peaks.size(); i++)
+    peakOrder[i] = {peaks[i].Timestamp, i};
+  std::sort(peakOrder.begin(), peakOrder.end());
+
+  std::vector<std::pair<uint64_t, uint32_t>> eventOrder(entries.size());
+  for (uint32_t i = 0; i < (uint32_t)entries.size(); i++)
+    eventOrder[i] = {entries[i].Timestamp, i};
+  std::sort(eventOrder.begin(), eventOrder.end());
+
+  std::vector<PeakWindow> windows(peaks.size());
+
+  // Every window has the same width, so both window edges are monotonic in
+  // peak time and neither pointer ever moves backwards
+  size_t lo = 0, hi = 0;
+  for (auto const &[peakTime, peakIndex] : peakOrder) {
+    uint64_t start = peakTime > m_options.WindowBefore
+                         ? peakTime - m_options.WindowBefore
+                         : 0;
+    uint64_t end = peakTime + m_options.WindowAfter;
+
+    while (lo < eventOrder.size() && eventOrder[lo].first < start)
+      lo++;
+    if (hi < lo)
+      hi = lo;
+    while (hi < eventOrder.size() && eventOrder[hi].first <= end)
+      hi++;
+
+    PeakWindow &w = windows[peakIndex];
+    w.PeakIndex = peakIndex;
+    w.Matches.reserve(hi - lo);
+    for (size_t e = lo; e < hi; e++) {
+      w.Matches.push_back(
+          {eventOrder[e].second, Weight(peakTime, eventOrder[e].first)});
+    }
+  }
+  return windows;
+}
+
+} // namespace analyzer
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "EventLogReader.h"
+#include "PeakDetector.h"
+#include <cstdint>
+#include <vector>
+
+namespace analyzer {
+
+struct PeakEventMatch {
+  uint32_t EventIndex; // Index into the entries passed to Assign
+  float Weight;        // Time-decay relevance, 1.0 at the peak itself
+};
+
+struct PeakWindow {
+  uint32_t PeakIndex; // Index into the peaks passed to Assign
+  std::vector<PeakEventMatch> Matches;
+};
+
+// Assigns log events to the correlation window of every peak in a single
+// two-pointer sweep over both time-sorted sequences.
+class BatchCorrelator {
+public:
+  // Seconds before/after a peak that an event may still be related to.
+  // Events leading up to a peak are the likely causes, so they decay slower.
+  struct Options {
+    uint64_t WindowBefore = 60;
+    uint64_t WindowAfter = 120;
+    float HalfLifeBefore = 60.0f;
+    float HalfLifeAfter = 30.0f;
+  };
+
+  BatchCorrelator();
+  explicit BatchCorrelator(const Options &options);
+
+  // Returns one window per peak, in the order of 'peaks'. Neither input
+  // needs to be sorted. Matches inside a window are sorted by event time.
+  std::vector<PeakWindow> Assign(const std::vector<TrafficPeak> &peaks,
+                                 const std::vector<LogEntry> &entries) const;
+
+  float Weight(uint64_t peakTime, uint64_t eventTime) const;
+
+private:
+  Options m_options;
+};
+
+} // namespace analyzer
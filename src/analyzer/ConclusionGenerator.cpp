@@ -1,68 +1,259 @@
 #include "ConclusionGenerator.h"
+#include "../utils/Logger.h"
 #include <algorithm>
+#include <cwctype>
+#include <fstream>
+#include <sstream>
+#include <windows.h>
 
 namespace analyzer {
 
-ConclusionGenerator::ConclusionGenerator() = default;
+static std::vector<ConclusionRule> DefaultRules() {
+  std::vector<ConclusionRule> rules(4);
 
-AnalysisConclusion
-ConclusionGenerator::Generate(const std::vector<LogEntry> &events,
-                              const std::wstring &appName) {
-  AnalysisConclusion conclusion;
-  conclusion.Summary = L"Unknown Traffic Cause";
-  conclusion.Detail =
-      L"No specific triggers could be identified for this peak.";
-  conclusion.Confidence = 0.1f;
-
-  std::wstring loweredApp = appName;
-  std::transform(loweredApp.begin(), loweredApp.end(), loweredApp.begin(),
-                 ::towlower);
-
-  if (IsWindowsUpdate(events)) {
-    conclusion.Summary = L"Windows Update";
-    conclusion.Detail = L"Detected activity from Windows Update Client in "
-                        L"system logs concurrent with this traffic peak.";
-    conclusion.Confidence = 0.9f;
-  } else if (IsSteamDownload(loweredApp)) {
-    conclusion.Summary = L"Steam Game Download/Update";
-    conclusion.Detail = L"Identified Steam (steam.exe or steamwebhelper.exe) "
-                        L"as the primary consumer during this peak.";
-    conclusion.Confidence = 0.85f;
-  } else if (IsWebBrowser(loweredApp)) {
-    conclusion.Summary = L"Web Browsing / Streaming";
-    conclusion.Detail = L"Identified a major web browser as the consumer. "
-                        L"Likely video streaming or a large download.";
-    conclusion.Confidence = 0.7f;
-  } else if (loweredApp.find(L"system") != std::wstring::npos) {
-    conclusion.Summary = L"System Process Activity";
-    conclusion.Detail = L"System-level processes were active. Could be "
-                        L"background synchronization or telemetry.";
-    conclusion.Confidence = 0.5f;
+  rules[0].Summary = L"Windows Update";
+  rules[0].Detail = L"Detected activity from Windows Update Client in "
+                    L"system logs concurrent with this traffic peak.";
+  rules[0].Priority = 400;
+  rules[0].Confidence = 0.9f;
+  rules[0].ProviderPatterns = {L"WindowsUpdateClient", L"UpdateOrchestrator"};
+
+  rules[1].Summary = L"Steam Game Download/Update";
+  rules[1].Detail = L"Identified Steam (steam.exe or steamwebhelper.exe) "
+                    L"as the primary consumer during this peak.";
+  rules[1].Priority = 300;
+  rules[1].Confidence = 0.85f;
+  rules[1].ProcessPatterns = {L"steam.exe", L"steamwebhelper.exe"};
+
+  rules[2].Summary = L"Web Browsing / Streaming";
+  rules[2].Detail = L"Identified a major web browser as the consumer. "
+                    L"Likely video streaming or a large download.";
+  rules[2].Priority = 200;
+  rules[2].Confidence = 0.7f;
+  rules[2].ProcessPatterns = {L"chrome.exe", L"msedge.exe", L"firefox.exe",
+                              L"brave.exe"};
+
+  rules[3].Summary = L"System Process Activity";
+  rules[3].Detail = L"System-level processes were active. Could be "
+                    L"background synchronization or telemetry.";
+  rules[3].Priority = 100;
+  rules[3].Confidence = 0.5f;
+  rules[3].ProcessPatterns = {L"system"};
+
+  return rules;
+}
+
+static std::wstring Trim(const std::wstring &s) {
+  size_t b = 0, e = s.size();
+  while (b < e && std::iswspace(s[b]))
+    b++;
+  while (e > b && std::iswspace(s[e - 1]))
+    e--;
+  return s.substr(b, e - b);
+}
+
+static std::vector<std::wstring> SplitList(const std::wstring &s) {
+  std::vector<std::wstring> items;
+  std::wstringstream ss(s);
+  std::wstring item;
+  while (std::getline(ss, item, L',')) {
+    item = Trim(item);
+    if (!item.empty())
+      items.push_back(item);
+  }
+  return items;
+}
+
+ConclusionGenerator::ConclusionGenerator() { SetRules(DefaultRules()); }
+
+bool ConclusionGenerator::LoadRules(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return false;
+  std::string utf8((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  if (utf8.size() >= 3 && utf8.compare(0, 3, "\xEF\xBB\xBF") == 0)
+    utf8.erase(0, 3);
+
+  std::wstring text;
+  int sz = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.length(),
+                               nullptr, 0);
+  if (sz > 0) {
+    text.resize(sz);
+    MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.length(), &text[0],
+                        sz);
   }
 
-  return conclusion;
+  std::vector<ConclusionRule> rules;
+  std::wstringstream lines(text);
+  std::wstring line;
+  int lineNo = 0;
+  while (std::getline(lines, line)) {
+    lineNo++;
+    line = Trim(line);
+    if (line.empty() || line.front() == L';' || line.front() == L'#')
+      continue;
+
+    if (line.front() == L'[' && line.back() == L']') {
+      rules.emplace_back();
+      rules.back().Summary = Trim(line.substr(1, line.size() - 2));
+      continue;
+    }
+
+    size_t eq = line.find(L'=');
+    if (rules.empty() || eq == std::wstring::npos) {
+      LOG("Warning: Ignoring line " + std::to_string(lineNo) + " in " + path);
+      continue;
+    }
+    std::wstring key = Trim(line.substr(0, eq));
+    std::wstring value = Trim(line.substr(eq + 1));
+    ConclusionRule &rule = rules.back();
+    try {
+      if (key == L"detail")
+        rule.Detail = value;
+      else if (key == L"priority")
+        rule.Priority = std::stoi(value);
+      else if (key == L"confidence")
+        rule.Confidence = std::clamp(std::stof(value), 0.0f, 1.0f);
+      else if (key == L"process")
+        for (auto &p : SplitList(value))
+          rule.ProcessPatterns.push_back(p);
+      else if (key == L"provider")
+        for (auto &p : SplitList(value))
+          rule.ProviderPatterns.push_back(p);
+      else if (key == L"event_id")
+        for (auto &id : SplitList(value))
+          rule.EventIds.push_back((uint32_t)std::stoul(id));
+      else
+        LOG("Warning: Unknown key on line " + std::to_string(lineNo) + " in " +
+            path);
+    } catch (...) {
+      LOG("Warning: Bad value on line " + std::to_string(lineNo) + " in " +
+          path);
+    }
+  }
+
+  if (rules.empty())
+    return false;
+  LOG("Loaded " + std::to_string(rules.size()) + " conclusion rules from " +
+      path);
+  SetRules(std::move(rules));
+  return true;
 }
 
-bool ConclusionGenerator::IsWindowsUpdate(const std::vector<LogEntry> &events) {
-  for (const auto &ev : events) {
-    if (ev.ProviderName.find(L"WindowsUpdateClient") != std::wstring::npos ||
-        ev.ProviderName.find(L"UpdateOrchestrator") != std::wstring::npos) {
-      return true;
+void ConclusionGenerator::SetRules(std::vector<ConclusionRule> rules) {
+  std::stable_sort(rules.begin(), rules.end(),
+                   [](const ConclusionRule &a, const ConclusionRule &b) {
+                     if (a.Priority != b.Priority)
+                       return a.Priority > b.Priority;
+                     return a.Confidence > b.Confidence;
+                   });
+  m_rules = std::move(rules);
+  Compile();
+}
+
+void ConclusionGenerator::Compile() {
+  m_matcher = PatternMatcher();
+  m_targets.clear();
+  m_anyProviderRules.clear();
+
+  for (uint32_t r = 0; r < (uint32_t)m_rules.size(); r++) {
+    for (const auto &p : m_rules[r].ProcessPatterns) {
+      m_matcher.Add(p);
+      m_targets.push_back({r, true});
+    }
+    for (const auto &p : m_rules[r].ProviderPatterns) {
+      m_matcher.Add(p);
+      m_targets.push_back({r, false});
     }
+    if (m_rules[r].ProviderPatterns.empty() && !m_rules[r].EventIds.empty())
+      m_anyProviderRules.push_back((int)r);
+  }
+  m_matcher.Compile();
+}
+
+int ConclusionGenerator::Better(int a, int b) {
+  if (a == NoRule)
+    return b;
+  if (b == NoRule)
+    return a;
+  return (std::min)(a, b);
+}
+
+int ConclusionGenerator::BestRuleForApp(const std::wstring &appName) const {
+  int best = NoRule;
+  m_matcher.Scan(appName, [&](uint32_t id) {
+    if (m_targets[id].IsProcess)
+      best = Better(best, (int)m_targets[id].Rule);
+  });
+  return best;
+}
+
+int ConclusionGenerator::BestRuleForEvent(const LogEntry &event) const {
+  auto idAllowed = [&](const ConclusionRule &rule) {
+    return rule.EventIds.empty() ||
+           std::find(rule.EventIds.begin(), rule.EventIds.end(),
+                     event.EventId) != rule.EventIds.end();
+  };
+
+  int best = NoRule;
+  m_matcher.Scan(event.ProviderName, [&](uint32_t id) {
+    const PatternTarget &t = m_targets[id];
+    if (!t.IsProcess && idAllowed(m_rules[t.Rule]))
+      best = Better(best, (int)t.Rule);
+  });
+  for (int r : m_anyProviderRules) {
+    if (idAllowed(m_rules[r]))
+      best = Better(best, r);
+  }
+  return best;
+}
+
+AnalysisConclusion ConclusionGenerator::FromRule(int rule) const {
+  AnalysisConclusion conclusion;
+  if (rule == NoRule) {
+    conclusion.Summary = L"Unknown Traffic Cause";
+    conclusion.Detail =
+        L"No specific triggers could be identified for this peak.";
+    conclusion.Confidence = 0.1f;
+    return conclusion;
   }
-  return false;
+  conclusion.Summary = m_rules[rule].Summary;
+  conclusion.Detail = m_rules[rule].Detail;
+  conclusion.Confidence = m_rules[rule].Confidence;
+  return conclusion;
 }
 
-bool ConclusionGenerator::IsSteamDownload(const std::wstring &appName) {
-  return appName.find(L"steam.exe") != std::wstring::npos ||
-         appName.find(L"steamwebhelper.exe") != std::wstring::npos;
+AnalysisConclusion
+ConclusionGenerator::Generate(const std::vector<LogEntry> &events,
+                              const std::wstring &appName) const {
+  int best = BestRuleForApp(appName);
+  for (const auto &ev : events) {
+    if (best == 0)
+      break; // Nothing can beat the top rule
+    best = Better(best, BestRuleForEvent(ev));
+  }
+  return FromRule(best);
 }
 
-bool ConclusionGenerator::IsWebBrowser(const std::wstring &appName) {
-  return appName.find(L"chrome.exe") != std::wstring::npos ||
-         appName.find(L"msedge.exe") != std::wstring::npos ||
-         appName.find(L"firefox.exe") != std::wstring::npos ||
-         appName.find(L"brave.exe") != std::wstring::npos;
+std::vector<AnalysisConclusion>
+ConclusionGenerator::GenerateBatch(const std::vector<LogEntry> &events,
+                                   const std::vector<PeakWindow> &windows,
+                                   const std::vector<std::wstring> &appNames)
+    const {
+  std::vector<int> eventRule(events.size());
+  for (size_t i = 0; i < events.size(); i++)
+    eventRule[i] = BestRuleForEvent(events[i]);
+
+  std::vector<AnalysisConclusion> conclusions;
+  conclusions.reserve(windows.size());
+  for (size_t w = 0; w < windows.size(); w++) {
+    int best = w < appNames.size() ? BestRuleForApp(appNames[w]) : NoRule;
+    for (const auto &m : windows[w].Matches)
+      best = Better(best, eventRule[m.EventIndex]);
+    conclusions.push_back(FromRule(best));
+  }
+  return conclusions;
 }
 
 } // namespace analyzer
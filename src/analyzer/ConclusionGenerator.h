@@ -1,6 +1,8 @@
 #pragma once
 
+#include "BatchCorrelator.h"
 #include "EventLogReader.h"
+#include "PatternMatcher.h"
 #include <string>
 #include <vector>
 
@@ -12,19 +14,74 @@ struct AnalysisConclusion {
   float Confidence = 0.0f; // 0.0 to 1.0
 };
 
+// A heuristic rule. It fires when any process pattern is a substring of the
+// app name, or when any event's provider contains a provider pattern (and,
+// if EventIds is not empty, the event id is listed). A rule with EventIds
+// but no provider patterns matches those ids from any provider.
+struct ConclusionRule {
+  std::wstring Summary;
+  std::wstring Detail;
+  int Priority = 0;
+  float Confidence = 0.5f;
+  std::vector<std::wstring> ProcessPatterns;
+  std::vector<std::wstring> ProviderPatterns;
+  std::vector<uint32_t> EventIds;
+};
+
 class ConclusionGenerator {
 public:
+  // Starts with the built-in rules
   ConclusionGenerator();
 
+  // Replaces the rules with the ones in an INI-style file, one section per
+  // rule with the summary as the section name:
+  //
+  //   [Windows Update]
+  //   detail = Detected activity from Windows Update Client...
+  //   priority = 400
+  //   confidence = 0.9
+  //   provider = WindowsUpdateClient, UpdateOrchestrator
+  //   event_id = 19, 43
+  //   process = steam.exe, steamwebhelper.exe
+  //
+  // The matching rule with the highest priority wins. Patterns are
+  // case-insensitive substrings. Returns false and keeps the current rules
+  // if the file cannot be read or has no rules.
+  bool LoadRules(const std::string &path);
+  void SetRules(std::vector<ConclusionRule> rules);
+  const std::vector<ConclusionRule> &GetRules() const { return m_rules; }
+
   // Analyzes a set of events and returns a conclusion
   AnalysisConclusion Generate(const std::vector<LogEntry> &events,
-                              const std::wstring &appName);
+                              const std::wstring &appName) const;
+
+  // Evaluates every correlated window at once. Each event is scanned a
+  // single time no matter how many windows it falls into.
+  std::vector<AnalysisConclusion>
+  GenerateBatch(const std::vector<LogEntry> &events,
+                const std::vector<PeakWindow> &windows,
+                const std::vector<std::wstring> &appNames) const;
 
 private:
-  // Heuristic rules
-  bool IsWindowsUpdate(const std::vector<LogEntry> &events);
-  bool IsSteamDownload(const std::wstring &appName);
-  bool IsWebBrowser(const std::wstring &appName);
+  static constexpr int NoRule = -1;
+
+  void Compile();
+
+  // Rules are kept sorted best-first, so the lowest matching index wins
+  int BestRuleForApp(const std::wstring &appName) const;
+  int BestRuleForEvent(const LogEntry &event) const;
+  static int Better(int a, int b);
+  AnalysisConclusion FromRule(int rule) const;
+
+  struct PatternTarget {
+    uint32_t Rule;
+    bool IsProcess;
+  };
+
+  std::vector<ConclusionRule> m_rules;
+  PatternMatcher m_matcher;
+  std::vector<PatternTarget> m_targets; // Pattern id -> rule
+  std::vector<int> m_anyProviderRules;  // Rules keyed on event id only
 };
 
 } // namespace analyzer
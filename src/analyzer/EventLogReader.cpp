@@ -45,20 +45,25 @@ std::vector<LogEntry> EventLogReader::QueryEvents(const std::wstring &channel,
     return results;
   }
 
+  // EvtRenderEventValues needs a context that selects the system properties
+  EVT_HANDLE hContext =
+      EvtCreateRenderContext(0, nullptr, EvtRenderContextSystem);
+
   EVT_HANDLE hEvents[50];
   DWORD returned = 0;
   while (EvtNext(hResults, 50, hEvents, INFINITE, 0, &returned)) {
     for (DWORD i = 0; i < returned; i++) {
       LogEntry entry;
+      entry.Channel = channel;
 
       // Render basic system info
       DWORD bufferSize = 0;
       DWORD propertyCount = 0;
-      if (!EvtRender(nullptr, hEvents[i], EvtRenderEventValues, 0, nullptr,
+      if (!EvtRender(hContext, hEvents[i], EvtRenderEventValues, 0, nullptr,
                      &bufferSize, &propertyCount) &&
           GetLastError() == ERROR_INSUFFICIENT_BUFFER) {
         std::vector<BYTE> buffer(bufferSize);
-        if (EvtRender(nullptr, hEvents[i], EvtRenderEventValues, bufferSize,
+        if (EvtRender(hContext, hEvents[i], EvtRenderEventValues, bufferSize,
                       buffer.data(), &bufferSize, &propertyCount)) {
           PEVT_VARIANT values = reinterpret_cast<PEVT_VARIANT>(buffer.data());
 
@@ -70,6 +75,10 @@ std::vector<LogEntry> EventLogReader::QueryEvents(const std::wstring &channel,
               values[EvtSystemEventID].Type == EvtVarTypeUInt16) {
             entry.EventId = values[EvtSystemEventID].UInt16Val;
           }
+          if (propertyCount > EvtSystemEventRecordId &&
+              values[EvtSystemEventRecordId].Type == EvtVarTypeUInt64) {
+            entry.RecordId = values[EvtSystemEventRecordId].UInt64Val;
+          }
           if (propertyCount > EvtSystemTimeCreated &&
               values[EvtSystemTimeCreated].Type == EvtVarTypeFileTime) {
             entry.Timestamp = (values[EvtSystemTimeCreated].FileTimeVal -
@@ -109,6 +118,8 @@ std::vector<LogEntry> EventLogReader::QueryEvents(const std::wstring &channel,
     }
   }
 
+  if (hContext)
+    EvtClose(hContext);
   EvtClose(hResults);
   return results;
 }
@@ -10,8 +10,10 @@ namespace analyzer {
 struct LogEntry {
   std::wstring ProviderName;
   std::wstring Message;
-  uint64_t Timestamp;
-  uint32_t EventId;
+  uint64_t Timestamp = 0;
+  uint32_t EventId = 0;
+  std::wstring Channel;
+  uint64_t RecordId = 0; // Unique within the channel
 };
 
 class EventLogReader {
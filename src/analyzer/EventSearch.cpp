@@ -0,0 +1,109 @@
+#include "EventSearch.h"
+#include <algorithm>
+#include <ctime>
+#include <unordered_map>
+
+namespace analyzer {
+
+db::StoredEvent ToStoredEvent(const LogEntry &entry) {
+  db::StoredEvent ev;
+  ev.Timestamp = entry.Timestamp;
+  ev.Channel = entry.Channel;
+  ev.Provider = entry.ProviderName;
+  ev.EventId = entry.EventId;
+  ev.RecordId = entry.RecordId;
+  ev.Message = entry.Message;
+  return ev;
+}
+
+EventSearch::EventSearch(db::Database &db) : m_db(db), m_detector(db) {}
+
+void EventSearch::Sync(int initialDays) {
+  uint64_t now = (uint64_t)std::time(nullptr);
+  uint64_t from = m_db.GetEventSyncTime();
+  if (from == 0)
+    from = now - (uint64_t)initialDays * 86400;
+
+  std::vector<db::StoredEvent> batch;
+  for (const wchar_t *channel : {L"System", L"Application"}) {
+    for (const auto &entry : m_logReader.QueryEvents(channel, from, now))
+      batch.push_back(ToStoredEvent(entry));
+  }
+  // Retried from the same point next time if storing failed
+  if (m_db.StoreEvents(batch))
+    m_db.SetEventSyncTime(now);
+}
+
+std::vector<EventSearchHit> EventSearch::Search(const std::wstring &query,
+                                                uint64_t peakThresholdBytes,
+                                                uint64_t maxPeakDistance) {
+  std::vector<EventSearchHit> hits;
+  auto events = m_db.SearchEvents(query);
+  if (events.empty())
+    return hits;
+
+  uint64_t first = events.front().Timestamp, last = events.front().Timestamp;
+  for (const auto &ev : events) {
+    first = (std::min)(first, ev.Timestamp);
+    last = (std::max)(last, ev.Timestamp);
+  }
+  first = first > maxPeakDistance ? first - maxPeakDistance : 0;
+  auto peaks = m_detector.FindPeaksBetween(first, last + maxPeakDistance,
+                                           peakThresholdBytes);
+  std::sort(peaks.begin(), peaks.end(),
+            [](const TrafficPeak &a, const TrafficPeak &b) {
+              return a.Timestamp < b.Timestamp;
+            });
+
+  std::unordered_map<int, std::wstring> appNames;
+  hits.reserve(events.size());
+  for (auto &ev : events) {
+    EventSearchHit hit;
+    hit.Event = std::move(ev);
+    uint64_t t = hit.Event.Timestamp;
+
+    // Closest peak on either side; ties go to the larger peak
+    auto it = std::lower_bound(
+        peaks.begin(), peaks.end(), t,
+        [](const TrafficPeak &p, uint64_t ts) { return p.Timestamp < ts; });
+    const TrafficPeak *best = nullptr;
+    uint64_t bestDist = maxPeakDistance + 1;
+    auto consider = [&](const TrafficPeak &p) {
+      uint64_t d = p.Timestamp > t ? p.Timestamp - t : t - p.Timestamp;
+      if (d < bestDist || (d == bestDist && best &&
+                           p.TotalBytes > best->TotalBytes)) {
+        best = &p;
+        bestDist = d;
+      }
+    };
+    // Several apps can peak in the same minute bucket, so scan the whole
+    // run of equal timestamps next to the insertion point
+    for (auto f = it; f != peaks.end() && f->Timestamp == it->Timestamp; ++f)
+      consider(*f);
+    if (it != peaks.begin()) {
+      uint64_t prevTs = std::prev(it)->Timestamp;
+      for (auto b = std::prev(it);; --b) {
+        if (b->Timestamp != prevTs)
+          break;
+        consider(*b);
+        if (b == peaks.begin())
+          break;
+      }
+    }
+
+    if (best && bestDist <= maxPeakDistance) {
+      hit.HasPeak = true;
+      hit.NearestPeak = *best;
+      hit.PeakOffset = (int64_t)t - (int64_t)best->Timestamp;
+      auto name = appNames.find(best->AppId);
+      if (name == appNames.end())
+        name = appNames.emplace(best->AppId, m_db.GetAppName(best->AppId))
+                   .first;
+      hit.PeakAppName = name->second;
+    }
+    hits.push_back(std::move(hit));
+  }
+  return hits;
+}
+
+} // namespace analyzer
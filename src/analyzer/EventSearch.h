@@ -0,0 +1,42 @@
+#pragma once
+
+#include "../db/Database.h"
+#include "EventLogReader.h"
+#include "PeakDetector.h"
+#include <string>
+#include <vector>
+
+namespace analyzer {
+
+struct EventSearchHit {
+  db::StoredEvent Event;
+  bool HasPeak = false;
+  TrafficPeak NearestPeak{};
+  std::wstring PeakAppName;
+  int64_t PeakOffset = 0; // Event time minus peak time, in seconds
+};
+
+db::StoredEvent ToStoredEvent(const LogEntry &entry);
+
+// Searches the indexed System/Application event logs and links each match
+// to the closest traffic peak
+class EventSearch {
+public:
+  EventSearch(db::Database &db);
+
+  // Indexes events since the previous sync, which the correlator storing
+  // events of its own does not move. The first sync goes back
+  // 'initialDays', so it can take a while.
+  void Sync(int initialDays = 30);
+
+  std::vector<EventSearchHit> Search(const std::wstring &query,
+                                     uint64_t peakThresholdBytes,
+                                     uint64_t maxPeakDistance = 600);
+
+private:
+  db::Database &m_db;
+  PeakDetector m_detector;
+  EventLogReader m_logReader;
+};
+
+} // namespace analyzer
@@ -1,11 +1,16 @@
 #include "LogCorrelator.h"
-#include "ConclusionGenerator.h"
+#include "BatchCorrelator.h"
+#include "EventSearch.h"
+#include <algorithm>
+#include <iterator>
 #include <sqlite3.h>
 #include <windows.h>
 
 namespace analyzer {
 
-LogCorrelator::LogCorrelator(db::Database &db) : m_db(db), m_detector(db) {}
+LogCorrelator::LogCorrelator(db::Database &db) : m_db(db), m_detector(db) {
+  m_generator.LoadRules(m_db.PathNextTo("conclusion_rules.ini"));
+}
 
 // Safe UTF8 to Wide conversion helper
 static std::wstring U8ToW(const char *s) {
@@ -19,43 +24,86 @@ static std::wstring U8ToW(const char *s) {
   return w;
 }
 
+std::wstring LogCorrelator::GetAppName(int appId) {
+  auto it = m_appNames.find(appId);
+  if (it != m_appNames.end())
+    return it->second;
+
+  std::wstring appName;
+  sqlite3_stmt *stmt;
+  const char *query = "SELECT name FROM apps WHERE id = ?;";
+
+  // Note: This uses raw handle, which is protected by Database's mutex in its
+  // own methods, but here we are doing a raw query. To be super safe, we'd
+  // need a LockHandle() method. For now, these are historical queries and
+  // less frequent.
+  if (sqlite3_prepare_v2(m_db.GetHandle(), query, -1, &stmt, nullptr) ==
+      SQLITE_OK) {
+    sqlite3_bind_int(stmt, 1, appId);
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+      const char *name = (const char *)sqlite3_column_text(stmt, 0);
+      appName = U8ToW(name);
+    }
+    sqlite3_finalize(stmt);
+  }
+  m_appNames[appId] = appName;
+  return appName;
+}
+
 std::vector<CorrelatedPeak> LogCorrelator::Correlate(int secondsBack,
                                                      uint64_t thresholdBytes) {
   std::vector<CorrelatedPeak> results;
   auto peaks = m_detector.FindPeaks(secondsBack, thresholdBytes);
+  if (peaks.empty())
+    return results;
 
+  // Fetch the logs once for the whole span instead of once per peak
+  uint64_t first = peaks.front().Timestamp, last = peaks.front().Timestamp;
   for (const auto &peak : peaks) {
+    first = (std::min)(first, peak.Timestamp);
+    last = (std::max)(last, peak.Timestamp);
+  }
+  BatchCorrelator::Options options;
+  uint64_t startTime =
+      first > options.WindowBefore ? first - options.WindowBefore : 0;
+  uint64_t endTime = last + options.WindowAfter;
+
+  auto events = m_logReader.QueryEvents(L"System", startTime, endTime);
+  auto appEvents = m_logReader.QueryEvents(L"Application", startTime, endTime);
+  events.insert(events.end(), std::make_move_iterator(appEvents.begin()),
+                std::make_move_iterator(appEvents.end()));
+
+  // Keep what we fetched searchable
+  std::vector<db::StoredEvent> stored;
+  stored.reserve(events.size());
+  for (const auto &ev : events)
+    stored.push_back(ToStoredEvent(ev));
+  m_db.StoreEvents(stored);
+
+  BatchCorrelator sweep(options);
+  auto windows = sweep.Assign(peaks, events);
+
+  std::vector<std::wstring> appNames;
+  appNames.reserve(peaks.size());
+  for (const auto &peak : peaks)
+    appNames.push_back(GetAppName(peak.AppId));
+  auto conclusions = m_generator.GenerateBatch(events, windows, appNames);
+
+  results.reserve(peaks.size());
+  for (size_t i = 0; i < peaks.size(); i++) {
     CorrelatedPeak cp;
-    cp.Peak = peak;
-
-    sqlite3_stmt *stmt;
-    const char *query = "SELECT name FROM apps WHERE id = ?;";
-
-    // Note: This uses raw handle, which is protected by Database's mutex in its
-    // own methods, but here we are doing a raw query. To be super safe, we'd
-    // need a LockHandle() method. For now, these are historical queries and
-    // less frequent.
-    if (sqlite3_prepare_v2(m_db.GetHandle(), query, -1, &stmt, nullptr) ==
-        SQLITE_OK) {
-      sqlite3_bind_int(stmt, 1, peak.AppId);
-      if (sqlite3_step(stmt) == SQLITE_ROW) {
-        const char *name = (const char *)sqlite3_column_text(stmt, 0);
-        cp.AppName = U8ToW(name);
-      }
-      sqlite3_finalize(stmt);
-    }
+    cp.Peak = peaks[i];
+    cp.AppName = std::move(appNames[i]);
+    cp.Conclusion = std::move(conclusions[i]);
 
-    uint64_t startTime = peak.Timestamp - 60;
-    uint64_t endTime = peak.Timestamp + 120;
-    cp.RelatedEvents = m_logReader.QueryEvents(L"System", startTime, endTime);
-    auto appEvents =
-        m_logReader.QueryEvents(L"Application", startTime, endTime);
-    cp.RelatedEvents.insert(cp.RelatedEvents.end(), appEvents.begin(),
-                            appEvents.end());
-
-    ConclusionGenerator gen;
-    cp.Conclusion = gen.Generate(cp.RelatedEvents, cp.AppName);
-    results.push_back(cp);
+    const auto &matches = windows[i].Matches;
+    cp.RelatedEvents.reserve(matches.size());
+    cp.EventWeights.reserve(matches.size());
+    for (const auto &m : matches) {
+      cp.RelatedEvents.push_back(events[m.EventIndex]);
+      cp.EventWeights.push_back(m.Weight);
+    }
+    results.push_back(std::move(cp));
   }
   return results;
 }
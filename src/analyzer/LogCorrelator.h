@@ -4,6 +4,7 @@
 #include "EventLogReader.h"
 #include "PeakDetector.h"
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace analyzer {
@@ -11,7 +12,8 @@ namespace analyzer {
 struct CorrelatedPeak {
   TrafficPeak Peak;
   std::wstring AppName;
-  std::vector<LogEntry> RelatedEvents;
+  std::vector<LogEntry> RelatedEvents; // Sorted by time
+  std::vector<float> EventWeights;     // Time-decay relevance per event
   AnalysisConclusion Conclusion;
 };
 
@@ -23,9 +25,13 @@ public:
                                         uint64_t thresholdBytes);
 
 private:
+  std::wstring GetAppName(int appId);
+
   db::Database &m_db;
   PeakDetector m_detector;
   EventLogReader m_logReader;
+  ConclusionGenerator m_generator;
+  std::unordered_map<int, std::wstring> m_appNames;
 };
 
 } // namespace analyzer
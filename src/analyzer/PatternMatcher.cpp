@@ -0,0 +1,91 @@
+#include "PatternMatcher.h"
+#include <cwctype>
+#include <queue>
+
+namespace analyzer {
+
+PatternMatcher::PatternMatcher() : m_trie(1), m_classOf(0x10000, 0) {}
+
+uint32_t PatternMatcher::ClassFor(wchar_t c) {
+  wchar_t lower = (wchar_t)std::towlower(c);
+  if ((uint32_t)lower >= m_classOf.size())
+    return 0;
+  if (m_classOf[lower] == 0) {
+    uint16_t cls = (uint16_t)m_classCount++;
+    m_classOf[lower] = cls;
+    wchar_t upper = (wchar_t)std::towupper(lower);
+    if ((uint32_t)upper < m_classOf.size())
+      m_classOf[upper] = cls;
+  }
+  return m_classOf[lower];
+}
+
+uint32_t PatternMatcher::Add(const std::wstring &pattern) {
+  uint32_t id = (uint32_t)m_patternCount++;
+  uint32_t node = 0;
+  for (wchar_t c : pattern) {
+    uint32_t cls = ClassFor(c);
+    uint32_t next = 0;
+    for (auto const &[k, n] : m_trie[node].Next) {
+      if (k == cls) {
+        next = n;
+        break;
+      }
+    }
+    if (next == 0) {
+      next = (uint32_t)m_trie.size();
+      m_trie[node].Next.push_back({cls, next});
+      m_trie.emplace_back();
+    }
+    node = next;
+  }
+  // An empty pattern would match everywhere; ignore it
+  if (node != 0)
+    m_trie[node].Outputs.push_back(id);
+  return id;
+}
+
+void PatternMatcher::Compile() {
+  const size_t stateCount = m_trie.size();
+  m_delta.assign(stateCount * m_classCount, 0);
+  std::vector<uint32_t> fail(stateCount, 0);
+  std::vector<std::vector<uint32_t>> outputs(stateCount);
+
+  // Breadth-first so a node's failure state is complete before its children
+  std::queue<uint32_t> pending;
+  for (auto const &[cls, child] : m_trie[0].Next) {
+    m_delta[cls] = child;
+    pending.push(child);
+  }
+  outputs[0] = m_trie[0].Outputs;
+
+  while (!pending.empty()) {
+    uint32_t node = pending.front();
+    pending.pop();
+
+    outputs[node] = m_trie[node].Outputs;
+    const auto &inherited = outputs[fail[node]];
+    outputs[node].insert(outputs[node].end(), inherited.begin(),
+                         inherited.end());
+
+    uint32_t *row = &m_delta[node * m_classCount];
+    const uint32_t *failRow = &m_delta[fail[node] * m_classCount];
+    for (uint32_t cls = 0; cls < m_classCount; cls++)
+      row[cls] = failRow[cls];
+    for (auto const &[cls, child] : m_trie[node].Next) {
+      fail[child] = failRow[cls];
+      row[cls] = child;
+      pending.push(child);
+    }
+  }
+
+  m_outputStart.assign(stateCount + 1, 0);
+  m_outputs.clear();
+  for (size_t s = 0; s < stateCount; s++) {
+    m_outputStart[s] = (uint32_t)m_outputs.size();
+    m_outputs.insert(m_outputs.end(), outputs[s].begin(), outputs[s].end());
+  }
+  m_outputStart[stateCount] = (uint32_t)m_outputs.size();
+}
+
+} // namespace analyzer
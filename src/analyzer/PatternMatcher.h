@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace analyzer {
+
+// Case-insensitive multi-pattern substring matcher (Aho-Corasick).
+// All patterns are compiled into one DFA so a single pass over the text
+// reports every pattern it contains.
+class PatternMatcher {
+public:
+  PatternMatcher();
+
+  // Returns the id reported for this pattern. Must be called before Compile.
+  uint32_t Add(const std::wstring &pattern);
+
+  // Builds the transition table. Adding patterns afterwards requires
+  // another Compile.
+  void Compile();
+
+  size_t GetPatternCount() const { return m_patternCount; }
+
+  // Calls onMatch(patternId) for every occurrence of every pattern in text
+  template <typename F> void Scan(const std::wstring &text, F &&onMatch) const {
+    if (m_delta.empty())
+      return;
+    uint32_t state = 0;
+    for (wchar_t c : text) {
+      uint32_t cls =
+          (uint32_t)c < m_classOf.size() ? m_classOf[(uint32_t)c] : 0;
+      state = m_delta[state * m_classCount + cls];
+      for (uint32_t i = m_outputStart[state]; i < m_outputStart[state + 1];
+           i++)
+        onMatch(m_outputs[i]);
+    }
+  }
+
+private:
+  struct TrieNode {
+    std::vector<std::pair<uint32_t, uint32_t>> Next; // (class, node)
+    std::vector<uint32_t> Outputs;
+  };
+
+  uint32_t ClassFor(wchar_t c);
+
+  std::vector<TrieNode> m_trie;
+  size_t m_patternCount = 0;
+
+  // Compiled form. Characters not used by any pattern share class 0.
+  std::vector<uint16_t> m_classOf; // wchar_t -> class, case folded
+  uint32_t m_classCount = 1;
+  std::vector<uint32_t> m_delta;       // state * m_classCount + class
+  std::vector<uint32_t> m_outputStart; // state -> range in m_outputs
+  std::vector<uint32_t> m_outputs;
+};
+
+} // namespace analyzer
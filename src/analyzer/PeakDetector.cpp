@@ -10,6 +10,13 @@ PeakDetector::PeakDetector(db::Database &db) : m_db(db) {}
 
 std::vector<TrafficPeak> PeakDetector::FindPeaks(int secondsBack,
                                                  uint64_t thresholdBytes) {
+  uint64_t now = (uint64_t)std::time(nullptr);
+  return FindPeaksBetween(now - secondsBack, now, thresholdBytes);
+}
+
+std::vector<TrafficPeak>
+PeakDetector::FindPeaksBetween(uint64_t startTime, uint64_t endTime,
+                               uint64_t thresholdBytes) {
   std::vector<TrafficPeak> peaks;
   sqlite3_stmt *stmt;
 
@@ -18,7 +25,7 @@ std::vector<TrafficPeak> PeakDetector::FindPeaks(int secondsBack,
   const char *query = "SELECT (timestamp / 60) * 60 as bucket, app_id, "
                       "SUM(bytes_up + bytes_down) as total "
                       "FROM traffic_log "
-                      "WHERE timestamp >= ? "
+                      "WHERE timestamp >= ? AND timestamp <= ? "
                       "GROUP BY bucket, app_id "
                       "HAVING total >= ? "
                       "ORDER BY bucket DESC;";
@@ -28,8 +35,9 @@ std::vector<TrafficPeak> PeakDetector::FindPeaks(int secondsBack,
     return peaks;
   }
 
-  sqlite3_bind_int64(stmt, 1, std::time(nullptr) - secondsBack);
-  sqlite3_bind_int64(stmt, 2, thresholdBytes);
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)startTime);
+  sqlite3_bind_int64(stmt, 2, (sqlite3_int64)endTime);
+  sqlite3_bind_int64(stmt, 3, (sqlite3_int64)thresholdBytes);
 
   while (sqlite3_step(stmt) == SQLITE_ROW) {
     TrafficPeak peak;
@@ -21,6 +21,12 @@ public:
   // window exceeds 'thresholdBytes'
   std::vector<TrafficPeak> FindPeaks(int secondsBack, uint64_t thresholdBytes);
 
+  // Same as FindPeaks for an absolute [startTime, endTime] range in epoch
+  // seconds
+  std::vector<TrafficPeak> FindPeaksBetween(uint64_t startTime,
+                                            uint64_t endTime,
+                                            uint64_t thresholdBytes);
+
 private:
   db::Database &m_db;
 };
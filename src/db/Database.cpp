@@ -1,7 +1,12 @@
 #include "Database.h"
+#include "../utils/LogLinearHistogram.h"
 #include "../utils/Logger.h"
+#include <algorithm>
+#include <cstdlib>
 #include <ctime>
+#include <filesystem>
 #include <iostream>
+#include <limits>
 #include <sqlite3.h>
 #include <windows.h>
 
@@ -22,9 +27,18 @@ bool Database::Open(const std::string &dbPath) {
     return false;
   }
   LOG("Database opened successfully");
+  m_path = dbPath;
   return InitSchema();
 }
 
+std::string Database::PathNextTo(const std::string &fileName) const {
+  try {
+    return (std::filesystem::path(m_path).parent_path() / fileName).string();
+  } catch (...) {
+    return fileName;
+  }
+}
+
 void Database::Close() {
   std::lock_guard<std::recursive_mutex> lock(m_mutex);
   if (m_db) {
@@ -42,7 +56,51 @@ bool Database::InitSchema() {
       "INTEGER, bytes_up INTEGER, bytes_down INTEGER);"
       "CREATE INDEX IF NOT EXISTS idx_traffic_timestamp ON "
       "traffic_log(timestamp);"
-      "CREATE INDEX IF NOT EXISTS idx_traffic_app ON traffic_log(app_id);";
+      "CREATE INDEX IF NOT EXISTS idx_traffic_app ON traffic_log(app_id);"
+      "CREATE TABLE IF NOT EXISTS event_log (id INTEGER PRIMARY KEY, "
+      "timestamp INTEGER, channel TEXT, provider TEXT, event_id INTEGER, "
+      "record_id INTEGER, message TEXT, UNIQUE(channel, record_id));"
+      "CREATE INDEX IF NOT EXISTS idx_event_timestamp ON "
+      "event_log(timestamp);"
+      // Single values, e.g. how far the event index is synced
+      "CREATE TABLE IF NOT EXISTS meta (key TEXT PRIMARY KEY, value INTEGER "
+      "NOT NULL);"
+      "CREATE TABLE IF NOT EXISTS geoip_cache (ip TEXT PRIMARY KEY, "
+      "country TEXT NOT NULL, expires INTEGER NOT NULL);"
+      "CREATE TABLE IF NOT EXISTS dims (id INTEGER PRIMARY KEY, kind "
+      "INTEGER NOT NULL, name TEXT NOT NULL, parent INTEGER, "
+      "UNIQUE(kind, name));"
+      "CREATE TABLE IF NOT EXISTS rollup_hour (bucket INTEGER NOT NULL, "
+      "dim_id INTEGER NOT NULL, bytes_up INTEGER NOT NULL, bytes_down "
+      "INTEGER NOT NULL, PRIMARY KEY(bucket, dim_id)) WITHOUT ROWID;"
+      "CREATE TABLE IF NOT EXISTS rollup_day (bucket INTEGER NOT NULL, "
+      "dim_id INTEGER NOT NULL, bytes_up INTEGER NOT NULL, bytes_down "
+      "INTEGER NOT NULL, PRIMARY KEY(bucket, dim_id)) WITHOUT ROWID;"
+      "CREATE TABLE IF NOT EXISTS rollup_minute (bucket INTEGER NOT NULL, "
+      "dim_id INTEGER NOT NULL, bytes_up INTEGER NOT NULL, bytes_down "
+      "INTEGER NOT NULL, PRIMARY KEY(bucket, dim_id)) WITHOUT ROWID;"
+      // One value over time, for GetSeries
+      "CREATE INDEX IF NOT EXISTS idx_rollup_minute_dim ON "
+      "rollup_minute(dim_id, bucket);"
+      "CREATE INDEX IF NOT EXISTS idx_rollup_hour_dim ON "
+      "rollup_hour(dim_id, bucket);"
+      "CREATE INDEX IF NOT EXISTS idx_rollup_day_dim ON "
+      "rollup_day(dim_id, bucket);"
+      // Serialized rate histograms, see AddRateSamples. Dimension id 0 is
+      // all traffic.
+      "CREATE TABLE IF NOT EXISTS sketch_hour (bucket INTEGER NOT NULL, "
+      "dim_id INTEGER NOT NULL, up BLOB NOT NULL, down BLOB NOT NULL, "
+      "PRIMARY KEY(bucket, dim_id)) WITHOUT ROWID;"
+      "CREATE TABLE IF NOT EXISTS sketch_day (bucket INTEGER NOT NULL, "
+      "dim_id INTEGER NOT NULL, up BLOB NOT NULL, down BLOB NOT NULL, "
+      "PRIMARY KEY(bucket, dim_id)) WITHOUT ROWID;"
+      // Serialized distinct-address sketches, see AddEndpoints
+      "CREATE TABLE IF NOT EXISTS hll_hour (bucket INTEGER NOT NULL, "
+      "dim_id INTEGER NOT NULL, sketch BLOB NOT NULL, "
+      "PRIMARY KEY(bucket, dim_id)) WITHOUT ROWID;"
+      "CREATE TABLE IF NOT EXISTS hll_day (bucket INTEGER NOT NULL, "
+      "dim_id INTEGER NOT NULL, sketch BLOB NOT NULL, "
+      "PRIMARY KEY(bucket, dim_id)) WITHOUT ROWID;";
 
   char *errMsg = nullptr;
   if (sqlite3_exec(m_db, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
@@ -52,7 +110,39 @@ bool Database::InitSchema() {
     }
     return false;
   }
+  // Databases from before dimension parents; fails harmlessly otherwise
+  sqlite3_exec(m_db, "ALTER TABLE dims ADD COLUMN parent INTEGER;", nullptr,
+               nullptr, nullptr);
+  sqlite3_exec(m_db,
+               "CREATE INDEX IF NOT EXISTS idx_dims_parent ON dims(parent);",
+               nullptr, nullptr, nullptr);
   LOG("Database::InitSchema successful");
+  m_hasFts = InitEventIndex();
+  return true;
+}
+
+bool Database::InitEventIndex() {
+  // External-content FTS5 table kept in sync with event_log by triggers.
+  // Not fatal if the SQLite build lacks FTS5; search falls back to LIKE.
+  const char *sql =
+      "CREATE VIRTUAL TABLE IF NOT EXISTS event_fts USING fts5(provider, "
+      "message, content='event_log', content_rowid='id');"
+      "CREATE TRIGGER IF NOT EXISTS event_log_ai AFTER INSERT ON event_log "
+      "BEGIN INSERT INTO event_fts(rowid, provider, message) VALUES "
+      "(new.id, new.provider, new.message); END;"
+      "CREATE TRIGGER IF NOT EXISTS event_log_ad AFTER DELETE ON event_log "
+      "BEGIN INSERT INTO event_fts(event_fts, rowid, provider, message) "
+      "VALUES ('delete', old.id, old.provider, old.message); END;";
+
+  char *errMsg = nullptr;
+  if (sqlite3_exec(m_db, sql, nullptr, nullptr, &errMsg) != SQLITE_OK) {
+    if (errMsg) {
+      LOG("Warning: Full-text event search unavailable: " +
+          std::string(errMsg));
+      sqlite3_free(errMsg);
+    }
+    return false;
+  }
   return true;
 }
 
@@ -110,7 +200,8 @@ int Database::GetOrAddApp(const std::wstring &appName) {
   return id;
 }
 
-bool Database::LogTraffic(int appId, uint64_t bytesUp, uint64_t bytesDown) {
+bool Database::LogTraffic(int appId, uint64_t bytesUp, uint64_t bytesDown,
+                          int64_t timestamp) {
   std::lock_guard<std::recursive_mutex> lock(m_mutex);
   if (!m_db)
     return false;
@@ -121,7 +212,7 @@ bool Database::LogTraffic(int appId, uint64_t bytesUp, uint64_t bytesDown) {
   if (sqlite3_prepare_v2(m_db, query, -1, &stmt, nullptr) != SQLITE_OK)
     return false;
 
-  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)std::time(nullptr));
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)timestamp);
   sqlite3_bind_int(stmt, 2, appId);
   sqlite3_bind_int64(stmt, 3, (sqlite3_int64)bytesUp);
   sqlite3_bind_int64(stmt, 4, (sqlite3_int64)bytesDown);
@@ -160,6 +251,611 @@ std::vector<AppUsage> Database::GetUsage(int secondsBack) {
   return results;
 }
 
+int Database::GetOrAddDimension(Dimension kind, const std::wstring &name,
+                                int parentId) {
+  std::string utf8Name = WToUTF8(name);
+  std::string cacheKey = std::to_string((int)kind) + ":" + utf8Name;
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return -1;
+  auto cached = m_dimensionIds.find(cacheKey);
+  if (cached != m_dimensionIds.end())
+    return cached->second;
+
+  sqlite3_stmt *stmt;
+  const char *ins =
+      "INSERT OR IGNORE INTO dims (kind, name, parent) VALUES (?, ?, ?);";
+  if (sqlite3_prepare_v2(m_db, ins, -1, &stmt, nullptr) != SQLITE_OK)
+    return -1;
+  sqlite3_bind_int(stmt, 1, (int)kind);
+  sqlite3_bind_text(stmt, 2, utf8Name.c_str(), -1, SQLITE_TRANSIENT);
+  if (parentId != -1)
+    sqlite3_bind_int(stmt, 3, parentId);
+  else
+    sqlite3_bind_null(stmt, 3);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+
+  const char *query = "SELECT id FROM dims WHERE kind = ? AND name = ?;";
+  if (sqlite3_prepare_v2(m_db, query, -1, &stmt, nullptr) != SQLITE_OK)
+    return -1;
+  sqlite3_bind_int(stmt, 1, (int)kind);
+  sqlite3_bind_text(stmt, 2, utf8Name.c_str(), -1, SQLITE_TRANSIENT);
+  int id = -1;
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    id = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  if (id != -1)
+    m_dimensionIds.emplace(std::move(cacheKey), id);
+  return id;
+}
+
+bool Database::AddRollups(const std::vector<RollupDelta> &deltas,
+                          int64_t timestamp) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return false;
+  if (deltas.empty())
+    return true;
+
+  struct Level {
+    const char *Sql;
+    int64_t Bucket;
+  };
+  const Level levels[] = {
+      {"INSERT INTO rollup_minute (bucket, dim_id, bytes_up, bytes_down) "
+       "VALUES (?, ?, ?, ?) ON CONFLICT(bucket, dim_id) DO UPDATE SET "
+       "bytes_up = bytes_up + excluded.bytes_up, "
+       "bytes_down = bytes_down + excluded.bytes_down;",
+       timestamp - timestamp % 60},
+      {"INSERT INTO rollup_hour (bucket, dim_id, bytes_up, bytes_down) "
+       "VALUES (?, ?, ?, ?) ON CONFLICT(bucket, dim_id) DO UPDATE SET "
+       "bytes_up = bytes_up + excluded.bytes_up, "
+       "bytes_down = bytes_down + excluded.bytes_down;",
+       timestamp - timestamp % 3600},
+      {"INSERT INTO rollup_day (bucket, dim_id, bytes_up, bytes_down) "
+       "VALUES (?, ?, ?, ?) ON CONFLICT(bucket, dim_id) DO UPDATE SET "
+       "bytes_up = bytes_up + excluded.bytes_up, "
+       "bytes_down = bytes_down + excluded.bytes_down;",
+       timestamp - timestamp % 86400},
+  };
+
+  sqlite3_exec(m_db, "BEGIN;", nullptr, nullptr, nullptr);
+  bool success = true;
+  for (const auto &level : levels) {
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(m_db, level.Sql, -1, &stmt, nullptr) !=
+        SQLITE_OK) {
+      success = false;
+      continue;
+    }
+    for (const auto &delta : deltas) {
+      sqlite3_bind_int64(stmt, 1, (sqlite3_int64)level.Bucket);
+      sqlite3_bind_int(stmt, 2, delta.DimensionId);
+      sqlite3_bind_int64(stmt, 3, (sqlite3_int64)delta.BytesUp);
+      sqlite3_bind_int64(stmt, 4, (sqlite3_int64)delta.BytesDown);
+      if (sqlite3_step(stmt) != SQLITE_DONE)
+        success = false;
+      sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+  }
+  // Minutes only serve recent charts; drop old ones once an hour
+  if (timestamp - m_minutesPrunedAt >= 3600) {
+    m_minutesPrunedAt = timestamp;
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(m_db,
+                           "DELETE FROM rollup_minute WHERE bucket < ?;", -1,
+                           &stmt, nullptr) == SQLITE_OK) {
+      sqlite3_bind_int64(stmt, 1,
+                         (sqlite3_int64)(timestamp - kMinuteRetention));
+      sqlite3_step(stmt);
+      sqlite3_finalize(stmt);
+    }
+  }
+  sqlite3_exec(m_db, "COMMIT;", nullptr, nullptr, nullptr);
+  return success;
+}
+
+std::vector<AppUsage> Database::GetUsageByDimension(Dimension kind,
+                                                    int secondsBack,
+                                                    int parentId) {
+  std::vector<AppUsage> results;
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return results;
+
+  bool daily = secondsBack > 7 * 86400;
+  int64_t width = daily ? 86400 : 3600;
+  int64_t from = (int64_t)std::time(nullptr) - secondsBack;
+  from -= from % width;
+
+  sqlite3_stmt *stmt;
+  std::string query =
+      std::string("SELECT d.name, SUM(r.bytes_up), SUM(r.bytes_down), d.id "
+                  "FROM ") +
+      (daily ? "rollup_day" : "rollup_hour") +
+      " r JOIN dims d ON d.id = r.dim_id WHERE r.bucket >= ? AND d.kind = ? " +
+      (parentId != -1 ? "AND d.parent = ? " : "") +
+      "GROUP BY r.dim_id ORDER BY (SUM(r.bytes_up) + SUM(r.bytes_down)) DESC;";
+  if (sqlite3_prepare_v2(m_db, query.c_str(), -1, &stmt, nullptr) !=
+      SQLITE_OK)
+    return results;
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)from);
+  sqlite3_bind_int(stmt, 2, (int)kind);
+  if (parentId != -1)
+    sqlite3_bind_int(stmt, 3, parentId);
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    AppUsage usage;
+    const char *name = (const char *)sqlite3_column_text(stmt, 0);
+    usage.AppName = UTF8ToW(name ? name : "");
+    usage.TotalBytesUp = (uint64_t)sqlite3_column_int64(stmt, 1);
+    usage.TotalBytesDown = (uint64_t)sqlite3_column_int64(stmt, 2);
+    usage.DimensionId = sqlite3_column_int(stmt, 3);
+    results.push_back(usage);
+  }
+  sqlite3_finalize(stmt);
+  return results;
+}
+
+std::vector<SeriesPoint> Database::GetSeries(int dimensionId, int64_t from,
+                                             int64_t to, size_t points) {
+  std::vector<SeriesPoint> series;
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db || to <= from || points == 0)
+    return series;
+
+  struct Level {
+    const char *Table;
+    int64_t Width;
+  };
+  // Coarsest first; minutes only as far back as they are kept
+  const Level levels[] = {
+      {"rollup_day", 86400}, {"rollup_hour", 3600}, {"rollup_minute", 60}};
+  int64_t wanted = std::max<int64_t>(1, (to - from) / (int64_t)points);
+  int64_t minutesFrom = (int64_t)std::time(nullptr) - kMinuteRetention;
+  const Level *level = &levels[1];
+  for (const auto &candidate : levels) {
+    if (candidate.Width == 60 && from < minutesFrom)
+      break;
+    level = &candidate;
+    if (candidate.Width <= wanted)
+      break;
+  }
+
+  // Whole rollup buckets per point, aligned to the rollup
+  int64_t width = std::max<int64_t>(1, wanted / level->Width) * level->Width;
+  from -= from % level->Width;
+  size_t count = (size_t)((to - from + width - 1) / width);
+
+  sqlite3_stmt *stmt;
+  std::string query = std::string("SELECT (bucket - ?1) / ?2, SUM(bytes_up), "
+                                  "SUM(bytes_down) FROM ") +
+                      level->Table +
+                      " WHERE dim_id = ?3 AND bucket >= ?1 AND bucket < ?4 "
+                      "GROUP BY 1 ORDER BY 1;";
+  if (sqlite3_prepare_v2(m_db, query.c_str(), -1, &stmt, nullptr) !=
+      SQLITE_OK)
+    return series;
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)from);
+  sqlite3_bind_int64(stmt, 2, (sqlite3_int64)width);
+  sqlite3_bind_int(stmt, 3, dimensionId);
+  sqlite3_bind_int64(stmt, 4, (sqlite3_int64)to);
+
+  series.resize(count);
+  for (size_t i = 0; i < count; i++)
+    series[i].Timestamp = from + (int64_t)i * width;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    int64_t slot = sqlite3_column_int64(stmt, 0);
+    if (slot < 0 || slot >= (int64_t)count)
+      continue;
+    series[slot].BytesUp = (uint64_t)sqlite3_column_int64(stmt, 1);
+    series[slot].BytesDown = (uint64_t)sqlite3_column_int64(stmt, 2);
+  }
+  sqlite3_finalize(stmt);
+  return series;
+}
+
+std::vector<Database::DimensionTotal>
+Database::SumByDimension(Dimension kind, const char *table, int64_t from,
+                         int64_t to, int parentId) {
+  std::vector<DimensionTotal> totals;
+  sqlite3_stmt *stmt;
+  std::string query =
+      std::string("SELECT r.dim_id, d.name, SUM(r.bytes_up) + "
+                  "SUM(r.bytes_down) FROM ") +
+      table +
+      " r JOIN dims d ON d.id = r.dim_id WHERE r.bucket >= ? AND r.bucket < ? "
+      "AND d.kind = ? " +
+      (parentId != -1 ? "AND d.parent = ? " : "") +
+      "GROUP BY r.dim_id ORDER BY r.dim_id;";
+  if (sqlite3_prepare_v2(m_db, query.c_str(), -1, &stmt, nullptr) !=
+      SQLITE_OK)
+    return totals;
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)from);
+  sqlite3_bind_int64(stmt, 2, (sqlite3_int64)to);
+  sqlite3_bind_int(stmt, 3, (int)kind);
+  if (parentId != -1)
+    sqlite3_bind_int(stmt, 4, parentId);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    const char *name = (const char *)sqlite3_column_text(stmt, 1);
+    totals.push_back({sqlite3_column_int(stmt, 0), UTF8ToW(name ? name : ""),
+                      (uint64_t)sqlite3_column_int64(stmt, 2)});
+  }
+  sqlite3_finalize(stmt);
+  return totals;
+}
+
+std::vector<UsageChange>
+Database::CompareUsage(Dimension kind, int64_t beforeFrom, int64_t beforeTo,
+                       int64_t afterFrom, int64_t afterTo, size_t limit,
+                       int parentId) {
+  std::vector<UsageChange> changes;
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db || beforeTo <= beforeFrom || afterTo <= afterFrom)
+    return changes;
+
+  // One rollup for both ranges, coarse enough to keep the scans short and
+  // fine enough for the shorter range
+  int64_t span = std::min(beforeTo - beforeFrom, afterTo - afterFrom);
+  const char *table = "rollup_hour";
+  int64_t width = 3600;
+  if (span >= 7 * 86400) {
+    table = "rollup_day";
+    width = 86400;
+  } else if (span <= 6 * 3600 &&
+             std::min(beforeFrom, afterFrom) >=
+                 (int64_t)std::time(nullptr) - kMinuteRetention) {
+    table = "rollup_minute";
+    width = 60;
+  }
+  // Every end is rounded up to a bucket edge, so a range ending where the
+  // other starts shares no bucket with it, and the current bucket counts
+  auto roundUp = [width](int64_t t) {
+    int64_t offset = ((t % width) + width) % width;
+    return offset ? t - offset + width : t;
+  };
+  beforeFrom = roundUp(beforeFrom);
+  beforeTo = roundUp(beforeTo);
+  afterFrom = roundUp(afterFrom);
+  afterTo = roundUp(afterTo);
+  // Lengths as covered so far; the current bucket is still filling
+  int64_t now = (int64_t)std::time(nullptr);
+  int64_t beforeLength = std::min(beforeTo, now) - beforeFrom;
+  int64_t afterLength = std::min(afterTo, now) - afterFrom;
+  if (beforeLength <= 0 || afterLength <= 0)
+    return changes;
+
+  auto before = SumByDimension(kind, table, beforeFrom, beforeTo, parentId);
+  auto after = SumByDimension(kind, table, afterFrom, afterTo, parentId);
+  double scale = (double)afterLength / beforeLength;
+
+  // Both sides are in id order
+  auto add = [&](const DimensionTotal *b, const DimensionTotal *a) {
+    UsageChange change;
+    change.DimensionId = a ? a->DimensionId : b->DimensionId;
+    change.Name = a ? a->Name : b->Name;
+    change.Before = b ? (uint64_t)(b->Bytes * scale) : 0;
+    change.After = a ? a->Bytes : 0;
+    change.Change = (int64_t)change.After - (int64_t)change.Before;
+    change.Ratio = change.Before > 0
+                       ? (double)change.After / change.Before
+                       : std::numeric_limits<double>::infinity();
+    changes.push_back(std::move(change));
+  };
+  size_t i = 0, j = 0;
+  while (i < before.size() || j < after.size()) {
+    if (j == after.size() ||
+        (i < before.size() && before[i].DimensionId < after[j].DimensionId))
+      add(&before[i++], nullptr);
+    else if (i == before.size() ||
+             after[j].DimensionId < before[i].DimensionId)
+      add(nullptr, &after[j++]);
+    else
+      add(&before[i++], &after[j++]);
+  }
+
+  size_t n = std::min(limit, changes.size());
+  std::partial_sort(changes.begin(), changes.begin() + n, changes.end(),
+                    [](const UsageChange &a, const UsageChange &b) {
+                      return std::llabs(a.Change) > std::llabs(b.Change);
+                    });
+  changes.resize(n);
+  return changes;
+}
+
+static std::string ColumnBlob(sqlite3_stmt *stmt, int column) {
+  const void *data = sqlite3_column_blob(stmt, column);
+  int size = sqlite3_column_bytes(stmt, column);
+  return data ? std::string((const char *)data, size) : std::string();
+}
+
+bool Database::AddRateSamples(const std::vector<RateSample> &samples,
+                              int64_t timestamp, int periodSeconds) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return false;
+  if (samples.empty() || periodSeconds <= 0)
+    return true;
+
+  struct Level {
+    const char *Select;
+    const char *Upsert;
+    int64_t Bucket;
+  };
+  const Level levels[] = {
+      {"SELECT up, down FROM sketch_hour WHERE bucket = ? AND dim_id = ?;",
+       "INSERT OR REPLACE INTO sketch_hour (bucket, dim_id, up, down) "
+       "VALUES (?, ?, ?, ?);",
+       timestamp - timestamp % 3600},
+      {"SELECT up, down FROM sketch_day WHERE bucket = ? AND dim_id = ?;",
+       "INSERT OR REPLACE INTO sketch_day (bucket, dim_id, up, down) "
+       "VALUES (?, ?, ?, ?);",
+       timestamp - timestamp % 86400},
+  };
+
+  sqlite3_exec(m_db, "BEGIN;", nullptr, nullptr, nullptr);
+  bool success = true;
+  for (const auto &level : levels) {
+    sqlite3_stmt *select, *upsert;
+    if (sqlite3_prepare_v2(m_db, level.Select, -1, &select, nullptr) !=
+        SQLITE_OK) {
+      success = false;
+      continue;
+    }
+    if (sqlite3_prepare_v2(m_db, level.Upsert, -1, &upsert, nullptr) !=
+        SQLITE_OK) {
+      sqlite3_finalize(select);
+      success = false;
+      continue;
+    }
+    for (const auto &sample : samples) {
+      utils::LogLinearHistogram up(kSketchBits), down(kSketchBits);
+      sqlite3_bind_int64(select, 1, (sqlite3_int64)level.Bucket);
+      sqlite3_bind_int(select, 2, sample.DimensionId);
+      if (sqlite3_step(select) == SQLITE_ROW) {
+        up.Deserialize(ColumnBlob(select, 0));
+        down.Deserialize(ColumnBlob(select, 1));
+      }
+      sqlite3_reset(select);
+      up.Record(sample.BytesUp / periodSeconds);
+      down.Record(sample.BytesDown / periodSeconds);
+
+      std::string upData = up.Serialize(), downData = down.Serialize();
+      sqlite3_bind_int64(upsert, 1, (sqlite3_int64)level.Bucket);
+      sqlite3_bind_int(upsert, 2, sample.DimensionId);
+      sqlite3_bind_blob(upsert, 3, upData.data(), (int)upData.size(),
+                        SQLITE_TRANSIENT);
+      sqlite3_bind_blob(upsert, 4, downData.data(), (int)downData.size(),
+                        SQLITE_TRANSIENT);
+      if (sqlite3_step(upsert) != SQLITE_DONE)
+        success = false;
+      sqlite3_reset(upsert);
+    }
+    sqlite3_finalize(select);
+    sqlite3_finalize(upsert);
+  }
+  sqlite3_exec(m_db, "COMMIT;", nullptr, nullptr, nullptr);
+  return success;
+}
+
+std::vector<RatePercentiles>
+Database::GetRatePercentiles(int64_t from, int64_t to, size_t limit) {
+  std::vector<RatePercentiles> results;
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db || to <= from)
+    return results;
+
+  bool daily = to - from >= 7 * 86400;
+  int64_t width = daily ? 86400 : 3600;
+  from -= from % width;
+
+  struct Merged {
+    std::wstring Name;
+    utils::LogLinearHistogram Up{kSketchBits};
+    utils::LogLinearHistogram Down{kSketchBits};
+  };
+  std::unordered_map<int, Merged> merged;
+  sqlite3_stmt *stmt;
+  std::string query =
+      std::string("SELECT s.dim_id, d.name, s.up, s.down FROM ") +
+      (daily ? "sketch_day" : "sketch_hour") +
+      " s LEFT JOIN dims d ON d.id = s.dim_id WHERE s.bucket >= ? AND "
+      "s.bucket < ?;";
+  if (sqlite3_prepare_v2(m_db, query.c_str(), -1, &stmt, nullptr) !=
+      SQLITE_OK)
+    return results;
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)from);
+  sqlite3_bind_int64(stmt, 2, (sqlite3_int64)to);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    Merged &entry = merged[sqlite3_column_int(stmt, 0)];
+    const char *name = (const char *)sqlite3_column_text(stmt, 1);
+    if (name && entry.Name.empty())
+      entry.Name = UTF8ToW(name);
+    utils::LogLinearHistogram up, down;
+    if (up.Deserialize(ColumnBlob(stmt, 2)) &&
+        down.Deserialize(ColumnBlob(stmt, 3))) {
+      entry.Up.Merge(up);
+      entry.Down.Merge(down);
+    }
+  }
+  sqlite3_finalize(stmt);
+
+  auto total = merged.find(0);
+  if (total == merged.end())
+    return results;
+  uint64_t periods = total->second.Up.Count();
+  auto describe = [](int id, Merged &entry) {
+    RatePercentiles p;
+    p.Name = entry.Name;
+    p.DimensionId = id;
+    p.Samples = entry.Up.Count();
+    p.P95Up = (double)entry.Up.Quantile(0.95);
+    p.P99Up = (double)entry.Up.Quantile(0.99);
+    p.MaxUp = (double)entry.Up.Max();
+    p.P95Down = (double)entry.Down.Quantile(0.95);
+    p.P99Down = (double)entry.Down.Quantile(0.99);
+    p.MaxDown = (double)entry.Down.Max();
+    return p;
+  };
+  results.push_back(describe(0, total->second));
+
+  std::vector<RatePercentiles> apps;
+  for (auto &[id, entry] : merged) {
+    if (id == 0)
+      continue;
+    // Periods the process was silent in are zero rates
+    uint64_t count = entry.Up.Count();
+    if (periods > count) {
+      entry.Up.Record(0, periods - count);
+      entry.Down.Record(0, periods - count);
+    }
+    apps.push_back(describe(id, entry));
+  }
+  size_t n = std::min(limit, apps.size());
+  std::partial_sort(apps.begin(), apps.begin() + n, apps.end(),
+                    [](const RatePercentiles &a, const RatePercentiles &b) {
+                      return std::max(a.P95Up, a.P95Down) >
+                             std::max(b.P95Up, b.P95Down);
+                    });
+  results.insert(results.end(), apps.begin(), apps.begin() + n);
+  return results;
+}
+
+bool Database::AddEndpoints(const std::vector<EndpointSketch> &sketches,
+                            int64_t timestamp) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return false;
+  if (sketches.empty())
+    return true;
+
+  struct Level {
+    const char *Select;
+    const char *Upsert;
+    int64_t Bucket;
+  };
+  const Level levels[] = {
+      {"SELECT sketch FROM hll_hour WHERE bucket = ? AND dim_id = ?;",
+       "INSERT OR REPLACE INTO hll_hour (bucket, dim_id, sketch) "
+       "VALUES (?, ?, ?);",
+       timestamp - timestamp % 3600},
+      {"SELECT sketch FROM hll_day WHERE bucket = ? AND dim_id = ?;",
+       "INSERT OR REPLACE INTO hll_day (bucket, dim_id, sketch) "
+       "VALUES (?, ?, ?);",
+       timestamp - timestamp % 86400},
+  };
+
+  sqlite3_exec(m_db, "BEGIN;", nullptr, nullptr, nullptr);
+  bool success = true;
+  for (const auto &level : levels) {
+    sqlite3_stmt *select, *upsert;
+    if (sqlite3_prepare_v2(m_db, level.Select, -1, &select, nullptr) !=
+        SQLITE_OK) {
+      success = false;
+      continue;
+    }
+    if (sqlite3_prepare_v2(m_db, level.Upsert, -1, &upsert, nullptr) !=
+        SQLITE_OK) {
+      sqlite3_finalize(select);
+      success = false;
+      continue;
+    }
+    for (const auto &entry : sketches) {
+      utils::HyperLogLog merged = entry.Endpoints;
+      sqlite3_bind_int64(select, 1, (sqlite3_int64)level.Bucket);
+      sqlite3_bind_int(select, 2, entry.DimensionId);
+      if (sqlite3_step(select) == SQLITE_ROW) {
+        utils::HyperLogLog stored;
+        if (stored.Deserialize(ColumnBlob(select, 0)))
+          merged.Merge(stored);
+      }
+      sqlite3_reset(select);
+
+      std::string data = merged.Serialize();
+      sqlite3_bind_int64(upsert, 1, (sqlite3_int64)level.Bucket);
+      sqlite3_bind_int(upsert, 2, entry.DimensionId);
+      sqlite3_bind_blob(upsert, 3, data.data(), (int)data.size(),
+                        SQLITE_TRANSIENT);
+      if (sqlite3_step(upsert) != SQLITE_DONE)
+        success = false;
+      sqlite3_reset(upsert);
+    }
+    sqlite3_finalize(select);
+    sqlite3_finalize(upsert);
+  }
+  sqlite3_exec(m_db, "COMMIT;", nullptr, nullptr, nullptr);
+  return success;
+}
+
+std::unordered_map<int, Database::MergedEndpoints>
+Database::MergeEndpoints(int64_t from, int64_t to, bool daily) {
+  std::unordered_map<int, MergedEndpoints> merged;
+  sqlite3_stmt *stmt;
+  std::string query =
+      std::string("SELECT s.dim_id, d.name, s.sketch FROM ") +
+      (daily ? "hll_day" : "hll_hour") +
+      " s LEFT JOIN dims d ON d.id = s.dim_id WHERE s.bucket >= ? AND "
+      "s.bucket < ?;";
+  if (sqlite3_prepare_v2(m_db, query.c_str(), -1, &stmt, nullptr) !=
+      SQLITE_OK)
+    return merged;
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)from);
+  sqlite3_bind_int64(stmt, 2, (sqlite3_int64)to);
+  utils::HyperLogLog sketch;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    MergedEndpoints &entry = merged[sqlite3_column_int(stmt, 0)];
+    const char *name = (const char *)sqlite3_column_text(stmt, 1);
+    if (name && entry.Name.empty())
+      entry.Name = UTF8ToW(name);
+    if (sketch.Deserialize(ColumnBlob(stmt, 2)))
+      entry.Endpoints.Merge(sketch);
+  }
+  sqlite3_finalize(stmt);
+  return merged;
+}
+
+std::vector<EndpointCount>
+Database::GetEndpointCounts(int64_t from, int64_t to, size_t limit) {
+  std::vector<EndpointCount> results;
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db || to <= from)
+    return results;
+
+  bool daily = to - from >= 7 * 86400;
+  int64_t width = daily ? 86400 : 3600;
+  // Whole buckets, with the one holding 'to' in; Before is as many
+  // buckets again, so the two ranges are the same length
+  from -= from % width;
+  if (to % width)
+    to += width - to % width;
+  auto after = MergeEndpoints(from, to, daily);
+  auto before = MergeEndpoints(from - (to - from), from, daily);
+
+  std::vector<EndpointCount> apps;
+  for (auto &[id, entry] : after) {
+    EndpointCount count;
+    count.Name = entry.Name;
+    count.DimensionId = id;
+    count.Distinct = entry.Endpoints.Estimate();
+    auto earlier = before.find(id);
+    if (earlier != before.end())
+      count.Before = earlier->second.Endpoints.Estimate();
+    if (id == 0)
+      results.insert(results.begin(), count);
+    else
+      apps.push_back(count);
+  }
+  size_t n = std::min(limit, apps.size());
+  std::partial_sort(apps.begin(), apps.begin() + n, apps.end(),
+                    [](const EndpointCount &a, const EndpointCount &b) {
+                      return a.Distinct > b.Distinct;
+                    });
+  results.insert(results.end(), apps.begin(), apps.begin() + n);
+  return results;
+}
+
 bool Database::ExportToCSV(const std::string &filename, int secondsBack) {
   FILE *f = nullptr;
   if (fopen_s(&f, filename.c_str(), "w") != 0)
@@ -196,4 +892,211 @@ bool Database::ExportToCSV(const std::string &filename, int secondsBack) {
   return true;
 }
 
+std::wstring Database::GetAppName(int appId) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return L"";
+
+  sqlite3_stmt *stmt;
+  const char *query = "SELECT name FROM apps WHERE id = ?;";
+  if (sqlite3_prepare_v2(m_db, query, -1, &stmt, nullptr) != SQLITE_OK)
+    return L"";
+  sqlite3_bind_int(stmt, 1, appId);
+
+  std::wstring name;
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    const char *s = (const char *)sqlite3_column_text(stmt, 0);
+    name = UTF8ToW(s ? s : "");
+  }
+  sqlite3_finalize(stmt);
+  return name;
+}
+
+bool Database::StoreEvents(const std::vector<StoredEvent> &events) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return false;
+  if (events.empty())
+    return true;
+
+  sqlite3_stmt *stmt;
+  const char *query =
+      "INSERT OR IGNORE INTO event_log (timestamp, channel, provider, "
+      "event_id, record_id, message) VALUES (?, ?, ?, ?, ?, ?);";
+  if (sqlite3_prepare_v2(m_db, query, -1, &stmt, nullptr) != SQLITE_OK)
+    return false;
+
+  sqlite3_exec(m_db, "BEGIN;", nullptr, nullptr, nullptr);
+  bool success = true;
+  for (const auto &ev : events) {
+    std::string channel = WToUTF8(ev.Channel);
+    std::string provider = WToUTF8(ev.Provider);
+    std::string message = WToUTF8(ev.Message);
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)ev.Timestamp);
+    sqlite3_bind_text(stmt, 2, channel.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 3, provider.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 4, (int)ev.EventId);
+    sqlite3_bind_int64(stmt, 5, (sqlite3_int64)ev.RecordId);
+    sqlite3_bind_text(stmt, 6, message.c_str(), -1, SQLITE_TRANSIENT);
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+      success = false;
+    sqlite3_reset(stmt);
+  }
+  sqlite3_exec(m_db, "COMMIT;", nullptr, nullptr, nullptr);
+  sqlite3_finalize(stmt);
+  return success;
+}
+
+uint64_t Database::GetEventSyncTime() {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return 0;
+
+  sqlite3_stmt *stmt;
+  const char *query = "SELECT value FROM meta WHERE key = 'event_sync';";
+  if (sqlite3_prepare_v2(m_db, query, -1, &stmt, nullptr) != SQLITE_OK)
+    return 0;
+  uint64_t synced = 0;
+  if (sqlite3_step(stmt) == SQLITE_ROW)
+    synced = (uint64_t)sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  return synced;
+}
+
+bool Database::SetEventSyncTime(uint64_t timestamp) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return false;
+
+  sqlite3_stmt *stmt;
+  const char *query =
+      "INSERT OR REPLACE INTO meta (key, value) VALUES ('event_sync', ?);";
+  if (sqlite3_prepare_v2(m_db, query, -1, &stmt, nullptr) != SQLITE_OK)
+    return false;
+  sqlite3_bind_int64(stmt, 1, (sqlite3_int64)timestamp);
+  bool success = sqlite3_step(stmt) == SQLITE_DONE;
+  sqlite3_finalize(stmt);
+  return success;
+}
+
+std::vector<GeoIpRecord> Database::LoadGeoIpCache() {
+  std::vector<GeoIpRecord> records;
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return records;
+
+  sqlite3_stmt *stmt;
+  const char *prune = "DELETE FROM geoip_cache WHERE expires <= ?;";
+  if (sqlite3_prepare_v2(m_db, prune, -1, &stmt, nullptr) == SQLITE_OK) {
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)std::time(nullptr));
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+  }
+
+  const char *query = "SELECT ip, country, expires FROM geoip_cache;";
+  if (sqlite3_prepare_v2(m_db, query, -1, &stmt, nullptr) != SQLITE_OK)
+    return records;
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    GeoIpRecord record;
+    record.Ip = UTF8ToW((const char *)sqlite3_column_text(stmt, 0));
+    record.Country = UTF8ToW((const char *)sqlite3_column_text(stmt, 1));
+    record.Expires = sqlite3_column_int64(stmt, 2);
+    records.push_back(record);
+  }
+  sqlite3_finalize(stmt);
+  return records;
+}
+
+bool Database::StoreGeoIp(const std::vector<GeoIpRecord> &records) {
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db)
+    return false;
+  if (records.empty())
+    return true;
+
+  sqlite3_stmt *stmt;
+  const char *query = "INSERT OR REPLACE INTO geoip_cache (ip, country, "
+                      "expires) VALUES (?, ?, ?);";
+  if (sqlite3_prepare_v2(m_db, query, -1, &stmt, nullptr) != SQLITE_OK)
+    return false;
+
+  sqlite3_exec(m_db, "BEGIN;", nullptr, nullptr, nullptr);
+  bool success = true;
+  for (const auto &record : records) {
+    std::string ip = WToUTF8(record.Ip);
+    std::string country = WToUTF8(record.Country);
+    sqlite3_bind_text(stmt, 1, ip.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, country.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64(stmt, 3, (sqlite3_int64)record.Expires);
+    if (sqlite3_step(stmt) != SQLITE_DONE)
+      success = false;
+    sqlite3_reset(stmt);
+  }
+  sqlite3_exec(m_db, "COMMIT;", nullptr, nullptr, nullptr);
+  sqlite3_finalize(stmt);
+  return success;
+}
+
+std::vector<StoredEvent> Database::SearchEvents(const std::wstring &query,
+                                                int limit) {
+  std::vector<StoredEvent> results;
+  std::lock_guard<std::recursive_mutex> lock(m_mutex);
+  if (!m_db || query.empty())
+    return results;
+
+  std::string sql;
+  std::vector<std::string> binds;
+  if (m_hasFts) {
+    sql = "SELECT e.timestamp, e.channel, e.provider, e.event_id, "
+          "e.record_id, e.message FROM event_fts f JOIN event_log e ON "
+          "e.id = f.rowid WHERE event_fts MATCH ? ORDER BY e.timestamp DESC "
+          "LIMIT ?;";
+    binds.push_back(WToUTF8(query));
+  } else {
+    // Plain word search; boolean operators and quotes are dropped
+    sql = "SELECT timestamp, channel, provider, event_id, record_id, message "
+          "FROM event_log WHERE 1";
+    std::string words = WToUTF8(query);
+    size_t pos = 0;
+    while (pos < words.size()) {
+      size_t end = words.find(' ', pos);
+      if (end == std::string::npos)
+        end = words.size();
+      std::string word = words.substr(pos, end - pos);
+      pos = end + 1;
+      word.erase(std::remove(word.begin(), word.end(), '"'), word.end());
+      if (word.empty() || word == "AND" || word == "OR" || word == "NOT")
+        continue;
+      sql += " AND (message LIKE ? OR provider LIKE ?)";
+      binds.push_back("%" + word + "%");
+      binds.push_back("%" + word + "%");
+    }
+    sql += " ORDER BY timestamp DESC LIMIT ?;";
+  }
+
+  sqlite3_stmt *stmt;
+  if (sqlite3_prepare_v2(m_db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    return results;
+  int idx = 1;
+  for (const auto &b : binds)
+    sqlite3_bind_text(stmt, idx++, b.c_str(), -1, SQLITE_TRANSIENT);
+  sqlite3_bind_int(stmt, idx, limit);
+
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    StoredEvent ev;
+    const char *channel = (const char *)sqlite3_column_text(stmt, 1);
+    const char *provider = (const char *)sqlite3_column_text(stmt, 2);
+    const char *message = (const char *)sqlite3_column_text(stmt, 5);
+    ev.Timestamp = (uint64_t)sqlite3_column_int64(stmt, 0);
+    ev.Channel = UTF8ToW(channel ? channel : "");
+    ev.Provider = UTF8ToW(provider ? provider : "");
+    ev.EventId = (uint32_t)sqlite3_column_int(stmt, 3);
+    ev.RecordId = (uint64_t)sqlite3_column_int64(stmt, 4);
+    ev.Message = UTF8ToW(message ? message : "");
+    results.push_back(ev);
+  }
+  sqlite3_finalize(stmt);
+  return results;
+}
+
 } // namespace db
@@ -1,8 +1,11 @@
 #pragma once
 
+#include "../utils/HyperLogLog.h"
+
 #include <cstdint>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 struct sqlite3;
@@ -13,6 +16,92 @@ struct AppUsage {
   std::wstring AppName;
   uint64_t TotalBytesUp;
   uint64_t TotalBytesDown;
+  int DimensionId = -1; // Set by GetUsageByDimension
+};
+
+// A Windows event log record kept for full-text search
+struct StoredEvent {
+  uint64_t Timestamp = 0;
+  std::wstring Channel;
+  std::wstring Provider;
+  uint32_t EventId = 0;
+  uint64_t RecordId = 0;
+  std::wstring Message;
+};
+
+// A remembered GeoIP lookup. An empty country is a negative entry (the
+// lookup failed or the range is private) and expires sooner.
+struct GeoIpRecord {
+  std::wstring Ip;
+  std::wstring Country;
+  int64_t Expires = 0; // Unix time
+};
+
+// What a traffic rollup is grouped by. Host values have their Domain
+// (registrable domain) as parent. Port values are service labels such as
+// "443/tcp (https)".
+enum class Dimension {
+  Process = 1,
+  Asn = 2,
+  Network = 3,
+  Domain = 4,
+  Host = 5,
+  Port = 6,
+};
+
+// Bytes to add to one dimension value's current buckets
+struct RollupDelta {
+  int DimensionId = -1;
+  uint64_t BytesUp = 0;
+  uint64_t BytesDown = 0;
+};
+
+// How one dimension value's traffic differs between two time ranges
+struct UsageChange {
+  std::wstring Name;
+  int DimensionId = -1;
+  uint64_t Before = 0; // Bytes up and down, scaled to the later range
+  uint64_t After = 0;
+  int64_t Change = 0;  // After - Before
+  double Ratio = 0;    // After / Before, infinite for new values
+};
+
+// Traffic of one sample period, for percentile billing
+struct RateSample {
+  int DimensionId = 0; // A Process value, or 0 for all traffic
+  uint64_t BytesUp = 0;
+  uint64_t BytesDown = 0;
+};
+
+// Percentiles of the per-period rates in a range, in bytes per second
+struct RatePercentiles {
+  std::wstring Name; // Empty for all traffic
+  int DimensionId = 0;
+  uint64_t Samples = 0;
+  double P95Up = 0, P99Up = 0, MaxUp = 0;
+  double P95Down = 0, P99Down = 0, MaxDown = 0;
+};
+
+// Distinct remote addresses seen by one process, see AddEndpoints
+struct EndpointSketch {
+  int DimensionId = 0; // A Process value, or 0 for all traffic
+  utils::HyperLogLog Endpoints;
+};
+
+// Distinct remote addresses over a range and over the range of the same
+// length just before it, estimated to within about 2%
+struct EndpointCount {
+  std::wstring Name; // Empty for all traffic
+  int DimensionId = 0;
+  uint64_t Distinct = 0;
+  uint64_t Before = 0;
+};
+
+// Traffic in one bucket of a time series
+struct SeriesPoint {
+  int64_t Timestamp = 0; // Bucket start, Unix time
+  uint64_t BytesUp = 0;
+  uint64_t BytesDown = 0;
 };
 
 class Database {
@@ -23,26 +112,140 @@ public:
   bool Open(const std::string &dbPath);
   void Close();
 
+  // 'fileName' in the directory of the database, where optional
+  // configuration files go. Relative if the database path is.
+  std::string PathNextTo(const std::string &fileName) const;
+
   bool InitSchema();
 
   // App ID cache
   int GetOrAddApp(const std::wstring &appName);
 
-  // Recording
-  bool LogTraffic(int appId, uint64_t bytesUp, uint64_t bytesDown);
+  // Recording. 'timestamp' is the Unix time the traffic happened at.
+  bool LogTraffic(int appId, uint64_t bytesUp, uint64_t bytesDown,
+                  int64_t timestamp);
 
   // Querying
   std::vector<AppUsage> GetUsage(int secondsBack);
 
+  // Traffic pre-aggregated per dimension value into minute, hourly and
+  // daily buckets, so grouped history does not scan traffic_log. Minutes
+  // are kept for a week. Ids are cached. A value keeps the parent it was
+  // first added with.
+  int GetOrAddDimension(Dimension kind, const std::wstring &name,
+                        int parentId = -1);
+  bool AddRollups(const std::vector<RollupDelta> &deltas, int64_t timestamp);
+
+  // Totals per value of 'kind', largest first. The range is rounded down
+  // to whole buckets: hours up to a week back, days beyond that. With a
+  // parent, only its children are returned.
+  std::vector<AppUsage> GetUsageByDimension(Dimension kind, int secondsBack,
+                                            int parentId = -1);
+
+  // Traffic of one dimension value over [from, to) in up to 'points'
+  // equal buckets, oldest first, zeros included. Summed in SQL from the
+  // coarsest rollup that still gives that many points over the range, so
+  // a month charts from hourly buckets. Buckets are whole multiples of the
+  // rollup, so there may be fewer points.
+  std::vector<SeriesPoint> GetSeries(int dimensionId, int64_t from,
+                                     int64_t to, size_t points);
+
+  // Values of 'kind' whose traffic changed most, by absolute change, from
+  // [beforeFrom, beforeTo) to [afterFrom, afterTo) (Unix times). Both
+  // ranges are rounded up to whole buckets of one rollup, and Before is
+  // scaled to the length After has covered so far. Each range is summed
+  // per value in value id order and the two are merge-joined, so a month
+  // costs two index scans.
+  std::vector<UsageChange> CompareUsage(Dimension kind, int64_t beforeFrom,
+                                        int64_t beforeTo, int64_t afterFrom,
+                                        int64_t afterTo, size_t limit,
+                                        int parentId = -1);
+
+  // Percentile (burstable) billing. Called once per closed period of
+  // 'periodSeconds' with the bytes of every process that had traffic and,
+  // as id 0, of all traffic, even when that is zero so idle periods are
+  // counted. The rates go into mergeable histogram sketches (accurate to
+  // 1%) per hour and per day.
+  bool AddRateSamples(const std::vector<RateSample> &samples,
+                      int64_t timestamp, int periodSeconds);
+  // Over [from, to), rounded down to whole hours, or days from a week up:
+  // all traffic first, then up to 'limit' processes by highest p95. A
+  // process counts as zero in periods it was silent. Merges the stored
+  // sketches, so a month costs about as much as a day.
+  std::vector<RatePercentiles> GetRatePercentiles(int64_t from, int64_t to,
+                                                  size_t limit);
+
+  // Distinct remote addresses per process and, as id 0, overall. Each
+  // sketch is merged into the hourly and daily HyperLogLog sketches of
+  // 'timestamp', so it may be written as often as convenient.
+  bool AddEndpoints(const std::vector<EndpointSketch> &sketches,
+                    int64_t timestamp);
+  // Over [from, to), widened to whole hours, or days from a week up: all
+  // traffic first, then up to 'limit' processes by most distinct
+  // addresses, with Before over as many buckets just before. The
+  // stored sketches are merged into one per process, so the memory does
+  // not grow with the range.
+  std::vector<EndpointCount> GetEndpointCounts(int64_t from, int64_t to,
+                                               size_t limit);
+
   bool ExportToCSV(const std::string &filename, int secondsBack);
 
+  std::wstring GetAppName(int appId);
+
+  // Event log index. Records already stored (same channel and record id)
+  // are skipped.
+  bool StoreEvents(const std::vector<StoredEvent> &events);
+  // Unix time up to which both logs were read into the index, 0 before
+  // the first sync. Events stored for other reasons do not move it.
+  uint64_t GetEventSyncTime();
+  bool SetEventSyncTime(uint64_t timestamp);
+
+  // Full-text search over provider and message, newest first. Uses FTS5
+  // query syntax (e.g. "timeout AND dns"); without FTS5 every word must
+  // appear somewhere in the message or provider.
+  std::vector<StoredEvent> SearchEvents(const std::wstring &query,
+                                        int limit = 500);
+  bool HasFullTextSearch() const { return m_hasFts; }
+
+  // GeoIP lookup cache. Loading drops expired entries first.
+  std::vector<GeoIpRecord> LoadGeoIpCache();
+  bool StoreGeoIp(const std::vector<GeoIpRecord> &records);
+
   sqlite3 *GetHandle() { return m_db; }
 
 private:
   std::string WToUTF8(const std::wstring &w);
   std::wstring UTF8ToW(const std::string &s);
 
+  bool InitEventIndex();
+
+  static constexpr int64_t kMinuteRetention = 7 * 86400;
+  static constexpr int kSketchBits = 7; // Rate sketch precision, 1/128
+
+  struct DimensionTotal {
+    int DimensionId;
+    std::wstring Name;
+    uint64_t Bytes; // Up and down
+  };
+  // Per value of 'kind' over buckets [from, to) of 'table', ascending id
+  std::vector<DimensionTotal> SumByDimension(Dimension kind,
+                                             const char *table, int64_t from,
+                                             int64_t to, int parentId);
+
+  struct MergedEndpoints {
+    std::wstring Name;
+    utils::HyperLogLog Endpoints;
+  };
+  // Per dimension id over [from, to), from hll_day or hll_hour
+  std::unordered_map<int, MergedEndpoints> MergeEndpoints(int64_t from,
+                                                          int64_t to,
+                                                          bool daily);
+
   sqlite3 *m_db = nullptr;
+  std::string m_path;
+  bool m_hasFts = false;
+  std::unordered_map<std::string, int> m_dimensionIds; // Kind + name
+  int64_t m_minutesPrunedAt = 0;
   std::recursive_mutex m_mutex;
 };
 
@@ -1,9 +1,12 @@
 #include <algorithm>
+#include <cfloat>
 #include <cstdio>
 #include <d3d11.h>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <map>
+#include <set>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -14,6 +17,7 @@
 #include "imgui_impl_win32.h"
 #include "sqlite3.h"
 
+#include "analyzer/EventSearch.h"
 #include "analyzer/LogCorrelator.h"
 #include "db/Database.h"
 #include "monitor/AppMonitor.h"
@@ -48,6 +52,18 @@ static std::string WToA_F(const std::wstring &w) {
   return s;
 }
 
+static std::wstring AToW_F(const std::string &s) {
+  if (s.empty())
+    return L"";
+  int sz =
+      MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.length(), nullptr, 0);
+  if (sz <= 0)
+    return L"";
+  std::wstring w(sz, 0);
+  MultiByteToWideChar(CP_UTF8, 0, s.c_str(), (int)s.length(), &w[0], sz);
+  return w;
+}
+
 bool glob_m(const char *pat, const char *str) {
   const char *p = pat, *s = str, *cp = nullptr, *cs = nullptr;
   while (*s) {
@@ -91,6 +107,11 @@ int main(int, char **) {
     }
 
     analyzer::LogCorrelator correlator(database);
+    analyzer::EventSearch eventSearch(database);
+    // Syncing the index can read a month of event logs, so searches run
+    // off the UI thread. Declared after what it uses, so it is waited for
+    // before those go.
+    std::future<std::vector<analyzer::EventSearchHit>> searchTask;
 
     WNDCLASSEXW wc = {sizeof(wc),
                       CS_CLASSDC,
@@ -134,16 +155,21 @@ int main(int, char **) {
     static int unitMode = 1;
     static std::vector<db::AppUsage> cachedUsage;
     static std::vector<analyzer::CorrelatedPeak> analysisResults;
+    static std::vector<analyzer::EventSearchHit> searchResults;
 
     struct Row {
       uint32_t Pid = 0;
-      std::string Proc = "", IP = "", Dom = "", Country = "";
-      uint64_t LUp = 0, LDn = 0; // Last Snapshot totals
-      uint64_t SUp = 0, SDn = 0; // Current speeds
-      uint64_t MaxUp = 0, MaxDn = 0;
-      uint64_t TUp = 0, TDn = 0; // Cumulative total
+      std::string Proc = "", IP = "", Port = "", Dom = "", Country = "",
+                  Asn = "";
+      std::string Group = ""; // Key of the site row this flow adds to
+      size_t Flows = 0;       // Site rows only
+      double SUp = 0, SDn = 0; // Current speeds
+      double MaxUp = 0, MaxDn = 0;
+      uint64_t TUp = 0, TDn = 0;     // Cumulative total
+      monitor::SparklineRing Recent; // Flow rows only
     };
-    static std::map<std::string, Row> tableData;
+    static std::map<uint64_t, Row> flowRows;    // By flow id
+    static std::map<std::string, Row> siteRows; // By pid and site
 
     while (!done) {
       MSG msg;
@@ -169,54 +195,120 @@ int main(int, char **) {
 
       if (ImGui::BeginTabBar("Tabs")) {
         if (ImGui::BeginTabItem("Monitor")) {
-          static float pU = 0, pD = 0, uD[120] = {0}, dD[120] = {0};
-          static int off = 0;
+          static float curUp = 0, curDn = 0;
+          static bool groupBySite = false;
 
-          if (now - lastSecUpdate >= 1.0) {
+          // One sample per published snapshot; an idle second publishes
+          // nothing, so fall back to the clock to record the zero. Only
+          // flows that changed since the last sample are touched.
+          static uint64_t lastSequence = 0;
+          auto changes = appMonitor.GetChangesSince(lastSequence);
+          if (changes.Sequence != lastSequence ||
+              now - lastSecUpdate >= 1.5) {
+            lastSequence = changes.Sequence;
             lastSecUpdate = now;
             float totCurUp = 0, totCurDn = 0;
             try {
-              auto snap = appMonitor.GetCumulativeSnapshot();
-              for (auto const &s : snap) {
-                std::string key =
-                    std::to_string(s.Pid) + "_" + WToA_F(s.RemoteIP);
-                auto &r = tableData[key];
-
-                // Delta Calculation for speeds
-                uint64_t deltaUp =
-                    (s.TotalUp >= r.LUp) ? (s.TotalUp - r.LUp) : 0;
-                uint64_t deltaDn =
-                    (s.TotalDown >= r.LDn) ? (s.TotalDown - r.LDn) : 0;
-
-                r.Pid = s.Pid;
-                r.Proc = WToA_F(s.ProcessName);
-                r.IP = WToA_F(s.RemoteIP);
-                r.Dom = WToA_F(s.Domain);
-                r.Country = WToA_F(s.Country);
-                r.SUp = deltaUp;
-                r.SDn = deltaDn;
-                r.LUp = s.TotalUp;
-                r.LDn = s.TotalDown;
-                r.TUp = s.TotalUp;
-                r.TDn = s.TotalDown;
-
-                if (deltaUp > r.MaxUp)
-                  r.MaxUp = deltaUp;
-                if (deltaDn > r.MaxDn)
-                  r.MaxDn = deltaDn;
-
-                totCurUp += (float)deltaUp;
-                totCurDn += (float)deltaDn;
+              std::set<std::string> touched;
+              // Takes a flow's old figures out of its site row. A row left
+              // without flows goes once all changes are in, so a flow that
+              // is only republished keeps its site's peaks.
+              auto detach = [&](const Row &r) {
+                if (r.Group.empty())
+                  return;
+                auto &g = siteRows[r.Group];
+                g.SUp -= r.SUp;
+                g.SDn -= r.SDn;
+                g.TUp -= r.TUp;
+                g.TDn -= r.TDn;
+                g.Flows--;
+                touched.insert(r.Group);
+              };
+              if (changes.Full) {
+                flowRows.clear();
+                siteRows.clear();
+              }
+              for (uint64_t id : changes.Removed) {
+                auto it = flowRows.find(id);
+                if (it == flowRows.end())
+                  continue;
+                detach(it->second);
+                flowRows.erase(it);
+              }
+              for (auto const &s : changes.Rows) {
+                auto &r = flowRows[s->FlowId];
+                detach(r);
+
+                r.Pid = s->Pid;
+                r.Proc = WToA_F(s->ProcessName);
+                // Flows folded away to save memory
+                r.IP = s->FoldedFlows > 0
+                           ? std::to_string(s->FoldedFlows) + " idle flows"
+                           : WToA_F(s->RemoteIP);
+                r.Port = WToA_F(s->Service);
+                r.Dom = WToA_F(s->Domain);
+                // Named subnets say more than "Local"
+                r.Country =
+                    WToA_F(s->Network.empty() ? s->Country : s->Network);
+                r.Asn = WToA_F(s->Asn);
+                r.SUp = s->RateUp;
+                r.SDn = s->RateDown;
+                r.TUp = s->TotalUp;
+                r.TDn = s->TotalDown;
+                r.Recent = s->Sparkline;
+                // Peaks are over sub-second bins, so above any rate
+                // sampled here once they catch up
+                r.MaxUp = std::max({r.MaxUp, r.SUp, s->PeakUp});
+                r.MaxDn = std::max({r.MaxDn, r.SDn, s->PeakDown});
+
+                // One site row per process and site
+                std::string site =
+                    WToA_F(s->Site.empty() ? s->RemoteIP : s->Site);
+                r.Group = std::to_string(s->Pid) + "_" + site;
+                auto &g = siteRows[r.Group];
+                if (g.Flows++ == 0) {
+                  g.Pid = r.Pid;
+                  g.Proc = r.Proc;
+                  g.Dom = site;
+                  g.Country = r.Country;
+                  g.Asn = r.Asn;
+                  g.Port = r.Port;
+                } else if (g.Port != r.Port) {
+                  g.Port = "various";
+                }
+                g.IP = g.Flows > 1 ? std::to_string(g.Flows) + " flows" : r.IP;
+                g.SUp += r.SUp;
+                g.SDn += r.SDn;
+                g.TUp += r.TUp;
+                g.TDn += r.TDn;
+                // A site peaks at least as high as any of its flows, also
+                // one that moved here from another site row
+                g.MaxUp = std::max(g.MaxUp, r.MaxUp);
+                g.MaxDn = std::max(g.MaxDn, r.MaxDn);
+                touched.insert(r.Group);
+              }
+              for (auto const &key : touched) {
+                auto it = siteRows.find(key);
+                if (it == siteRows.end())
+                  continue;
+                if (it->second.Flows == 0) {
+                  siteRows.erase(it);
+                  continue;
+                }
+                // Subtracting rates leaves rounding noise below zero
+                it->second.SUp = std::max(it->second.SUp, 0.0);
+                it->second.SDn = std::max(it->second.SDn, 0.0);
+                it->second.MaxUp = std::max(it->second.MaxUp, it->second.SUp);
+                it->second.MaxDn = std::max(it->second.MaxDn, it->second.SDn);
+              }
+              if (changes.Seconds > 0) {
+                totCurUp = (float)(changes.BytesUp / changes.Seconds);
+                totCurDn = (float)(changes.BytesDown / changes.Seconds);
               }
             } catch (...) {
             }
-            if (totCurUp > pU)
-              pU = totCurUp;
-            if (totCurDn > pD)
-              pD = totCurDn;
-            uD[off] = totCurUp;
-            dD[off] = totCurDn;
-            off = (off + 1) % 120;
+            curUp = totCurUp;
+            curDn = totCurDn;
           }
 
           float div =
@@ -231,22 +323,126 @@ int main(int, char **) {
           ImGui::SameLine();
           ImGui::RadioButton("B/s", &unitMode, 2);
 
-          ImGui::Text("Upload: %.1f %s (Peak: %.1f %s)",
-                      uD[(off + 119) % 120] / div, usS.c_str(), pU / div,
-                      usS.c_str());
-          ImGui::PlotLines("##U", uD, 120, off, nullptr, 0, pU * 1.1f + 1.0f,
+          // The monitor keeps a week at falling resolution and thins the
+          // range out to one point per pixel
+          static int chartRange = 0;
+          static double lastChartUpdate = -10;
+          static monitor::ThroughputSeries::Series chart;
+          const char *rangeNames[] = {"2 min",   "10 min",   "1 hour",
+                                      "6 hours", "24 hours", "7 days"};
+          const int64_t rangeSeconds[] = {120,      600,       3600,
+                                          6 * 3600, 24 * 3600, 7 * 24 * 3600};
+          ImGui::SameLine(0, 20.0f);
+          bool rangeChanged =
+              ImGui::Combo("Range", &chartRange, rangeNames, 6);
+          float chartWidth = ImGui::GetContentRegionAvail().x;
+          if (rangeChanged || now - lastChartUpdate >= 1.0) {
+            chart = appMonitor.GetThroughput(
+                rangeSeconds[chartRange] * 1000000,
+                (size_t)std::max(chartWidth, 3.0f));
+            lastChartUpdate = now;
+          }
+          // Averages per bucket are drawn; the peak is the highest
+          // sub-second rate in the range
+          std::vector<float> upAvg, dnAvg;
+          float upScale = 0, dnScale = 0, upPeak = 0, dnPeak = 0;
+          for (const auto &p : chart.Up) {
+            upAvg.push_back((float)p.Avg);
+            upScale = std::max(upScale, (float)p.Avg);
+            upPeak = std::max(upPeak, (float)p.Max);
+          }
+          for (const auto &p : chart.Down) {
+            dnAvg.push_back((float)p.Avg);
+            dnScale = std::max(dnScale, (float)p.Avg);
+            dnPeak = std::max(dnPeak, (float)p.Max);
+          }
+          std::string resolution =
+              chart.BucketUs > 0
+                  ? std::to_string(chart.BucketUs / 1000000) + " s buckets"
+                  : "";
+
+          ImGui::Text("Upload: %.1f %s (Peak: %.1f %s)", curUp / div,
+                      usS.c_str(), upPeak / div, usS.c_str());
+          ImGui::PlotLines("##U", upAvg.data(), (int)upAvg.size(), 0,
+                           resolution.c_str(), 0, upScale * 1.1f + 1.0f,
                            ImVec2(-1, 60));
-          ImGui::Text("Download: %.1f %s (Peak: %.1f %s)",
-                      dD[(off + 119) % 120] / div, usS.c_str(), pD / div,
-                      usS.c_str());
-          ImGui::PlotLines("##D", dD, 120, off, nullptr, 0, pD * 1.1f + 1.0f,
+          ImGui::Text("Download: %.1f %s (Peak: %.1f %s)", curDn / div,
+                      usS.c_str(), dnPeak / div, usS.c_str());
+          ImGui::PlotLines("##D", dnAvg.data(), (int)dnAvg.size(), 0,
+                           resolution.c_str(), 0, dnScale * 1.1f + 1.0f,
                            ImVec2(-1, 60));
 
+          // Totals per network class since start
+          auto byClass = appMonitor.GetTrafficByClass();
+          const monitor::NetworkClass shownClasses[] = {
+              monitor::NetworkClass::Internet, monitor::NetworkClass::Lan,
+              monitor::NetworkClass::Vpn};
+          for (auto networkClass : shownClasses) {
+            const auto &t = byClass[(size_t)networkClass];
+            if (networkClass != monitor::NetworkClass::Internet)
+              ImGui::SameLine(0, 20.0f);
+            ImGui::Text("%s: %.1f MB up, %.1f MB down",
+                        WToA_F(monitor::NetworkClassifier::ClassName(
+                                   networkClass))
+                            .c_str(),
+                        t.BytesUp / 1048576.0, t.BytesDown / 1048576.0);
+          }
+
+          // Rates over sub-second bins, which the chart averages away
+          static double lastBurstUpdate = -10;
+          static std::vector<monitor::AppMonitor::BurstStats> bursts;
+          std::string burstHeader =
+              "Burst rates (" +
+              std::to_string(appMonitor.GetRateResolution().count()) +
+              " ms bins)";
+          if (ImGui::CollapsingHeader(burstHeader.c_str())) {
+            if (now - lastBurstUpdate >= 2.0) {
+              bursts = appMonitor.GetBurstStats(20);
+              lastBurstUpdate = now;
+            }
+            if (ImGui::BeginTable("BurstTable", 10,
+                                  ImGuiTableFlags_Borders |
+                                      ImGuiTableFlags_RowBg |
+                                      ImGuiTableFlags_ScrollY |
+                                      ImGuiTableFlags_SizingFixedFit,
+                                  ImVec2(0, 150))) {
+              std::string unitHeader = " (" + usS + ")";
+              ImGui::TableSetupColumn("Process", 0, 150.0f);
+              ImGui::TableSetupColumn("Bins", 0, 70.0f);
+              const char *quantiles[] = {"p50", "p90", "p99", "Peak"};
+              for (const char *dir : {"Up ", "Down "})
+                for (const char *q : quantiles)
+                  ImGui::TableSetupColumn((dir + std::string(q) + unitHeader)
+                                              .c_str(),
+                                          0, 90.0f);
+              ImGui::TableHeadersRow();
+              for (const auto &b : bursts) {
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text("%s", b.ProcessName.empty()
+                                      ? "(all traffic)"
+                                      : WToA_F(b.ProcessName).c_str());
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text("%llu", (unsigned long long)b.Bins);
+                double values[] = {b.P50Up,   b.P90Up,   b.P99Up,
+                                   b.PeakUp,  b.P50Down, b.P90Down,
+                                   b.P99Down, b.PeakDown};
+                for (int i = 0; i < 8; i++) {
+                  ImGui::TableSetColumnIndex(2 + i);
+                  ImGui::Text("%.1f", values[i] / div);
+                }
+              }
+              ImGui::EndTable();
+            }
+          }
+
           static char flt[128] = "";
           ImGui::InputText("Filter", flt, 128);
+          ImGui::SameLine();
+          ImGui::Checkbox("Group by site", &groupBySite);
 
           if (ImGui::BeginTable(
-                  "MonTable", 11,
+                  "MonTable", 14,
                   ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg |
                       ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingFixedFit |
                       ImGuiTableFlags_Sortable,
@@ -257,11 +453,14 @@ int main(int, char **) {
             ImGui::TableSetupColumn("PID", 0, 50.0f);
             ImGui::TableSetupColumn("Process", 0, 150.0f);
             ImGui::TableSetupColumn("IP", 0, 110.0f);
+            ImGui::TableSetupColumn("Port", 0, 110.0f);
             ImGui::TableSetupColumn("Domain", 0, 150.0f);
             ImGui::TableSetupColumn("Country", 0, 60.0f);
+            ImGui::TableSetupColumn("ASN", 0, 150.0f);
             ImGui::TableSetupColumn(("Upload" + unitHeader).c_str(), 0, 90.0f);
             ImGui::TableSetupColumn(("Download" + unitHeader).c_str(), 0,
                                     90.0f);
+            ImGui::TableSetupColumn("Last minute", 0, 100.0f);
             ImGui::TableSetupColumn(("Max Up" + unitHeader).c_str(), 0, 90.0f);
             ImGui::TableSetupColumn(("Max Down" + unitHeader).c_str(), 0,
                                     90.0f);
@@ -270,13 +469,15 @@ int main(int, char **) {
             ImGui::TableSetupColumn(("Total Down" + totalUnitHeader).c_str(), 0,
                                     100.0f);
             ImGui::TableHeadersRow();
-            for (auto &rowPair : tableData) {
-              auto &r = rowPair.second;
+            auto drawRow = [&](const Row &r) {
               if (flt[0] != '\0' &&
-                  !glob_m(flt, (r.Proc + " " + r.IP + " " + r.Dom).c_str()))
-                continue;
+                  !glob_m(flt,
+                          (r.Proc + " " + r.IP + " " + r.Port + " " + r.Dom +
+                           " " + r.Asn)
+                              .c_str()))
+                return;
               if (r.TUp == 0 && r.TDn == 0)
-                continue; // Hide inactive
+                return; // Hide inactive
               ImGui::TableNextRow();
               ImGui::TableSetColumnIndex(0);
               ImGui::Text("%u", r.Pid);
@@ -285,55 +486,414 @@ int main(int, char **) {
               ImGui::TableSetColumnIndex(2);
               ImGui::Text("%s", r.IP.c_str());
               ImGui::TableSetColumnIndex(3);
-              ImGui::Text("%s", r.Dom.c_str());
+              ImGui::Text("%s", r.Port.c_str());
               ImGui::TableSetColumnIndex(4);
-              ImGui::Text("%s", r.Country.c_str());
+              ImGui::Text("%s", r.Dom.c_str());
               ImGui::TableSetColumnIndex(5);
-              ImGui::Text("%.1f", (float)r.SUp / div);
+              ImGui::Text("%s", r.Country.c_str());
               ImGui::TableSetColumnIndex(6);
-              ImGui::Text("%.1f", (float)r.SDn / div);
+              ImGui::Text("%s", r.Asn.c_str());
               ImGui::TableSetColumnIndex(7);
-              ImGui::Text("%.1f", (float)r.MaxUp / div);
+              ImGui::Text("%.1f", (float)r.SUp / div);
               ImGui::TableSetColumnIndex(8);
-              ImGui::Text("%.1f", (float)r.MaxDn / div);
+              ImGui::Text("%.1f", (float)r.SDn / div);
               ImGui::TableSetColumnIndex(9);
-              ImGui::Text("%.1f", (float)r.TUp / div);
+              if (r.Flows == 0) {
+                // Decoded only for rows on screen: a clipped plot never
+                // asks for its values
+                struct Spark {
+                  const monitor::SparklineRing *Ring;
+                  uint64_t End;
+                } spark{&r.Recent, lastSequence};
+                ImGui::PushID(&r);
+                ImGui::PlotLines(
+                    "##Recent",
+                    [](void *data, int i) {
+                      auto *spark = static_cast<Spark *>(data);
+                      return (float)spark->Ring->At(spark->End, (size_t)i);
+                    },
+                    &spark, (int)monitor::SparklineRing::kSamples, 0,
+                    nullptr, 0, FLT_MAX, ImVec2(100, 0));
+                ImGui::PopID();
+              }
               ImGui::TableSetColumnIndex(10);
+              ImGui::Text("%.1f", (float)r.MaxUp / div);
+              ImGui::TableSetColumnIndex(11);
+              ImGui::Text("%.1f", (float)r.MaxDn / div);
+              ImGui::TableSetColumnIndex(12);
+              ImGui::Text("%.1f", (float)r.TUp / div);
+              ImGui::TableSetColumnIndex(13);
               ImGui::Text("%.1f", (float)r.TDn / div);
+            };
+            if (groupBySite)
+              for (auto const &rowPair : siteRows)
+                drawRow(rowPair.second);
+            else
+              for (auto const &rowPair : flowRows)
+                drawRow(rowPair.second);
+            ImGui::EndTable();
+          }
+          if (ImGui::Button("Reset View Data")) {
+            flowRows.clear();
+            siteRows.clear();
+            lastSequence = 0; // The next sample brings every flow back
+          }
+          ImGui::EndTabItem();
+        }
+
+        if (ImGui::BeginTabItem("Connections")) {
+          // Copying out the longest open ones is a full table scan
+          static double lastConnUpdate = -10;
+          static monitor::ConnectionTable::Stats connStats;
+          static std::vector<monitor::AppMonitor::ConnectionInfo> longest;
+          static std::vector<monitor::AppMonitor::ProcessConnections>
+              byProcess;
+          if (now - lastConnUpdate >= 2.0) {
+            lastConnUpdate = now;
+            connStats = appMonitor.GetConnectionStats();
+            longest = appMonitor.GetLongestConnections(200);
+            byProcess = appMonitor.GetConnectionsByProcess(50);
+          }
+
+          ImGui::Text("Open: %zu (peak %zu) | Opened: %llu | Closed: %llu | "
+                      "Idle expired: %llu | Not tracked: %llu",
+                      connStats.Open, connStats.Peak, connStats.Opened,
+                      connStats.Closed, connStats.Expired, connStats.Dropped);
+          ImGui::Text("Average closed connection: %.1f s | Table: %.1f MB",
+                      connStats.Closed
+                          ? connStats.ClosedMs / 1000.0 / connStats.Closed
+                          : 0.0,
+                      connStats.Bytes / 1048576.0);
+
+          if (ImGui::BeginTable("ConnProcTable", 3,
+                                ImGuiTableFlags_Borders |
+                                    ImGuiTableFlags_RowBg |
+                                    ImGuiTableFlags_ScrollY,
+                                ImVec2(0, 150))) {
+            ImGui::TableSetupColumn("PID");
+            ImGui::TableSetupColumn("Process");
+            ImGui::TableSetupColumn("Open connections");
+            ImGui::TableHeadersRow();
+            for (const auto &p : byProcess) {
+              ImGui::TableNextRow();
+              ImGui::TableSetColumnIndex(0);
+              ImGui::Text("%u", p.Pid);
+              ImGui::TableSetColumnIndex(1);
+              ImGui::Text("%s", WToA_F(p.ProcessName).c_str());
+              ImGui::TableSetColumnIndex(2);
+              ImGui::Text("%zu", p.Open);
+            }
+            ImGui::EndTable();
+          }
+
+          ImGui::Text("Longest open");
+          if (ImGui::BeginTable("ConnTable", 7,
+                                ImGuiTableFlags_Borders |
+                                    ImGuiTableFlags_RowBg |
+                                    ImGuiTableFlags_ScrollY |
+                                    ImGuiTableFlags_SizingFixedFit,
+                                ImVec2(0, 0))) {
+            ImGui::TableSetupColumn("PID", 0, 50.0f);
+            ImGui::TableSetupColumn("Process", 0, 150.0f);
+            ImGui::TableSetupColumn("Direction", 0, 70.0f);
+            ImGui::TableSetupColumn("Local", 0, 180.0f);
+            ImGui::TableSetupColumn("Remote", 0, 180.0f);
+            ImGui::TableSetupColumn("Open (s)", 0, 80.0f);
+            ImGui::TableSetupColumn("Idle (s)", 0, 80.0f);
+            ImGui::TableHeadersRow();
+            for (const auto &c : longest) {
+              ImGui::TableNextRow();
+              ImGui::TableSetColumnIndex(0);
+              ImGui::Text("%u", c.Pid);
+              ImGui::TableSetColumnIndex(1);
+              ImGui::Text("%s", WToA_F(c.ProcessName).c_str());
+              ImGui::TableSetColumnIndex(2);
+              ImGui::Text("%s", c.Inbound ? "In" : "Out");
+              ImGui::TableSetColumnIndex(3);
+              ImGui::Text("%s", WToA_F(c.Local).c_str());
+              ImGui::TableSetColumnIndex(4);
+              ImGui::Text("%s", WToA_F(c.Remote).c_str());
+              ImGui::TableSetColumnIndex(5);
+              ImGui::Text("%.0f", c.Seconds);
+              ImGui::TableSetColumnIndex(6);
+              ImGui::Text("%.0f", c.IdleSeconds);
             }
             ImGui::EndTable();
           }
-          if (ImGui::Button("Reset View Data"))
-            tableData.clear();
           ImGui::EndTabItem();
         }
 
         if (ImGui::BeginTabItem("History")) {
-          if (now - lastHistUpdate >= 5.0) {
+          // Endpoint rows come from the raw log, the others from rollups
+          static int groupBy = 0, range = 0;
+          static int drillDomain = -1; // Domain whose hosts are shown
+          static std::string drillName;
+          static int chartDim = -1; // Value charted over the range
+          static std::string chartName;
+          static std::vector<db::SeriesPoint> chartSeries;
+          // What changed against an earlier range of the same length
+          static int compareWith = 0;
+          static std::vector<db::UsageChange> cachedChanges;
+          static const char *compareNames[] = {"Nothing", "Previous period",
+                                               "A week earlier"};
+          static const char *groupNames[] = {"Endpoint", "Process", "ASN",
+                                             "Network",  "Domain",  "Port"};
+          static const char *columnNames[] = {
+              "Application", "Process", "Autonomous system", "Network",
+              "Domain",      "Service port"};
+          static const db::Dimension groupDims[] = {
+              db::Dimension::Process, db::Dimension::Process,
+              db::Dimension::Asn,     db::Dimension::Network,
+              db::Dimension::Domain,  db::Dimension::Port};
+          static const char *rangeNames[] = {"Last hour", "Last day",
+                                             "Last week", "Last month"};
+          static const int rangeSeconds[] = {3600, 86400, 7 * 86400,
+                                             30 * 86400};
+          ImGui::SetNextItemWidth(150.0f);
+          bool changed = ImGui::Combo("Group by", &groupBy, groupNames, 6);
+          if (changed) {
+            drillDomain = -1;
+            chartDim = -1;
+          }
+          ImGui::SameLine();
+          ImGui::SetNextItemWidth(150.0f);
+          changed |= ImGui::Combo("Range", &range, rangeNames, 4);
+          if (groupBy != 0) {
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(150.0f);
+            changed |=
+                ImGui::Combo("Compare with", &compareWith, compareNames, 3);
+          }
+          bool comparing = groupBy != 0 && compareWith != 0;
+          if (groupBy == 0 && range != 0) {
+            ImGui::SameLine();
+            ImGui::TextDisabled("(scans the raw log)");
+          }
+          if (drillDomain != -1) {
+            ImGui::SameLine();
+            if (ImGui::Button("< All domains")) {
+              drillDomain = -1;
+              changed = true;
+            }
+            ImGui::SameLine();
+            ImGui::Text("Hosts under %s", drillName.c_str());
+          } else if (groupBy == 4) {
+            ImGui::SameLine();
+            ImGui::TextDisabled("(click a domain for its hosts)");
+          }
+
+          if (changed || now - lastHistUpdate >= 5.0) {
             lastHistUpdate = now;
             try {
-              cachedUsage = database.GetUsage(3600);
+              if (drillDomain != -1)
+                cachedUsage = database.GetUsageByDimension(
+                    db::Dimension::Host, rangeSeconds[range], drillDomain);
+              else if (groupBy != 0)
+                cachedUsage = database.GetUsageByDimension(
+                    groupDims[groupBy], rangeSeconds[range]);
+              else
+                cachedUsage = database.GetUsage(rangeSeconds[range]);
+              if (comparing) {
+                int64_t to = (int64_t)std::time(nullptr);
+                int64_t from = to - rangeSeconds[range];
+                int64_t back =
+                    compareWith == 1 ? rangeSeconds[range] : 7 * 86400;
+                cachedChanges = database.CompareUsage(
+                    drillDomain != -1 ? db::Dimension::Host
+                                      : groupDims[groupBy],
+                    from - back, to - back, from, to, 200, drillDomain);
+              }
+              if (chartDim != -1) {
+                // About one point per pixel
+                int64_t to = (int64_t)std::time(nullptr);
+                chartSeries = database.GetSeries(
+                    chartDim, to - rangeSeconds[range], to,
+                    (size_t)std::max(ImGui::GetContentRegionAvail().x, 1.0f));
+              }
             } catch (...) {
             }
           }
-          if (ImGui::BeginTable("Hist", 3,
+          if (chartDim != -1) {
+            std::vector<float> up, down;
+            for (const auto &point : chartSeries) {
+              up.push_back(point.BytesUp / 1048576.0f);
+              down.push_back(point.BytesDown / 1048576.0f);
+            }
+            int64_t bucket = chartSeries.size() > 1
+                                 ? chartSeries[1].Timestamp -
+                                       chartSeries[0].Timestamp
+                                 : 0;
+            ImGui::Text("%s, MB per %lld min", chartName.c_str(),
+                        (long long)(bucket / 60));
+            ImGui::SameLine();
+            if (ImGui::SmallButton("Close chart"))
+              chartDim = -1;
+            ImGui::PlotLines("Download##Hist", down.data(), (int)down.size(),
+                             0, nullptr, 0, FLT_MAX, ImVec2(-100, 60));
+            ImGui::PlotLines("Upload##Hist", up.data(), (int)up.size(), 0,
+                             nullptr, 0, FLT_MAX, ImVec2(-100, 60));
+          }
+          if (comparing &&
+              ImGui::BeginTable("HistDiff", 5,
                                 ImGuiTableFlags_Borders |
                                     ImGuiTableFlags_RowBg |
                                     ImGuiTableFlags_SizingFixedFit)) {
-            ImGui::TableSetupColumn("Application", 0, 400.0f);
+            ImGui::TableSetupColumn(
+                drillDomain != -1 ? "Host" : columnNames[groupBy], 0, 400.0f);
+            ImGui::TableSetupColumn("Before (MB)", 0, 100.0f);
+            ImGui::TableSetupColumn("Now (MB)", 0, 100.0f);
+            ImGui::TableSetupColumn("Change (MB)", 0, 100.0f);
+            ImGui::TableSetupColumn("Ratio", 0, 70.0f);
+            ImGui::TableHeadersRow();
+            for (auto const &item : cachedChanges) {
+              ImGui::TableNextRow();
+              ImGui::TableSetColumnIndex(0);
+              ImGui::Text("%s", WToA_F(item.Name).c_str());
+              ImGui::TableSetColumnIndex(1);
+              ImGui::Text("%.1f", item.Before / 1048576.0f);
+              ImGui::TableSetColumnIndex(2);
+              ImGui::Text("%.1f", item.After / 1048576.0f);
+              ImGui::TableSetColumnIndex(3);
+              ImGui::Text("%+.1f", item.Change / 1048576.0f);
+              ImGui::TableSetColumnIndex(4);
+              if (item.Before == 0)
+                ImGui::Text("new");
+              else
+                ImGui::Text("x%.2f", item.Ratio);
+            }
+            ImGui::EndTable();
+          } else if (ImGui::BeginTable("Hist", 4,
+                                ImGuiTableFlags_Borders |
+                                    ImGuiTableFlags_RowBg |
+                                    ImGuiTableFlags_SizingFixedFit)) {
+            ImGui::TableSetupColumn(
+                drillDomain != -1 ? "Host" : columnNames[groupBy], 0, 400.0f);
             ImGui::TableSetupColumn("Upload (MB)", 0, 120.0f);
             ImGui::TableSetupColumn("Download (MB)", 0, 120.0f);
+            ImGui::TableSetupColumn("", 0, 60.0f);
             ImGui::TableHeadersRow();
+            int drillTo = -1;
             for (auto const &item : cachedUsage) {
               ImGui::TableNextRow();
               ImGui::TableSetColumnIndex(0);
-              ImGui::Text("%s", WToA_F(item.AppName).c_str());
+              std::string name = WToA_F(item.AppName);
+              if (groupBy == 4 && drillDomain == -1) {
+                if (ImGui::Selectable(name.c_str())) {
+                  drillTo = item.DimensionId;
+                  drillName = name;
+                }
+              } else {
+                ImGui::Text("%s", name.c_str());
+              }
               ImGui::TableSetColumnIndex(1);
               ImGui::Text("%.1f", item.TotalBytesUp / 1048576.0f);
               ImGui::TableSetColumnIndex(2);
               ImGui::Text("%.1f", item.TotalBytesDown / 1048576.0f);
+              // Rollup values only; endpoints come from the raw log
+              ImGui::TableSetColumnIndex(3);
+              ImGui::PushID(item.DimensionId);
+              if (item.DimensionId != -1 && ImGui::SmallButton("Chart")) {
+                chartDim = item.DimensionId;
+                chartName = name;
+                lastHistUpdate = 0; // Refresh on the next frame
+              }
+              ImGui::PopID();
             }
             ImGui::EndTable();
+            if (drillTo != -1) {
+              drillDomain = drillTo;
+              lastHistUpdate = 0; // Refresh on the next frame
+            }
+          }
+
+          // Burstable billing: percentiles of the 5-minute average rates
+          static double lastBillingUpdate = -10;
+          static int billingRange = -1;
+          static std::vector<db::RatePercentiles> billing;
+          if (ImGui::CollapsingHeader("95th percentile (5-minute samples)")) {
+            if (billingRange != range || now - lastBillingUpdate >= 30.0) {
+              int64_t to = (int64_t)std::time(nullptr);
+              billing = database.GetRatePercentiles(to - rangeSeconds[range],
+                                                    to, 20);
+              billingRange = range;
+              lastBillingUpdate = now;
+            }
+            if (ImGui::BeginTable("Billing", 8,
+                                  ImGuiTableFlags_Borders |
+                                      ImGuiTableFlags_RowBg |
+                                      ImGuiTableFlags_SizingFixedFit)) {
+              ImGui::TableSetupColumn("Process", 0, 250.0f);
+              ImGui::TableSetupColumn("Samples", 0, 70.0f);
+              ImGui::TableSetupColumn("Up p95 (KB/s)", 0, 100.0f);
+              ImGui::TableSetupColumn("Up p99 (KB/s)", 0, 100.0f);
+              ImGui::TableSetupColumn("Up max (KB/s)", 0, 100.0f);
+              ImGui::TableSetupColumn("Down p95 (KB/s)", 0, 100.0f);
+              ImGui::TableSetupColumn("Down p99 (KB/s)", 0, 100.0f);
+              ImGui::TableSetupColumn("Down max (KB/s)", 0, 100.0f);
+              ImGui::TableHeadersRow();
+              for (const auto &p : billing) {
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text("%s", p.DimensionId == 0
+                                      ? "(all traffic)"
+                                      : WToA_F(p.Name).c_str());
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text("%llu", (unsigned long long)p.Samples);
+                double values[] = {p.P95Up,   p.P99Up,   p.MaxUp,
+                                   p.P95Down, p.P99Down, p.MaxDown};
+                for (int i = 0; i < 6; i++) {
+                  ImGui::TableSetColumnIndex(2 + i);
+                  ImGui::Text("%.1f", values[i] / 1024.0);
+                }
+              }
+              ImGui::EndTable();
+            }
+          }
+
+          // Distinct remote addresses, against the range just before, so a
+          // process that starts scanning or seeding stands out
+          static double lastEndpointsUpdate = -10;
+          static int endpointsRange = -1;
+          static std::vector<db::EndpointCount> endpointCounts;
+          if (ImGui::CollapsingHeader("Distinct remote addresses")) {
+            if (endpointsRange != range || now - lastEndpointsUpdate >= 30.0) {
+              int64_t to = (int64_t)std::time(nullptr);
+              endpointCounts = database.GetEndpointCounts(
+                  to - rangeSeconds[range], to, 20);
+              endpointsRange = range;
+              lastEndpointsUpdate = now;
+            }
+            if (ImGui::BeginTable("Endpoints", 4,
+                                  ImGuiTableFlags_Borders |
+                                      ImGuiTableFlags_RowBg |
+                                      ImGuiTableFlags_SizingFixedFit)) {
+              ImGui::TableSetupColumn("Process", 0, 250.0f);
+              ImGui::TableSetupColumn("Addresses", 0, 90.0f);
+              ImGui::TableSetupColumn("Before", 0, 90.0f);
+              ImGui::TableSetupColumn("Ratio", 0, 110.0f);
+              ImGui::TableHeadersRow();
+              for (const auto &c : endpointCounts) {
+                ImGui::TableNextRow();
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text("%s", c.DimensionId == 0
+                                      ? "(all traffic)"
+                                      : WToA_F(c.Name).c_str());
+                ImGui::TableSetColumnIndex(1);
+                ImGui::Text("%llu", (unsigned long long)c.Distinct);
+                ImGui::TableSetColumnIndex(2);
+                ImGui::Text("%llu", (unsigned long long)c.Before);
+                ImGui::TableSetColumnIndex(3);
+                // Estimates are within a few percent, so small counts
+                // and small changes are not flagged
+                bool sudden = c.Distinct >= 50 && c.Distinct >= 4 * c.Before;
+                if (c.Before == 0)
+                  ImGui::Text("%s", sudden ? "new, sudden" : "new");
+                else
+                  ImGui::Text("x%.1f%s", (double)c.Distinct / c.Before,
+                              sudden ? ", sudden" : "");
+              }
+              ImGui::EndTable();
+            }
           }
           ImGui::EndTabItem();
         }
@@ -342,6 +902,52 @@ int main(int, char **) {
           if (ImGui::Button("Run Analysis")) {
             analysisResults = correlator.Correlate(3600, 1024 * 1024);
           }
+
+          static char searchQuery[256] = "";
+          bool searching = searchTask.valid();
+          if (searching && searchTask.wait_for(std::chrono::seconds(0)) ==
+                               std::future_status::ready) {
+            try {
+              searchResults = searchTask.get();
+            } catch (...) {
+            }
+            searching = false;
+          }
+          bool runSearch =
+              ImGui::InputText("Search Events", searchQuery, 256,
+                               ImGuiInputTextFlags_EnterReturnsTrue);
+          ImGui::SameLine();
+          if (searching) {
+            ImGui::TextDisabled("Searching...");
+          } else if (ImGui::Button("Search") || runSearch) {
+            try {
+              std::wstring query = AToW_F(searchQuery);
+              searchTask =
+                  std::async(std::launch::async, [&eventSearch, query] {
+                    eventSearch.Sync();
+                    return eventSearch.Search(query, 1024 * 1024);
+                  });
+            } catch (...) {
+            }
+          }
+          if (!searchResults.empty() &&
+              ImGui::CollapsingHeader(
+                  ("Search Results (" + std::to_string(searchResults.size()) +
+                   ")###SearchResults")
+                      .c_str(),
+                  ImGuiTreeNodeFlags_DefaultOpen)) {
+            for (auto const &hit : searchResults) {
+              ImGui::TextWrapped("[%llu] %s: %s", hit.Event.Timestamp,
+                                 WToA_F(hit.Event.Provider).c_str(),
+                                 WToA_F(hit.Event.Message).c_str());
+              if (hit.HasPeak)
+                ImGui::TextDisabled(
+                    "    Nearest peak: %s | %llu KB | %+lld s",
+                    WToA_F(hit.PeakAppName).c_str(),
+                    hit.NearestPeak.TotalBytes / 1024, hit.PeakOffset);
+            }
+          }
+          ImGui::Separator();
           for (auto const &res : analysisResults) {
             std::string header = WToA_F(res.AppName) + " | Peak: " +
                                  std::to_string(res.Peak.TotalBytes / 1024) +
@@ -352,8 +958,10 @@ int main(int, char **) {
               ImGui::TextWrapped("Detail: %s",
                                  WToA_F(res.Conclusion.Detail).c_str());
               ImGui::Separator();
-              for (auto const &evt : res.RelatedEvents) {
-                ImGui::TextDisabled("[%llu] %s: %s", evt.Timestamp,
+              for (size_t i = 0; i < res.RelatedEvents.size(); i++) {
+                auto const &evt = res.RelatedEvents[i];
+                ImGui::TextDisabled("[%llu] (%.2f) %s: %s", evt.Timestamp,
+                                    res.EventWeights[i],
                                     WToA_F(evt.ProviderName).c_str(),
                                     WToA_F(evt.Message).c_str());
               }
@@ -367,6 +975,31 @@ int main(int, char **) {
                       appMonitor.GetTotalEventsCount(),
                       appMonitor.GetParsedEventsCount(),
                       appMonitor.GetDnsEventsCount());
+          auto dnsStats = appMonitor.GetDnsCacheStats();
+          ImGui::Text("DNS cache: %zu addresses, %zu per process, %zu names"
+                      " | %.1f / %.1f KB | evicted %llu, expired %llu",
+                      dnsStats.Addresses, dnsStats.ProcessAddresses,
+                      dnsStats.Domains,
+                      dnsStats.Bytes / 1024.0, dnsStats.MaxBytes / 1024.0,
+                      dnsStats.Evicted, dnsStats.Expired);
+          ImGui::Text("GeoIP: %s", appMonitor.HasOfflineGeoIp()
+                                       ? "offline database"
+                                       : "no offline database (geoip.csv)");
+          ImGui::SameLine();
+          bool onlineGeoIp = appMonitor.GetOnlineGeoIp();
+          if (ImGui::Checkbox("Online fallback (ip-api.com)", &onlineGeoIp))
+            appMonitor.SetOnlineGeoIp(onlineGeoIp);
+          ImGui::Text("ASN: %s", appMonitor.HasAsnDatabase()
+                                     ? "offline database"
+                                     : "no offline database (asn.tsv)");
+          auto resident = appMonitor.GetSnapshot();
+          ImGui::Text("Flows: %zu resident (~%.1f MB), %llu folded into "
+                      "\"other\" rows",
+                      resident->Rows.size(),
+                      resident->ResidentBytes / 1048576.0,
+                      resident->EvictedFlows);
+          ImGui::Text("Log windows: late data merged %llu times",
+                      appMonitor.GetLateWindowCount());
           ImGui::Text("Event Frequency:");
           if (ImGui::BeginTable("DebugF", 2,
                                 ImGuiTableFlags_Borders |
@@ -1,13 +1,32 @@
 #include "AppMonitor.h"
 #include "ETWHeaders.h"
 #include "utils/Logger.h"
+#include <algorithm>
+#include <ctime>
 #include <iostream>
 #include <sstream>
+#include <unordered_set>
 
 
 namespace monitor {
 
-AppMonitor::AppMonitor(db::Database &db) : m_db(db) {}
+AppMonitor::AppMonitor(db::Database &db) : AppMonitor(db, Options()) {}
+
+AppMonitor::AppMonitor(db::Database &db, const Options &options)
+    : m_db(db), m_options(options), m_geoIp(db, m_networks), m_asn(db),
+      m_bufferedStats(options.RateResolution.count() * 1000, 0),
+      m_connections(options.Connections),
+      m_persistWindows(options.Window.count() * 1000,
+                       options.Lateness.count() * 1000),
+      m_rateBins(options.RateResolution.count() * 1000,
+                 options.Lateness.count() * 1000),
+      m_snapshot(std::make_shared<const Snapshot>()),
+      m_series(options.RateResolution.count() * 1000) {
+  // Optional user-named subnets, next to the database like the rules file
+  m_networks.LoadSubnets(db.PathNextTo("networks.ini"));
+  // The full list from publicsuffix.org, if present, replaces the built-in
+  m_suffixes.Load(db.PathNextTo("public_suffix_list.dat"));
+}
 
 AppMonitor::~AppMonitor() { Stop(); }
 
@@ -37,6 +56,13 @@ void AppMonitor::Stop() {
     m_flushThread.join();
 }
 
+// The connection table's clock
+static uint64_t SteadyMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 void AppMonitor::OnEvent(PEVENT_RECORD pEvent) {
   m_totalEventsReceived++;
 
@@ -55,6 +81,11 @@ void AppMonitor::OnEvent(PEVENT_RECORD pEvent) {
       0x5329,
       0x4832,
       {0x8d, 0xfd, 0x43, 0xd9, 0x79, 0x15, 0x3a, 0x88}};
+  static const GUID KernelProcGuid = {
+      0x22fb2cd6,
+      0x0e7b,
+      0x422b,
+      {0xa0, 0xc7, 0x2f, 0xad, 0x1f, 0xd0, 0xe7, 0x16}};
 
   std::wstring providerName = L"Unknown";
   bool isWellKnown = true;
@@ -65,6 +96,9 @@ void AppMonitor::OnEvent(PEVENT_RECORD pEvent) {
   else if (memcmp(&pEvent->EventHeader.ProviderId, &KernelNetGuid,
                   sizeof(GUID)) == 0)
     providerName = L"K-NET";
+  else if (memcmp(&pEvent->EventHeader.ProviderId, &KernelProcGuid,
+                  sizeof(GUID)) == 0)
+    providerName = L"K-PROC";
   else
     isWellKnown = false;
 
@@ -91,6 +125,8 @@ void AppMonitor::OnEvent(PEVENT_RECORD pEvent) {
       kA = "DNS";
     else if (providerName == L"K-NET")
       kA = "K-NET";
+    else if (providerName == L"K-PROC")
+      kA = "K-PROC";
     else {
       int sz = WideCharToMultiByte(CP_UTF8, 0, providerName.c_str(),
                                    (int)providerName.length(), nullptr, 0,
@@ -107,25 +143,74 @@ void AppMonitor::OnEvent(PEVENT_RECORD pEvent) {
   }
 
   std::wstring parseError;
+  ProcessEvent proc;
+  if (m_parser.ParseProcess(pEvent, proc, parseError)) {
+    if (proc.IsStart)
+      m_tracker.OnProcessStart(proc.ProcessId, proc.CreateTime,
+                               proc.ImageName);
+    else
+      m_tracker.OnProcessExit(proc.ProcessId, proc.CreateTime);
+    return;
+  }
+
+  ConnectionEvent conn;
+  if (m_parser.ParseConnection(pEvent, conn, parseError)) {
+    ConnectionKey key;
+    key.Local = conn.Local;
+    key.Remote = conn.Remote;
+    key.LocalPort = conn.LocalPort;
+    key.RemotePort = conn.RemotePort;
+    key.Pid = conn.ProcessId;
+    std::lock_guard<std::mutex> lock(m_connectionsMutex);
+    if (conn.Type == ConnectionEvent::Kind::Disconnect)
+      m_connections.Close(key, SteadyMs());
+    else
+      m_connections.Open(key, conn.Type == ConnectionEvent::Kind::Accept,
+                         SteadyMs());
+    return;
+  }
+
   DnsEvent dns;
   if (m_parser.ParseDns(pEvent, dns, parseError)) {
     m_dnsEventsCount++;
-    m_dnsResolver.AddMapping(dns.ResultIP, dns.QueryName);
+    m_dnsResolver.AddAnswer(dns.ProcessId, dns.Timestamp, dns.QueryName,
+                            dns.CnameChain, dns.Addresses);
     return;
   }
 
   TrafficEvent te;
   if (m_parser.Parse(pEvent, te, parseError)) {
     m_parsedEventsReceived++;
-    std::lock_guard<std::mutex> lock(m_statsMutex);
-    StatsKey skey{te.ProcessId, te.RemoteIP};
-    if (te.IsUpload) {
-      m_bufferedStats[skey].BytesUp += te.Bytes;
-      m_cumulativeStats[skey].BytesUp += te.Bytes;
-    } else {
-      m_bufferedStats[skey].BytesDown += te.Bytes;
-      m_cumulativeStats[skey].BytesDown += te.Bytes;
+    size_t networkClass = (size_t)m_networks.GetClass(te.Remote);
+    m_classBytes[networkClass][te.IsUpload ? 0 : 1] += te.Bytes;
+
+    StatsKey key;
+    key.Remote = te.Remote;
+    key.Pid = te.ProcessId;
+    key.Port = ServicePort(te.LocalPort, te.RemotePort);
+    key.Proto = te.Proto;
+    if (te.Proto == Protocol::Tcp && te.LocalPort != 0) {
+      // Keeps the connection from expiring as idle
+      ConnectionKey conn;
+      conn.Local = te.Local;
+      conn.Remote = te.Remote;
+      conn.LocalPort = te.LocalPort;
+      conn.RemotePort = te.RemotePort;
+      conn.Pid = te.ProcessId;
+      std::lock_guard<std::mutex> lock(m_connectionsMutex);
+      m_connections.Touch(conn, SteadyMs());
     }
+
+    int64_t eventUs = te.Timestamp != 0
+                          ? m_eventClock.ToUnixMicros((int64_t)te.Timestamp)
+                          : EventClock::NowUnixMicros();
+
+    std::lock_guard<std::mutex> lock(m_statsMutex);
+    auto &stats = m_bufferedStats.At(eventUs, key);
+    if (te.IsUpload)
+      stats.BytesUp += te.Bytes;
+    else
+      stats.BytesDown += te.Bytes;
   } else if (!parseError.empty()) {
     std::lock_guard<std::mutex> lock(m_debugMutex);
     m_lastParsingError = parseError;
@@ -139,6 +224,24 @@ uint64_t AppMonitor::GetParsedEventsCount() const {
   return m_parsedEventsReceived;
 }
 
+std::vector<AccumulatedStats> AppMonitor::GetTrafficByClass() const {
+  std::vector<AccumulatedStats> totals(kNetworkClassCount);
+  for (size_t i = 0; i < kNetworkClassCount; i++) {
+    totals[i].BytesUp = m_classBytes[i][0];
+    totals[i].BytesDown = m_classBytes[i][1];
+  }
+  return totals;
+}
+
+// "Internet", or the class and subnet name, e.g. "VPN (Office VPN)"
+std::wstring AppMonitor::NetworkDimension(const IpAddress &ip) const {
+  const Subnet *subnet = m_networks.Classify(ip);
+  if (!subnet)
+    return NetworkClassifier::ClassName(NetworkClass::Internet);
+  return std::wstring(NetworkClassifier::ClassName(subnet->Class)) + L" (" +
+         subnet->Name + L")";
+}
+
 std::vector<AppMonitor::DebugEvent> AppMonitor::GetLastEvents() {
   std::lock_guard<std::mutex> lock(m_debugMutex);
   return m_lastEvents;
@@ -152,17 +255,426 @@ std::wstring AppMonitor::GetLastParsingError() const {
   return m_lastParsingError;
 }
 
-std::vector<AppMonitor::AppStatsSnapshot> AppMonitor::GetCumulativeSnapshot() {
-  std::vector<AppStatsSnapshot> snapshot;
-  std::lock_guard<std::mutex> lock(m_statsMutex);
-  for (auto const &[key, stats] : m_cumulativeStats) {
-    std::wstring procName = m_tracker.GetProcessName(key.Pid);
-    std::wstring domain = m_dnsResolver.GetDomain(key.RemoteIP);
-    std::wstring country = m_geoIp.GetCountryCode(key.RemoteIP);
-    snapshot.push_back({key.Pid, procName, key.RemoteIP, domain, country,
-                        stats.BytesUp, stats.BytesDown});
+ConnectionTable::Stats AppMonitor::GetConnectionStats() const {
+  std::lock_guard<std::mutex> lock(m_connectionsMutex);
+  return m_connections.GetStats();
+}
+
+static std::wstring FormatEndpoint(const IpAddress &ip, uint16_t port) {
+  if (ip.IsV4())
+    return ip.ToString() + L":" + std::to_wstring(port);
+  return L"[" + ip.ToString() + L"]:" + std::to_wstring(port);
+}
+
+std::vector<AppMonitor::ConnectionInfo>
+AppMonitor::GetLongestConnections(size_t limit) {
+  std::vector<ConnectionTable::Connection> oldest;
+  {
+    std::lock_guard<std::mutex> lock(m_connectionsMutex);
+    oldest = m_connections.GetOldest(limit);
+  }
+  uint64_t now = SteadyMs();
+  std::vector<ConnectionInfo> result;
+  result.reserve(oldest.size());
+  for (const auto &conn : oldest) {
+    ConnectionInfo info;
+    info.Pid = conn.Key.Pid;
+    info.ProcessName = m_tracker.GetProcessName(conn.Key.Pid);
+    info.Local = FormatEndpoint(conn.Key.Local, conn.Key.LocalPort);
+    info.Remote = FormatEndpoint(conn.Key.Remote, conn.Key.RemotePort);
+    info.Inbound = conn.Inbound;
+    info.Seconds = (now - std::min(now, conn.OpenedAt)) / 1000.0;
+    info.IdleSeconds = (now - std::min(now, conn.LastActive)) / 1000.0;
+    result.push_back(std::move(info));
   }
-  return snapshot;
+  return result;
+}
+
+std::vector<AppMonitor::ProcessConnections>
+AppMonitor::GetConnectionsByProcess(size_t limit) {
+  std::vector<ProcessConnections> result;
+  {
+    std::lock_guard<std::mutex> lock(m_connectionsMutex);
+    for (const auto &[pid, open] : m_connections.CountByProcess())
+      result.push_back({pid, L"", open});
+  }
+  size_t n = std::min(limit, result.size());
+  std::partial_sort(result.begin(), result.begin() + n, result.end(),
+                    [](const ProcessConnections &a,
+                       const ProcessConnections &b) {
+                      return a.Open > b.Open;
+                    });
+  result.resize(n);
+  for (auto &process : result)
+    process.ProcessName = m_tracker.GetProcessName(process.Pid);
+  return result;
+}
+
+bool AppMonitor::Enrich(const StatsKey &key, FlowEntry &flow, uint64_t bytes,
+                        Clock::time_point now) {
+  AppStatsSnapshot &row = flow.Row;
+  bool changed = false;
+  auto update = [&changed](std::wstring &field, std::wstring value) {
+    if (field != value) {
+      field = std::move(value);
+      changed = true;
+    }
+  };
+  update(row.ProcessName, m_tracker.GetProcessName(key.Pid));
+  update(row.Domain, m_dnsResolver.GetDomain(key.Pid, key.Remote));
+  update(row.Site, row.Domain.empty()
+                       ? L""
+                       : m_suffixes.GetRegistrableDomain(row.Domain));
+  update(row.Country, m_geoIp.GetCountryCode(row.RemoteIP, bytes));
+  AsnInfo asn;
+  update(row.Asn, m_asn.Lookup(key.Remote, asn) ? asn.ToString() : L"");
+  const Subnet *subnet = m_networks.Classify(key.Remote);
+  update(row.Network, subnet ? subnet->Name : L"");
+  flow.EnrichedAt = now;
+  return changed;
+}
+
+void AppMonitor::Publish(std::shared_ptr<Delta> delta) {
+  uint64_t sequence = ++m_sequence;
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->Rows.reserve(m_flows.size());
+  for (auto &[key, flow] : m_flows) {
+    if (flow.Changed) {
+      flow.Row.Generation = sequence;
+      flow.Published = std::make_shared<const AppStatsSnapshot>(flow.Row);
+      flow.Changed = false;
+      delta->Rows.push_back(flow.Published);
+    }
+    snapshot->Rows.push_back(flow.Published);
+  }
+  delta->Sequence = sequence;
+  m_recent.push_back(std::move(delta));
+  if (m_recent.size() > kKeepDeltas)
+    m_recent.pop_front();
+  snapshot->Recent.assign(m_recent.begin(), m_recent.end());
+  snapshot->Sequence = sequence;
+  snapshot->ResidentBytes = m_residentBytes;
+  snapshot->EvictedFlows = m_evictedFlows;
+  m_snapshot.store(std::move(snapshot), std::memory_order_release);
+}
+
+AppMonitor::Changes AppMonitor::GetChangesSince(uint64_t since) const {
+  auto snapshot = GetSnapshot();
+  Changes changes;
+  changes.Sequence = snapshot->Sequence;
+  if (since >= snapshot->Sequence)
+    return changes;
+
+  const auto &recent = snapshot->Recent;
+  if (since == 0 || recent.empty() || recent.front()->Sequence > since + 1) {
+    // Too far behind to replay: everything, with the last interval's rates
+    changes.Full = true;
+    changes.Rows = snapshot->Rows;
+    if (!recent.empty()) {
+      changes.BytesUp = recent.back()->BytesUp;
+      changes.BytesDown = recent.back()->BytesDown;
+      changes.Seconds = recent.back()->Seconds;
+      changes.PeakUp = recent.back()->PeakUp;
+      changes.PeakDown = recent.back()->PeakDown;
+    }
+    return changes;
+  }
+
+  // Newest first, so each flow keeps its latest row. A removed flow has
+  // no rows after its removal.
+  std::unordered_set<uint64_t> seen;
+  for (auto it = recent.rbegin();
+       it != recent.rend() && (*it)->Sequence > since; ++it) {
+    const Delta &delta = **it;
+    for (uint64_t id : delta.Removed)
+      if (seen.insert(id).second)
+        changes.Removed.push_back(id);
+    changes.BytesUp += delta.BytesUp;
+    changes.BytesDown += delta.BytesDown;
+    changes.Seconds += delta.Seconds;
+    changes.PeakUp = std::max(changes.PeakUp, delta.PeakUp);
+    changes.PeakDown = std::max(changes.PeakDown, delta.PeakDown);
+    for (const auto &row : delta.Rows)
+      if (seen.insert(row->FlowId).second)
+        changes.Rows.push_back(row);
+  }
+  return changes;
+}
+
+size_t AppMonitor::EstimateBytes(const StatsKey &key, const FlowEntry &flow) {
+  // Map node plus the row and its published copy with their strings
+  const AppStatsSnapshot &row = flow.Row;
+  size_t chars = 0;
+  for (const std::wstring *s :
+       {&row.ProcessName, &row.RemoteIP, &row.Service, &row.Domain, &row.Site,
+        &row.Country, &row.Asn, &row.Network})
+    chars += 2 * s->capacity();
+  return 64 + sizeof(StatsKey) + sizeof(FlowEntry) + sizeof(AppStatsSnapshot) +
+         chars * sizeof(wchar_t);
+}
+
+void AppMonitor::EvictIdle(Clock::time_point now, Delta &delta) {
+  size_t total = 0;
+  std::vector<std::pair<Clock::time_point, const StatsKey *>> idle;
+  for (const auto &[key, flow] : m_flows) {
+    total += EstimateBytes(key, flow);
+    bool catchAll = key.Pid == 0 && key.IsOther;
+    if (!catchAll && !flow.Active && now - flow.LastActive >= m_options.MinIdle)
+      idle.push_back({flow.LastActive, &key});
+  }
+  m_residentBytes = total;
+  if (total <= m_options.FlowMemoryBudget)
+    return;
+
+  // Longest idle first, down to 90% so this does not run every second.
+  // Flows go into their process's "other" row; those rows in turn go into
+  // the one for pid 0.
+  std::sort(idle.begin(), idle.end());
+  size_t target = m_options.FlowMemoryBudget / 10 * 9;
+  for (const auto &[lastActive, keyPtr] : idle) {
+    if (total <= target)
+      break;
+    StatsKey key = *keyPtr; // The node goes away below
+    FlowEntry &flow = m_flows.at(key);
+    const AppStatsSnapshot &row = flow.Row;
+    bool isOther = key.IsOther;
+    StatsKey otherKey;
+    otherKey.Pid = isOther ? 0 : key.Pid;
+    otherKey.IsOther = 1;
+
+    // May rehash, but references to elements stay valid
+    auto [otherIt, inserted] = m_flows.try_emplace(otherKey);
+    FlowEntry &other = otherIt->second;
+    if (inserted) {
+      other.Row.FlowId = m_nextFlowId++;
+      other.Row.Pid = otherKey.Pid;
+      other.Row.ProcessName = isOther ? L"Other processes" : row.ProcessName;
+      total += EstimateBytes(otherKey, other);
+    }
+    other.Row.TotalUp += row.TotalUp;
+    other.Row.TotalDown += row.TotalDown;
+    other.Row.FoldedFlows += isOther ? row.FoldedFlows : 1;
+    other.LastActive = std::max(other.LastActive, lastActive);
+    other.Changed = true;
+
+    total -= EstimateBytes(key, flow);
+    delta.Removed.push_back(row.FlowId);
+    m_flows.erase(key);
+    m_evictedFlows++;
+  }
+  m_residentBytes = total;
+  if (total > m_options.FlowMemoryBudget)
+    LOG("Warning: Flow memory over budget with no idle flows left to fold");
+}
+
+void AppMonitor::AdvanceBillingPeriod(int64_t timestamp) {
+  int64_t period = m_options.BillingPeriod.count();
+  if (period <= 0)
+    return;
+  if (m_periodStart == INT64_MIN) {
+    // The first whole period; a partial one would read as a quiet one
+    m_periodStart = timestamp - timestamp % period + period;
+    return;
+  }
+  while (timestamp >= m_periodStart + period) {
+    std::vector<db::RateSample> samples;
+    samples.push_back(
+        {0, m_periodTotal.BytesUp, m_periodTotal.BytesDown}); // Even if idle
+    for (const auto &[name, stats] : m_periodBytes) {
+      int id = m_db.GetOrAddDimension(db::Dimension::Process, name);
+      if (id != -1)
+        samples.push_back({id, stats.BytesUp, stats.BytesDown});
+    }
+    m_db.AddRateSamples(samples, m_periodStart, (int)period);
+    m_periodTotal = AccumulatedStats();
+    m_periodBytes.clear();
+    m_periodStart += period;
+    // Back from sleep: skip the gap rather than log it as idle
+    if (timestamp - m_periodStart >= 86400)
+      m_periodStart = timestamp - timestamp % period;
+  }
+}
+
+void AppMonitor::PersistWindow(int64_t timestamp,
+                               const FlowWindows::Window &window) {
+  AdvanceBillingPeriod(timestamp);
+  bool billed = m_periodStart != INT64_MIN && timestamp >= m_periodStart;
+
+  // Per-dimension totals for this window, written as rollup deltas
+  std::map<std::pair<db::Dimension, std::wstring>, AccumulatedStats> rollups;
+  auto addRollup = [&](db::Dimension kind, const std::wstring &name,
+                       const AccumulatedStats &stats) {
+    rollups[{kind, name}] += stats;
+  };
+
+  // Flows to other ports of the same endpoint share a log row
+  std::map<int, AccumulatedStats> logged;
+  HourEndpoints &endpoints = m_endpoints[timestamp - timestamp % 3600];
+  for (auto const &[key, stats] : window) {
+    // Evicted meanwhile: name it from the key alone
+    AppStatsSnapshot fallback;
+    auto flow = m_flows.find(key);
+    if (flow == m_flows.end()) {
+      fallback.ProcessName = m_tracker.GetProcessName(key.Pid);
+      if (!key.Remote.IsUnspecified())
+        fallback.RemoteIP = key.Remote.ToString();
+    }
+    const AppStatsSnapshot &row =
+        flow != m_flows.end() ? flow->second.Row : fallback;
+    const std::wstring &procName = row.ProcessName;
+    const std::wstring &domain = row.Domain;
+    const std::wstring &country = row.Country;
+    std::wstring displayName = procName;
+    if (!domain.empty())
+      displayName += L" -> " + domain;
+    else if (!row.RemoteIP.empty())
+      displayName += L" -> " + row.RemoteIP;
+    if (!country.empty() && country != L".." && country != L"Local")
+      displayName += L" [" + country + L"]";
+
+    int appId = m_db.GetOrAddApp(displayName);
+    if (appId != -1)
+      logged[appId] += stats;
+
+    addRollup(db::Dimension::Process, procName, stats);
+    if (!key.Remote.IsUnspecified()) {
+      endpoints.Total.Add(key.Remote.Bytes, sizeof(key.Remote.Bytes));
+      endpoints.ByName[procName].Add(key.Remote.Bytes,
+                                     sizeof(key.Remote.Bytes));
+    }
+    if (billed) {
+      m_periodTotal += stats;
+      m_periodBytes[procName] += stats;
+    }
+    if (!row.Asn.empty())
+      addRollup(db::Dimension::Asn, row.Asn, stats);
+    addRollup(db::Dimension::Network, NetworkDimension(key.Remote), stats);
+    if (!row.Service.empty())
+      addRollup(db::Dimension::Port, row.Service, stats);
+    if (!domain.empty()) {
+      addRollup(db::Dimension::Domain, row.Site, stats);
+      addRollup(db::Dimension::Host, domain, stats);
+    }
+  }
+
+  for (auto const &[appId, stats] : logged)
+    m_db.LogTraffic(appId, stats.BytesUp, stats.BytesDown, timestamp);
+
+  std::vector<db::RollupDelta> deltas;
+  for (auto const &[dim, stats] : rollups) {
+    int parentId = -1;
+    if (dim.first == db::Dimension::Host) {
+      // Domain values sort first, so the parent id is cached by now
+      std::wstring site = m_suffixes.GetRegistrableDomain(dim.second);
+      parentId = m_db.GetOrAddDimension(db::Dimension::Domain, site);
+    }
+    int id = m_db.GetOrAddDimension(dim.first, dim.second, parentId);
+    if (id != -1)
+      deltas.push_back({id, stats.BytesUp, stats.BytesDown});
+  }
+  m_db.AddRollups(deltas, timestamp);
+}
+
+void AppMonitor::WriteEndpoints() {
+  for (auto &[hour, endpoints] : m_endpoints) {
+    std::vector<db::EndpointSketch> sketches;
+    sketches.push_back({0, std::move(endpoints.Total)});
+    for (auto &[name, sketch] : endpoints.ByName) {
+      int id = m_db.GetOrAddDimension(db::Dimension::Process, name);
+      if (id != -1)
+        sketches.push_back({id, std::move(sketch)});
+    }
+    m_db.AddEndpoints(sketches, hour);
+  }
+  m_endpoints.clear();
+}
+
+bool AppMonitor::RecordBursts(int64_t startUs, const FlowWindows::Window &bin,
+                              Delta &delta) {
+  double perSecond = 1e6 / m_rateBins.WidthUs();
+  bool peaked = false;
+  AccumulatedStats total;
+  std::unordered_map<uint32_t, AccumulatedStats> byPid;
+  for (const auto &[key, stats] : bin) {
+    total += stats;
+    byPid[key.Pid] += stats;
+    auto flow = m_flows.find(key);
+    if (flow == m_flows.end())
+      continue; // Folded meanwhile
+    AppStatsSnapshot &row = flow->second.Row;
+    double up = stats.BytesUp * perSecond;
+    double down = stats.BytesDown * perSecond;
+    if (up > row.PeakUp || down > row.PeakDown) {
+      row.PeakUp = std::max(row.PeakUp, up);
+      row.PeakDown = std::max(row.PeakDown, down);
+      flow->second.Changed = true;
+      peaked = true;
+    }
+  }
+  delta.PeakUp = std::max(delta.PeakUp, total.BytesUp * perSecond);
+  delta.PeakDown = std::max(delta.PeakDown, total.BytesDown * perSecond);
+  {
+    std::lock_guard<std::mutex> lock(m_seriesMutex);
+    m_series.Add(startUs, total.BytesUp, total.BytesDown);
+  }
+
+  // A bin with traffic one way counts as a zero rate the other way
+  auto record = [perSecond](Bursts &bursts, const AccumulatedStats &stats) {
+    bursts.Up.Record((uint64_t)(stats.BytesUp * perSecond));
+    bursts.Down.Record((uint64_t)(stats.BytesDown * perSecond));
+  };
+  std::vector<std::pair<std::wstring, AccumulatedStats>> apps;
+  for (const auto &[pid, stats] : byPid)
+    apps.push_back({m_tracker.GetProcessName(pid), stats});
+  std::lock_guard<std::mutex> lock(m_burstsMutex);
+  record(m_totalBursts, total);
+  for (const auto &[name, stats] : apps)
+    record(m_appBursts[name], stats);
+  return peaked;
+}
+
+ThroughputSeries::Series AppMonitor::GetThroughput(int64_t spanUs,
+                                                  size_t maxPoints) const {
+  std::lock_guard<std::mutex> lock(m_seriesMutex);
+  int64_t toUs = m_series.Closed();
+  if (toUs == INT64_MIN)
+    return ThroughputSeries::Series();
+  return m_series.Query(toUs - spanUs, toUs, maxPoints);
+}
+
+std::vector<AppMonitor::BurstStats>
+AppMonitor::GetBurstStats(size_t limit) const {
+  auto describe = [](const std::wstring &name, const Bursts &bursts) {
+    BurstStats stats;
+    stats.ProcessName = name;
+    stats.Bins = bursts.Up.Count();
+    stats.P50Up = (double)bursts.Up.Quantile(0.5);
+    stats.P90Up = (double)bursts.Up.Quantile(0.9);
+    stats.P99Up = (double)bursts.Up.Quantile(0.99);
+    stats.PeakUp = (double)bursts.Up.Max();
+    stats.P50Down = (double)bursts.Down.Quantile(0.5);
+    stats.P90Down = (double)bursts.Down.Quantile(0.9);
+    stats.P99Down = (double)bursts.Down.Quantile(0.99);
+    stats.PeakDown = (double)bursts.Down.Max();
+    return stats;
+  };
+
+  std::lock_guard<std::mutex> lock(m_burstsMutex);
+  std::vector<std::pair<uint64_t, decltype(m_appBursts)::const_pointer>> apps;
+  for (const auto &app : m_appBursts)
+    apps.push_back(
+        {std::max(app.second.Up.Max(), app.second.Down.Max()), &app});
+  size_t n = std::min(limit, apps.size());
+  std::partial_sort(apps.begin(), apps.begin() + n, apps.end(),
+                    [](const auto &a, const auto &b) {
+                      return a.first > b.first;
+                    });
+  std::vector<BurstStats> result;
+  result.reserve(n + 1);
+  result.push_back(describe(L"", m_totalBursts));
+  for (size_t i = 0; i < n; i++)
+    result.push_back(describe(apps[i].second->first, apps[i].second->second));
+  return result;
 }
 
 void AppMonitor::FlushLoop() {
@@ -172,33 +684,138 @@ void AppMonitor::FlushLoop() {
       break;
 
     try {
-      std::map<StatsKey, AccumulatedStats> toFlush;
+      // Keep exited processes around long enough to name their last flush
+      m_tracker.AgeOut(std::chrono::seconds(60));
+      {
+        std::lock_guard<std::mutex> lock(m_connectionsMutex);
+        m_connections.Expire(SteadyMs());
+      }
+
+      std::map<int64_t, FlowWindows::Window> windows;
       {
         std::lock_guard<std::mutex> lock(m_statsMutex);
-        toFlush.swap(m_bufferedStats);
+        windows = m_bufferedStats.Take();
       }
-      if (toFlush.empty())
-        continue;
+      // The live view is by arrival, the log and burst rates by event time
+      FlowWindows::Window toFlush;
+      for (auto &[start, window] : windows) {
+        m_persistWindows.Add(start, window);
+        m_rateBins.Add(start, window);
+        for (auto const &[key, stats] : window)
+          toFlush[key] += stats;
+      }
+
+      auto now = Clock::now();
+      auto delta = std::make_shared<Delta>();
+      delta->Seconds = m_lastFlush == Clock::time_point{}
+                           ? 1.0
+                           : std::chrono::duration<double>(now - m_lastFlush)
+                                 .count();
+      m_lastFlush = now;
 
+      // Names are looked up here, off the ingestion path, and cached
+      bool changed = !toFlush.empty();
+      for (auto &[key, flow] : m_flows) {
+        bool stale = flow.Row.Country == L".." ||
+                     now - flow.EnrichedAt >= std::chrono::seconds(10);
+        if (stale && flow.Row.FoldedFlows == 0) {
+          auto fresh = toFlush.find(key);
+          // Republished only if a name actually changed
+          flow.Changed |= Enrich(
+              key, flow,
+              fresh == toFlush.end()
+                  ? 0
+                  : fresh->second.BytesUp + fresh->second.BytesDown,
+              now);
+        }
+        if (flow.Active) {
+          // Quiet this interval unless it is in toFlush below
+          flow.Row.DeltaUp = flow.Row.DeltaDown = 0;
+          flow.Row.RateUp = flow.Row.RateDown = 0;
+          flow.Active = false;
+          flow.Changed = true;
+        }
+        changed |= flow.Changed;
+      }
       for (auto const &[key, stats] : toFlush) {
-        std::wstring procName = m_tracker.GetProcessName(key.Pid);
-        std::wstring domain = m_dnsResolver.GetDomain(key.RemoteIP);
-        std::wstring country = m_geoIp.GetCountryCode(key.RemoteIP);
-        std::wstring displayName = procName;
-        if (!domain.empty())
-          displayName += L" -> " + domain;
-        else if (!key.RemoteIP.empty())
-          displayName += L" -> " + key.RemoteIP;
-        if (!country.empty() && country != L".." && country != L"Local")
-          displayName += L" [" + country + L"]";
-
-        int appId = m_db.GetOrAddApp(displayName);
-        if (appId != -1)
-          m_db.LogTraffic(appId, stats.BytesUp, stats.BytesDown);
+        auto [it, inserted] = m_flows.try_emplace(key);
+        FlowEntry &flow = it->second;
+        if (inserted) {
+          flow.Row.FlowId = m_nextFlowId++;
+          flow.Row.Pid = key.Pid;
+          if (!key.Remote.IsUnspecified())
+            flow.Row.RemoteIP = key.Remote.ToString();
+          flow.Row.Port = key.Port;
+          flow.Row.Proto = key.Proto;
+          flow.Row.Service = ServiceLabel(key.Port, key.Proto);
+          Enrich(key, flow, stats.BytesUp + stats.BytesDown, now);
+        }
+        flow.Row.TotalUp += stats.BytesUp;
+        flow.Row.TotalDown += stats.BytesDown;
+        flow.Row.DeltaUp = stats.BytesUp;
+        flow.Row.DeltaDown = stats.BytesDown;
+        flow.Row.RateUp = stats.BytesUp / delta->Seconds;
+        flow.Row.RateDown = stats.BytesDown / delta->Seconds;
+        // Published as the next sequence, see Publish()
+        flow.Row.Sparkline.Set(m_sequence + 1,
+                               flow.Row.RateUp + flow.Row.RateDown);
+        flow.Active = true;
+        flow.Changed = true;
+        flow.LastActive = now;
+        delta->BytesUp += stats.BytesUp;
+        delta->BytesDown += stats.BytesDown;
+      }
+      // A bin split across two flushes would read as two smaller bursts,
+      // so bins wait for the watermark like the log windows do
+      int64_t nowUs = EventClock::NowUnixMicros();
+      m_rateBins.Emit(nowUs, [&](int64_t startUs,
+                                 const FlowWindows::Window &bin) {
+        changed |= RecordBursts(startUs, bin, *delta);
+      });
+      {
+        std::lock_guard<std::mutex> lock(m_seriesMutex);
+        m_series.Close(m_rateBins.EmittedUntil());
+      }
+      EvictIdle(now, *delta);
+      if (changed || !delta->Removed.empty())
+        Publish(std::move(delta));
+      m_persistWindows.Emit(EventClock::NowUnixMicros(),
+                            [this](int64_t startUs,
+                                   const FlowWindows::Window &window) {
+                              PersistWindow(startUs / 1000000, window);
+                            });
+      m_lateWindows = m_persistWindows.LateCount();
+      // Quiet periods have no windows to close them. Everything before the
+      // oldest open window is persisted, so a period ending there is whole.
+      int64_t persistedUs = m_persistWindows.EmittedUntil();
+      if (persistedUs != INT64_MIN)
+        AdvanceBillingPeriod(persistedUs / 1000000);
+      // Sketches are merged into the stored ones, so writing them once a
+      // minute bounds what a crash loses without rewriting them per window
+      if (now - m_endpointsWrittenAt >= std::chrono::minutes(1)) {
+        WriteEndpoints();
+        m_endpointsWrittenAt = now;
       }
     } catch (...) {
     }
   }
+
+  // Log what is still open rather than lose the last seconds
+  try {
+    std::map<int64_t, FlowWindows::Window> windows;
+    {
+      std::lock_guard<std::mutex> lock(m_statsMutex);
+      windows = m_bufferedStats.Take();
+    }
+    for (auto &[start, window] : windows)
+      m_persistWindows.Add(start, window);
+    m_persistWindows.Emit(INT64_MAX, [this](int64_t startUs,
+                                           const FlowWindows::Window &window) {
+      PersistWindow(startUs / 1000000, window);
+    });
+    WriteEndpoints();
+  } catch (...) {
+  }
 }
 
 } // namespace monitor
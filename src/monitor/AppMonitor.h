@@ -1,38 +1,96 @@
 #pragma once
 
 #include "../db/Database.h"
+#include "../utils/HyperLogLog.h"
+#include "../utils/LogLinearHistogram.h"
+#include "AsnResolver.h"
+#include "ConnectionTable.h"
 #include "DnsResolver.h"
 #include "ETWController.h"
+#include "EventClock.h"
 #include "GeoIpResolver.h"
+#include "NetworkClassifier.h"
 #include "ProcessTracker.h"
+#include "PublicSuffixList.h"
+#include "ServicePort.h"
+#include "SparklineRing.h"
+#include "ThroughputSeries.h"
 #include "TraceParser.h"
+#include "TumblingWindows.h"
 
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace monitor {
 
+// A flow as aggregated: process, remote address and service port. Packed
+// into 24 bytes so it hashes and compares as three 64-bit words.
 struct StatsKey {
-  uint32_t Pid;
-  std::wstring RemoteIP;
-  bool operator<(const StatsKey &other) const {
-    if (Pid != other.Pid)
-      return Pid < other.Pid;
-    return RemoteIP < other.RemoteIP;
+  IpAddress Remote;
+  uint32_t Pid = 0;
+  uint16_t Port = 0; // Service port, see ServicePort()
+  Protocol Proto = Protocol::Unknown;
+  uint8_t IsOther = 0; // Idle flows folded together, see EvictIdle()
+
+  bool operator==(const StatsKey &other) const {
+    return memcmp(this, &other, sizeof(*this)) == 0;
+  }
+};
+static_assert(sizeof(StatsKey) == 24, "StatsKey must stay packed");
+
+struct StatsKeyHash {
+  size_t operator()(const StatsKey &key) const {
+    uint64_t w[3];
+    memcpy(w, &key, sizeof(w));
+    uint64_t h = (w[0] ^ (w[1] * 0x9E3779B97F4A7C15ull) ^
+                  (w[2] * 0xC2B2AE3D27D4EB4Full)) *
+                 0x9E3779B97F4A7C15ull;
+    return (size_t)(h ^ (h >> 32));
   }
 };
 
 struct AccumulatedStats {
   uint64_t BytesUp = 0;
   uint64_t BytesDown = 0;
+
+  AccumulatedStats &operator+=(const AccumulatedStats &other) {
+    BytesUp += other.BytesUp;
+    BytesDown += other.BytesDown;
+    return *this;
+  }
 };
 
 class AppMonitor {
 public:
+  struct Options {
+    // Estimated memory for flow rows. Past it, the longest idle flows are
+    // folded into one "other" row per process, keeping totals exact.
+    size_t FlowMemoryBudget = 64 * 1024 * 1024;
+    std::chrono::seconds MinIdle{300}; // Younger flows are never folded
+    ConnectionTable::Options Connections;
+    // Traffic is logged in event-time windows of this width. Narrower
+    // windows time bursts more precisely but write more log rows.
+    std::chrono::milliseconds Window{1000};
+    // How long a window stays open for events that arrive late
+    std::chrono::milliseconds Lateness{2000};
+    // Burst rates are measured over bins this wide, by event time, so a
+    // short burst is not averaged away over the flush interval. Should
+    // divide Window.
+    std::chrono::milliseconds RateResolution{100};
+    // Traffic per process is stored in samples this long for percentile
+    // billing, see Database::AddRateSamples
+    std::chrono::seconds BillingPeriod{300};
+  };
+
   AppMonitor(db::Database &db);
+  AppMonitor(db::Database &db, const Options &options);
   ~AppMonitor();
 
   bool Start();
@@ -42,47 +100,234 @@ public:
   uint64_t GetParsedEventsCount() const;
 
   struct AppStatsSnapshot {
-    uint32_t Pid;
+    uint64_t FlowId = 0;     // Stable for the lifetime of the flow
+    uint64_t Generation = 0; // Snapshot sequence of the last change
+    uint32_t Pid = 0;
     std::wstring ProcessName;
     std::wstring RemoteIP;
+    uint16_t Port = 0; // Service port, 0 if unknown
+    Protocol Proto = Protocol::Unknown;
+    std::wstring Service; // "443/tcp (https)", empty if unknown
     std::wstring Domain;
+    std::wstring Site; // Registrable domain of Domain, e.g. "google.com"
     std::wstring Country;
-    uint64_t TotalUp;   // Persistent total
-    uint64_t TotalDown; // Persistent total
-
-    AppStatsSnapshot(uint32_t pid, std::wstring pname, std::wstring rip,
-                     std::wstring dom, std::wstring count, uint64_t tu,
-                     uint64_t td)
-        : Pid(pid), ProcessName(pname), RemoteIP(rip), Domain(dom),
-          Country(count), TotalUp(tu), TotalDown(td) {}
+    std::wstring Asn;     // "AS<number> <organization>", empty if unknown
+    std::wstring Network; // Special or named subnet, empty for internet
+    uint64_t TotalUp = 0;   // Persistent total
+    uint64_t TotalDown = 0; // Persistent total
+    uint64_t DeltaUp = 0;   // Bytes in the interval ending at Generation
+    uint64_t DeltaDown = 0;
+    double RateUp = 0; // Bytes per second over that interval
+    double RateDown = 0;
+    double PeakUp = 0; // Highest rate over one RateResolution bin
+    double PeakDown = 0;
+    SparklineRing Sparkline; // RateUp + RateDown by snapshot sequence
+    uint64_t FoldedFlows = 0; // Non-zero marks an "other" row
+  };
+  using RowPtr = std::shared_ptr<const AppStatsSnapshot>;
+
+  // The flows that changed in one flush interval. A flow that goes quiet
+  // is listed once more with zero rates.
+  struct Delta {
+    uint64_t Sequence = 0;
+    std::vector<RowPtr> Rows;
+    std::vector<uint64_t> Removed; // Flow ids folded into "other" rows
+    uint64_t BytesUp = 0; // All traffic in the interval
+    uint64_t BytesDown = 0;
+    double Seconds = 0; // Length of the interval
+    // Highest rate of all traffic over one RateResolution bin, among the
+    // bins closed in the interval
+    double PeakUp = 0;
+    double PeakDown = 0;
+  };
+
+  // Cumulative statistics since start, one row per (pid, remote IP, service
+  // port), and the most recent deltas. Published by the flush thread and
+  // never modified afterwards; unchanged rows are shared between snapshots.
+  struct Snapshot {
+    std::vector<RowPtr> Rows;
+    std::vector<std::shared_ptr<const Delta>> Recent; // Oldest first
+    uint64_t Sequence = 0; // Increases with every publish
+    size_t ResidentBytes = 0; // Estimated, see Options::FlowMemoryBudget
+    uint64_t EvictedFlows = 0; // Since start
+  };
+
+  // The latest snapshot, refreshed once a second. A single atomic load:
+  // readers never block ingestion or each other.
+  std::shared_ptr<const Snapshot> GetSnapshot() const {
+    return m_snapshot.load(std::memory_order_acquire);
+  }
+
+  struct Changes {
+    uint64_t Sequence = 0; // Pass back as 'since' on the next call
+    // 'since' was too old: Rows holds every flow and replaces what the
+    // caller had
+    bool Full = false;
+    std::vector<RowPtr> Rows; // Latest state of each changed flow
+    std::vector<uint64_t> Removed; // Flows gone since 'since'
+    uint64_t BytesUp = 0;     // All traffic in the covered intervals
+    uint64_t BytesDown = 0;
+    double Seconds = 0;
+    double PeakUp = 0; // Highest of the covered intervals
+    double PeakDown = 0;
+  };
+
+  // Flows that changed after snapshot 'since'; 0 asks for everything. The
+  // cost is proportional to the flows active in the missed intervals, not
+  // to all flows seen since start.
+  Changes GetChangesSince(uint64_t since) const;
+
+  // Open TCP connections from the connect, accept and disconnect events
+  struct ConnectionInfo {
+    uint32_t Pid = 0;
+    std::wstring ProcessName;
+    std::wstring Local; // "address:port"
+    std::wstring Remote;
+    bool Inbound = false;
+    double Seconds = 0; // Open for
+    double IdleSeconds = 0;
   };
+  struct ProcessConnections {
+    uint32_t Pid = 0;
+    std::wstring ProcessName;
+    size_t Open = 0;
+  };
+  ConnectionTable::Stats GetConnectionStats() const;
+  // Up to 'limit' connections, longest open first
+  std::vector<ConnectionInfo> GetLongestConnections(size_t limit);
+  // Up to 'limit' processes, most open connections first
+  std::vector<ProcessConnections> GetConnectionsByProcess(size_t limit);
+
+  // Distribution of rates over RateResolution bins since start, counting
+  // only bins with traffic. Rates are in bytes per second, to within 1/16.
+  struct BurstStats {
+    std::wstring ProcessName; // Empty for all traffic
+    uint64_t Bins = 0;
+    double P50Up = 0, P90Up = 0, P99Up = 0, PeakUp = 0;
+    double P50Down = 0, P90Down = 0, P99Down = 0, PeakDown = 0;
+  };
+  // All traffic first, then up to 'limit' processes, highest peak first
+  std::vector<BurstStats> GetBurstStats(size_t limit) const;
+  std::chrono::milliseconds GetRateResolution() const {
+    return m_options.RateResolution;
+  }
 
-  // NEW: Returns cumulative statistics since start
-  std::vector<AppStatsSnapshot> GetCumulativeSnapshot();
+  // All traffic over the last 'spanUs' microseconds of event time, at most
+  // 'maxPoints' per direction. Ends at the newest closed rate bin, about
+  // Options::Lateness before the present.
+  ThroughputSeries::Series GetThroughput(int64_t spanUs,
+                                         size_t maxPoints) const;
 
   struct DebugEvent {
     uint16_t Id;
     std::wstring Provider;
   };
+  // Bytes since start per NetworkClass, indexed by its value
+  std::vector<AccumulatedStats> GetTrafficByClass() const;
+
   std::vector<DebugEvent> GetLastEvents();
   std::map<std::string, uint64_t> GetEventCounts();
   uint64_t GetDnsEventsCount() const { return m_dnsEventsCount; }
+  DnsResolver::Stats GetDnsCacheStats() const {
+    return m_dnsResolver.GetStats();
+  }
+  bool HasOfflineGeoIp() const { return m_geoIp.HasOfflineDatabase(); }
+  bool GetOnlineGeoIp() const { return m_geoIp.GetOnlineFallback(); }
+  void SetOnlineGeoIp(bool enabled) { m_geoIp.SetOnlineFallback(enabled); }
+  bool HasAsnDatabase() const { return m_asn.IsLoaded(); }
+  // Windowed data that arrived after its window was logged
+  uint64_t GetLateWindowCount() const { return m_lateWindows; }
   std::wstring GetLastParsingError() const;
 
 private:
   void OnEvent(PEVENT_RECORD pEvent);
   void FlushLoop();
+  std::wstring NetworkDimension(const IpAddress &ip) const;
+
+  using Clock = std::chrono::steady_clock;
+
+  // A flow's running totals with its looked-up names. Names are cached and
+  // only looked up again every few seconds, or while a lookup is pending.
+  struct FlowEntry {
+    AppStatsSnapshot Row;
+    RowPtr Published;     // Row as of the last snapshot
+    bool Active = false;  // Had traffic in the last published interval
+    bool Changed = false; // Since the last publish
+    Clock::time_point EnrichedAt{};
+    Clock::time_point LastActive{};
+  };
+  // Looks the flow's names up again; true if any of them changed
+  bool Enrich(const StatsKey &key, FlowEntry &flow, uint64_t bytes,
+              Clock::time_point now);
+  static size_t EstimateBytes(const StatsKey &key, const FlowEntry &flow);
+  void EvictIdle(Clock::time_point now, Delta &delta);
+  void Publish(std::shared_ptr<Delta> delta);
+
+  using FlowWindows = TumblingWindows<StatsKey, AccumulatedStats, StatsKeyHash>;
+  // Logs one closed window; 'timestamp' is its start in Unix seconds
+  void PersistWindow(int64_t timestamp, const FlowWindows::Window &window);
+  // Closes every billing period that ended by 'timestamp' (Unix seconds)
+  void AdvanceBillingPeriod(int64_t timestamp);
+  // Adds the pending address sketches to the database's
+  void WriteEndpoints();
+  // Records one closed rate bin. True if a flow's peak rose.
+  bool RecordBursts(int64_t startUs, const FlowWindows::Window &bin,
+                    Delta &delta);
+
+  struct Bursts {
+    utils::LogLinearHistogram Up;
+    utils::LogLinearHistogram Down;
+  };
+
+  struct HourEndpoints {
+    utils::HyperLogLog Total;
+    std::unordered_map<std::wstring, utils::HyperLogLog> ByName;
+  };
 
   db::Database &m_db;
+  Options m_options;
   ETWController m_controller;
   TraceParser m_parser;
   ProcessTracker m_tracker;
   DnsResolver m_dnsResolver;
+  NetworkClassifier m_networks; // Before m_geoIp, which uses it
+  PublicSuffixList m_suffixes;
   GeoIpResolver m_geoIp;
+  AsnResolver m_asn;
+
+  EventClock m_eventClock; // ETW callback thread only
 
   std::mutex m_statsMutex;
-  std::map<StatsKey, AccumulatedStats> m_bufferedStats;
-  std::map<StatsKey, AccumulatedStats> m_cumulativeStats; // NEW: Never cleared
+  FlowWindows m_bufferedStats; // RateResolution bins, taken every flush
+
+  mutable std::mutex m_connectionsMutex;
+  ConnectionTable m_connections;
+
+  // Owned by the flush thread
+  FlowWindows m_persistWindows; // Until the watermark passes them
+  FlowWindows m_rateBins;       // Likewise, RateResolution wide
+  std::atomic<uint64_t> m_lateWindows{0};
+  int64_t m_periodStart = INT64_MIN; // Unix seconds
+  AccumulatedStats m_periodTotal;
+  std::unordered_map<std::wstring, AccumulatedStats> m_periodBytes; // By name
+  std::map<int64_t, HourEndpoints> m_endpoints; // By hour start, Unix time
+  Clock::time_point m_endpointsWrittenAt{};
+  std::unordered_map<StatsKey, FlowEntry, StatsKeyHash> m_flows;
+  uint64_t m_sequence = 0;
+  uint64_t m_nextFlowId = 1;
+  Clock::time_point m_lastFlush{};
+  std::deque<std::shared_ptr<const Delta>> m_recent; // Capped at kKeepDeltas
+  static constexpr size_t kKeepDeltas = 60;
+  size_t m_residentBytes = 0;
+  uint64_t m_evictedFlows = 0;
+  std::atomic<std::shared_ptr<const Snapshot>> m_snapshot;
+
+  mutable std::mutex m_burstsMutex; // Written by the flush thread
+  Bursts m_totalBursts;
+  std::unordered_map<std::wstring, Bursts> m_appBursts; // By process name
+
+  mutable std::mutex m_seriesMutex; // Written by the flush thread
+  ThroughputSeries m_series;
 
   std::vector<DebugEvent> m_lastEvents;
   std::mutex m_debugMutex;
@@ -92,6 +337,7 @@ private:
   std::atomic<uint64_t> m_totalEventsReceived{0};
   std::atomic<uint64_t> m_parsedEventsReceived{0};
   std::atomic<uint64_t> m_dnsEventsCount{0};
+  std::atomic<uint64_t> m_classBytes[kNetworkClassCount][2] = {}; // Up, down
 
   std::atomic<bool> m_stopFlush{false};
   std::thread m_flushThread;
@@ -0,0 +1,69 @@
+#include "AsnResolver.h"
+#include "../utils/Logger.h"
+
+namespace monitor {
+
+std::wstring AsnInfo::ToString() const {
+  std::wstring text = L"AS" + std::to_wstring(Number);
+  if (!Organization.empty())
+    text += L" " + Organization;
+  return text;
+}
+
+AsnResolver::AsnResolver(const db::Database &db) {
+  // Compiling the full TSV takes a few seconds, keep it off the UI thread
+  m_loaderThread = std::thread(&AsnResolver::Load, this,
+                               db.PathNextTo("asn.bin"),
+                               db.PathNextTo("asn.tsv"));
+}
+
+AsnResolver::~AsnResolver() {
+  if (m_loaderThread.joinable())
+    m_loaderThread.join();
+}
+
+void AsnResolver::Load(const std::string &binPath,
+                       const std::string &tsvPath) {
+  try {
+    IpRangeTable::CsvLayout layout;
+    layout.Separator = '\t';
+    layout.ValueColumns = {2, 4}; // Number and organization
+    std::string error;
+    if (!m_table.OpenOrCompile(binPath, tsvPath, layout, error)) {
+      LOG("No offline ASN database (" + error + ")");
+      return;
+    }
+    LOG("ASN database loaded: " + std::to_string(m_table.NodeCount()) +
+        " nodes, " + std::to_string(m_table.ValueCount()) + " values");
+    m_tableReady.store(true, std::memory_order_release);
+  } catch (const std::exception &e) {
+    LOG("Error: Exception loading ASN database: " + std::string(e.what()));
+  }
+}
+
+bool AsnResolver::Lookup(const IpAddress &ip, AsnInfo &info) const {
+  if (!m_tableReady.load(std::memory_order_acquire))
+    return false;
+  std::string_view value = m_table.Lookup(ip);
+
+  // "<number> <organization>"
+  uint32_t number = 0;
+  size_t pos = 0;
+  while (pos < value.size() && value[pos] >= '0' && value[pos] <= '9')
+    number = number * 10 + (value[pos++] - '0');
+  if (number == 0)
+    return false; // Not announced (iptoasn lists these as AS0)
+  while (pos < value.size() && value[pos] == ' ')
+    pos++;
+
+  info.Number = number;
+  info.Organization.assign(value.begin() + pos, value.end());
+  return true;
+}
+
+bool AsnResolver::Lookup(const std::wstring &ipAddress, AsnInfo &info) const {
+  IpAddress ip;
+  return IpAddress::Parse(ipAddress, ip) && Lookup(ip, info);
+}
+
+} // namespace monitor
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "../db/Database.h"
+#include "IpAddress.h"
+#include "IpRangeTable.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace monitor {
+
+struct AsnInfo {
+  uint32_t Number = 0;
+  std::wstring Organization;
+
+  // "AS13335 CLOUDFLARENET"
+  std::wstring ToString() const;
+};
+
+// Resolves IP addresses to the autonomous system that announces them.
+//
+// Reads asn.bin next to the database, compiled at startup from asn.tsv
+// whenever the TSV is newer. The TSV uses the iptoasn.com layout:
+// "first<TAB>last<TAB>number<TAB>country<TAB>organization" rows. Lookups
+// are a longest-prefix match in the mapped table and never block.
+class AsnResolver {
+public:
+  explicit AsnResolver(const db::Database &db);
+  ~AsnResolver();
+  AsnResolver(const AsnResolver &) = delete;
+  AsnResolver &operator=(const AsnResolver &) = delete;
+
+  // False if the table is not loaded or the address is not announced
+  bool Lookup(const IpAddress &ip, AsnInfo &info) const;
+  bool Lookup(const std::wstring &ipAddress, AsnInfo &info) const;
+
+  // False until the table is loaded, or if there is none
+  bool IsLoaded() const { return m_tableReady; }
+
+private:
+  void Load(const std::string &binPath, const std::string &tsvPath);
+
+  // Written once by the loader before m_tableReady is set
+  IpRangeTable m_table;
+  std::atomic<bool> m_tableReady{false};
+  std::thread m_loaderThread;
+};
+
+} // namespace monitor
@@ -0,0 +1,259 @@
+#include "ConnectionTable.h"
+#include <algorithm>
+
+namespace monitor {
+
+uint64_t ConnectionKey::Hash() const {
+  uint64_t words[5];
+  memcpy(words, this, sizeof(words));
+  uint64_t h = 0;
+  for (uint64_t w : words)
+    h = (h ^ w ^ (h >> 29)) * 0x9E3779B97F4A7C15ull;
+  return h ^ (h >> 32);
+}
+
+// Marks an entry that is in no wheel slot list
+static constexpr uint8_t kUnscheduled = 0xFF;
+
+ConnectionTable::ConnectionTable() : ConnectionTable(Options()) {}
+
+ConnectionTable::ConnectionTable(const Options &options)
+    : m_options(options) {
+  for (auto &level : m_wheel)
+    std::fill(std::begin(level), std::end(level), kNone);
+}
+
+size_t ConnectionTable::FindSlot(const ConnectionKey &key,
+                                 uint32_t hash) const {
+  if (m_slots.empty())
+    return SIZE_MAX;
+  size_t mask = m_slots.size() - 1;
+  for (size_t pos = hash & mask; m_slots[pos].Index != kNone;
+       pos = (pos + 1) & mask) {
+    if (m_slots[pos].Hash == hash &&
+        m_entries[m_slots[pos].Index].Conn.Key == key)
+      return pos;
+  }
+  return SIZE_MAX;
+}
+
+void ConnectionTable::InsertSlot(uint32_t hash, uint32_t index) {
+  size_t mask = m_slots.size() - 1;
+  size_t pos = hash & mask;
+  while (m_slots[pos].Index != kNone)
+    pos = (pos + 1) & mask;
+  m_slots[pos] = {hash, index};
+}
+
+void ConnectionTable::EraseSlot(size_t pos) {
+  // Pull back later entries of the probe run so lookups never stop early
+  size_t mask = m_slots.size() - 1;
+  size_t hole = pos;
+  for (size_t next = (pos + 1) & mask; m_slots[next].Index != kNone;
+       next = (next + 1) & mask) {
+    size_t home = m_slots[next].Hash & mask;
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      m_slots[hole] = m_slots[next];
+      hole = next;
+    }
+  }
+  m_slots[hole] = Slot();
+}
+
+void ConnectionTable::Grow() {
+  m_slots.assign(std::max<size_t>(1024, m_slots.size() * 2), Slot());
+  for (uint32_t i = 0; i < m_entries.size(); i++)
+    if (m_entries[i].InUse)
+      InsertSlot((uint32_t)m_entries[i].Conn.Key.Hash(), i);
+}
+
+uint64_t ConnectionTable::DeadlineOf(const Entry &entry) const {
+  uint64_t timeoutMs = (uint64_t)m_options.IdleTimeout.count() * 1000;
+  return (entry.Conn.LastActive + timeoutMs + 999) / 1000;
+}
+
+void ConnectionTable::Schedule(uint32_t index, uint64_t deadline) {
+  const uint64_t maxDelta = (1ull << (kSlotBits * kLevels)) - 1;
+  deadline = std::clamp(deadline, m_tick, m_tick + maxDelta);
+  uint64_t delta = deadline - m_tick;
+  int level = 0;
+  while (level < kLevels - 1 && delta >> (kSlotBits * (level + 1)))
+    level++;
+
+  Entry &entry = m_entries[index];
+  entry.Deadline = deadline;
+  entry.Level = (uint8_t)level;
+  entry.WheelSlot = (deadline >> (kSlotBits * level)) & (kSlots - 1);
+  uint32_t &head = m_wheel[level][entry.WheelSlot];
+  entry.Prev = kNone;
+  entry.Next = head;
+  if (head != kNone)
+    m_entries[head].Prev = index;
+  head = index;
+}
+
+void ConnectionTable::Unschedule(uint32_t index) {
+  Entry &entry = m_entries[index];
+  if (entry.Level == kUnscheduled)
+    return;
+  if (entry.Prev != kNone)
+    m_entries[entry.Prev].Next = entry.Next;
+  else
+    m_wheel[entry.Level][entry.WheelSlot] = entry.Next;
+  if (entry.Next != kNone)
+    m_entries[entry.Next].Prev = entry.Prev;
+  entry.Level = kUnscheduled;
+}
+
+void ConnectionTable::Remove(size_t pos) {
+  uint32_t index = m_slots[pos].Index;
+  Entry &entry = m_entries[index];
+  Unschedule(index);
+  EraseSlot(pos);
+
+  auto it = m_perProcess.find(entry.Conn.Key.Pid);
+  if (it != m_perProcess.end() && --it->second == 0)
+    m_perProcess.erase(it);
+  entry.InUse = false;
+  entry.Next = m_freeHead;
+  m_freeHead = index;
+  m_count--;
+}
+
+void ConnectionTable::Open(const ConnectionKey &key, bool inbound,
+                           uint64_t now) {
+  if (!m_started) {
+    m_tick = now / 1000;
+    m_started = true;
+  }
+  uint32_t hash = (uint32_t)key.Hash();
+  size_t pos = FindSlot(key, hash);
+  if (pos != SIZE_MAX) {
+    Touch(key, now);
+    return;
+  }
+  if (m_count >= m_options.MaxConnections) {
+    m_stats.Dropped++;
+    return;
+  }
+  if ((m_count + 1) * 2 > m_slots.size())
+    Grow();
+
+  uint32_t index;
+  if (m_freeHead != kNone) {
+    index = m_freeHead;
+    m_freeHead = m_entries[index].Next;
+  } else {
+    index = (uint32_t)m_entries.size();
+    m_entries.emplace_back();
+  }
+  Entry &entry = m_entries[index];
+  entry.Conn = {key, inbound, now, now};
+  entry.InUse = true;
+  entry.Level = kUnscheduled;
+  InsertSlot(hash, index);
+  Schedule(index, DeadlineOf(entry));
+
+  m_count++;
+  m_perProcess[key.Pid]++;
+  m_stats.Opened++;
+  m_stats.Peak = std::max(m_stats.Peak, m_count);
+}
+
+void ConnectionTable::Close(const ConnectionKey &key, uint64_t now) {
+  size_t pos = FindSlot(key, (uint32_t)key.Hash());
+  if (pos == SIZE_MAX)
+    return; // Opened before we started, or dropped
+  const Connection &conn = m_entries[m_slots[pos].Index].Conn;
+  m_stats.Closed++;
+  m_stats.ClosedMs += now > conn.OpenedAt ? now - conn.OpenedAt : 0;
+  Remove(pos);
+}
+
+bool ConnectionTable::Touch(const ConnectionKey &key, uint64_t now) {
+  size_t pos = FindSlot(key, (uint32_t)key.Hash());
+  if (pos == SIZE_MAX)
+    return false;
+  Connection &conn = m_entries[m_slots[pos].Index].Conn;
+  conn.LastActive = std::max(conn.LastActive, now);
+  return true;
+}
+
+void ConnectionTable::Cascade(int level) {
+  uint32_t &head =
+      m_wheel[level][(m_tick >> (kSlotBits * level)) & (kSlots - 1)];
+  uint32_t index = head;
+  head = kNone;
+  while (index != kNone) {
+    uint32_t next = m_entries[index].Next;
+    m_entries[index].Level = kUnscheduled;
+    Schedule(index, m_entries[index].Deadline);
+    index = next;
+  }
+}
+
+void ConnectionTable::Expire(uint64_t now) {
+  uint64_t target = now / 1000;
+  if (!m_started) {
+    m_tick = target;
+    m_started = true;
+    return;
+  }
+  while (m_tick < target) {
+    m_tick++;
+    if ((m_tick & (kSlots - 1)) == 0) {
+      // Move the next block of each coarser level down a level
+      for (int level = kLevels - 1; level > 0; level--)
+        if ((m_tick & ((1ull << (kSlotBits * level)) - 1)) == 0)
+          Cascade(level);
+    }
+
+    uint32_t &head = m_wheel[0][m_tick & (kSlots - 1)];
+    uint32_t index = head;
+    head = kNone;
+    while (index != kNone) {
+      Entry &entry = m_entries[index];
+      uint32_t next = entry.Next;
+      entry.Level = kUnscheduled;
+      // Touched since it was scheduled: not idle yet
+      uint64_t deadline = DeadlineOf(entry);
+      if (deadline > m_tick) {
+        Schedule(index, deadline);
+      } else {
+        m_stats.Expired++;
+        Remove(FindSlot(entry.Conn.Key, (uint32_t)entry.Conn.Key.Hash()));
+      }
+      index = next;
+    }
+  }
+}
+
+ConnectionTable::Stats ConnectionTable::GetStats() const {
+  Stats stats = m_stats;
+  stats.Open = m_count;
+  stats.Bytes = m_slots.capacity() * sizeof(Slot) +
+                m_entries.capacity() * sizeof(Entry);
+  return stats;
+}
+
+std::vector<ConnectionTable::Connection>
+ConnectionTable::GetOldest(size_t limit) const {
+  std::vector<uint32_t> open;
+  open.reserve(m_count);
+  for (uint32_t i = 0; i < m_entries.size(); i++)
+    if (m_entries[i].InUse)
+      open.push_back(i);
+  size_t n = std::min(limit, open.size());
+  std::partial_sort(open.begin(), open.begin() + n, open.end(),
+                    [this](uint32_t a, uint32_t b) {
+                      return m_entries[a].Conn.OpenedAt <
+                             m_entries[b].Conn.OpenedAt;
+                    });
+  std::vector<Connection> result;
+  result.reserve(n);
+  for (size_t i = 0; i < n; i++)
+    result.push_back(m_entries[open[i]].Conn);
+  return result;
+}
+
+} // namespace monitor
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "IpAddress.h"
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace monitor {
+
+// A TCP connection as owned by one process. The connect, accept and
+// disconnect events only exist for TCP, so the protocol is implied.
+// Packed without padding so hashing and comparing read five 64-bit words.
+struct ConnectionKey {
+  IpAddress Local;
+  IpAddress Remote;
+  uint16_t LocalPort = 0; // Host order
+  uint16_t RemotePort = 0;
+  uint32_t Pid = 0;
+
+  bool operator==(const ConnectionKey &other) const {
+    return memcmp(this, &other, sizeof(*this)) == 0;
+  }
+  uint64_t Hash() const;
+};
+static_assert(sizeof(ConnectionKey) == 40, "ConnectionKey must stay packed");
+
+// Open TCP connections, driven by the Kernel-Network lifecycle events.
+//
+// An open-addressing hash table (linear probing, backward-shift deletion)
+// maps keys to entries in a separate array, so entries never move and can
+// be linked into a hierarchical timer wheel: three levels of 64 one-second
+// slots covering about three days. A connection whose disconnect was never
+// seen expires 'IdleTimeout' after its last activity. Activity only updates
+// a timestamp; the timer notices and reschedules when it fires, so both
+// are O(1) amortized.
+//
+// Both arrays grow on demand up to 'MaxConnections', about 100 bytes per
+// connection. Connections opened past that are counted, not tracked.
+// Not thread-safe; times are milliseconds on a monotonic clock.
+class ConnectionTable {
+public:
+  struct Options {
+    size_t MaxConnections = 1 << 20;
+    std::chrono::seconds IdleTimeout{2 * 3600}; // Windows keepalive time
+  };
+
+  struct Connection {
+    ConnectionKey Key;
+    bool Inbound = false; // Accepted rather than connected
+    uint64_t OpenedAt = 0;
+    uint64_t LastActive = 0;
+  };
+
+  struct Stats {
+    size_t Open = 0;
+    size_t Peak = 0;
+    uint64_t Opened = 0;
+    uint64_t Closed = 0;
+    uint64_t Expired = 0; // Idle past the timeout, disconnect never seen
+    uint64_t Dropped = 0; // Table full
+    uint64_t ClosedMs = 0; // Summed lifetime of closed connections
+    size_t Bytes = 0;
+  };
+
+  ConnectionTable();
+  explicit ConnectionTable(const Options &options);
+
+  // A connect or accept. An already open key only counts as activity.
+  void Open(const ConnectionKey &key, bool inbound, uint64_t now);
+  void Close(const ConnectionKey &key, uint64_t now);
+  // Activity on the connection, false if it is not open
+  bool Touch(const ConnectionKey &key, uint64_t now);
+  // Runs the timer wheel up to 'now'
+  void Expire(uint64_t now);
+
+  Stats GetStats() const;
+  // Open connections per process id
+  const std::unordered_map<uint32_t, size_t> &CountByProcess() const {
+    return m_perProcess;
+  }
+  // Up to 'limit' open connections, longest open first
+  std::vector<Connection> GetOldest(size_t limit) const;
+
+private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+  static constexpr int kLevels = 3;
+  static constexpr int kSlotBits = 6;
+  static constexpr uint32_t kSlots = 1u << kSlotBits;
+
+  struct Slot {
+    uint32_t Hash = 0; // Low bits of the key hash
+    uint32_t Index = kNone;
+  };
+
+  struct Entry {
+    Connection Conn;
+    uint64_t Deadline = 0; // Timer wheel tick
+    uint32_t Next = kNone; // Timer slot list, or the free list
+    uint32_t Prev = kNone;
+    uint8_t Level = 0; // Wheel position, to unlink from the list head
+    uint8_t WheelSlot = 0;
+    bool InUse = false;
+  };
+
+  size_t FindSlot(const ConnectionKey &key, uint32_t hash) const;
+  void InsertSlot(uint32_t hash, uint32_t index);
+  void EraseSlot(size_t pos);
+  void Grow();
+  void Remove(size_t pos);
+
+  void Schedule(uint32_t index, uint64_t deadline);
+  void Unschedule(uint32_t index);
+  void Cascade(int level);
+  uint64_t DeadlineOf(const Entry &entry) const;
+
+  Options m_options;
+  std::vector<Slot> m_slots; // Power of two, at most half full
+  std::vector<Entry> m_entries;
+  uint32_t m_freeHead = kNone;
+  size_t m_count = 0;
+
+  uint32_t m_wheel[kLevels][kSlots];
+  uint64_t m_tick = 0; // Last tick the wheel ran, in seconds
+  bool m_started = false;
+
+  std::unordered_map<uint32_t, size_t> m_perProcess;
+  Stats m_stats;
+};
+
+} // namespace monitor
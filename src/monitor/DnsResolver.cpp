@@ -1,41 +1,300 @@
 #include "DnsResolver.h"
-#include <iomanip>
-#include <sstream>
-
+#include <algorithm>
+#include <cwctype>
 
 namespace monitor {
 
-void DnsResolver::AddMapping(const std::wstring &ipAddress,
-                             const std::wstring &domainName) {
-  std::lock_guard<std::mutex> lock(m_mutex);
-  m_cache[ipAddress] = domainName;
+static std::wstring NormalizeName(const std::wstring &name) {
+  std::wstring out = name;
+  std::transform(out.begin(), out.end(), out.begin(),
+                 [](wchar_t c) { return (wchar_t)towlower(c); });
+  while (!out.empty() && out.back() == L'.')
+    out.pop_back();
+  return out;
+}
+
+DnsResolver::DnsResolver() : DnsResolver(Options()) {}
+
+DnsResolver::DnsResolver(const Options &options) : m_options(options) {
+  if (m_options.MaxAddressesPerDomain == 0)
+    m_options.MaxAddressesPerDomain = 1;
+}
+
+size_t DnsResolver::Footprint(const DomainRecord &domain) {
+  // The name is stored twice: in the record and as the map key
+  size_t bytes = sizeof(DomainRecord) + sizeof(std::wstring) +
+                 sizeof(void *) * 3 +
+                 domain.Name.capacity() * sizeof(wchar_t) * 2;
+  bytes += domain.CnameChain.capacity() * sizeof(std::wstring);
+  for (const auto &alias : domain.CnameChain)
+    bytes += alias.capacity() * sizeof(wchar_t);
+  bytes += domain.Addresses.capacity() * sizeof(IpAddress);
+  return bytes;
+}
+
+void DnsResolver::Account(DomainRecord &domain) {
+  m_bytes -= domain.Bytes;
+  domain.Bytes = Footprint(domain);
+  m_bytes += domain.Bytes;
+}
+
+void DnsResolver::ReleaseIfUnused(DomainRecord *domain) {
+  if (domain->Addresses.empty() && domain->ProcessRefs == 0) {
+    m_bytes -= domain->Bytes;
+    m_domains.erase(domain->Name); // Destroys 'domain'
+  } else {
+    Account(*domain);
+  }
+}
+
+void DnsResolver::Unlink(const IpAddress &ip, DomainRecord *domain) {
+  auto &addresses = domain->Addresses;
+  addresses.erase(std::remove(addresses.begin(), addresses.end(), ip),
+                  addresses.end());
+  ReleaseIfUnused(domain);
+}
+
+void DnsResolver::Remove(
+    std::unordered_map<IpAddress, AddressEntry, IpAddressHash>::iterator it) {
+  Unlink(it->first, it->second.Domain);
+  m_lru.erase(it->second.LruPos);
+  m_addresses.erase(it);
+  m_bytes -= kAddressBytes;
+}
+
+DnsResolver::AddressEntry *DnsResolver::Touch(const IpAddress &ip) {
+  auto it = m_addresses.find(ip);
+  if (it == m_addresses.end())
+    return nullptr;
+  auto now = Clock::now();
+  if (it->second.Expires <= now) {
+    Remove(it);
+    m_expired++;
+    return nullptr;
+  }
+  // Moving to the front keeps the list in expiry order as well
+  it->second.Expires = now + m_options.Ttl;
+  m_lru.splice(m_lru.begin(), m_lru, it->second.LruPos);
+  return &it->second;
+}
+
+void DnsResolver::AttributeLocked(uint32_t pid, uint64_t timestamp,
+                                  const IpAddress &ip, DomainRecord *domain,
+                                  Clock::time_point now) {
+  ProcessKey key{pid, ip};
+  auto [it, inserted] =
+      m_processAddresses.try_emplace(key, ProcessEntry{domain, timestamp, now});
+  if (inserted) {
+    domain->ProcessRefs++;
+    m_processQueue.push_back({key, now});
+    m_bytes += kProcessEntryBytes;
+    return;
+  }
+
+  ProcessEntry &entry = it->second;
+  if (timestamp < entry.Timestamp)
+    return; // An older answer delivered late
+  if (entry.Domain != domain) {
+    DomainRecord *previous = entry.Domain;
+    entry.Domain = domain;
+    domain->ProcessRefs++;
+    previous->ProcessRefs--;
+    ReleaseIfUnused(previous);
+  }
+  entry.Timestamp = timestamp;
+  entry.LastUsed = now;
+}
+
+bool DnsResolver::PopProcessEntry(Clock::time_point now, bool force) {
+  while (!m_processQueue.empty()) {
+    QueuedKey front = m_processQueue.front();
+    if (!force && front.QueuedAt + m_options.Ttl > now)
+      return false;
+    m_processQueue.pop_front();
+
+    auto it = m_processAddresses.find(front.Key);
+    const ProcessEntry &entry = it->second;
+    if (entry.LastUsed > front.QueuedAt &&
+        (force || entry.LastUsed + m_options.Ttl > now)) {
+      m_processQueue.push_back({front.Key, entry.LastUsed});
+      continue;
+    }
+
+    DomainRecord *domain = entry.Domain;
+    m_processAddresses.erase(it);
+    m_bytes -= kProcessEntryBytes;
+    domain->ProcessRefs--;
+    ReleaseIfUnused(domain);
+    return true;
+  }
+  return false;
+}
+
+void DnsResolver::Trim(Clock::time_point now) {
+  while (PopProcessEntry(now, false))
+    m_expired++;
+
+  while (!m_lru.empty()) {
+    auto it = m_addresses.find(m_lru.back());
+    if (it->second.Expires <= now) {
+      m_expired++;
+    } else if (m_bytes <= m_options.MaxBytes) {
+      break;
+    } else if (!m_processQueue.empty() &&
+               m_processQueue.front().QueuedAt + m_options.Ttl <
+                   it->second.Expires) {
+      // The process attribution was queued before this address was used
+      if (PopProcessEntry(now, true))
+        m_evicted++;
+      continue;
+    } else {
+      m_evicted++;
+    }
+    Remove(it);
+  }
+
+  while (m_bytes > m_options.MaxBytes && PopProcessEntry(now, true))
+    m_evicted++;
 }
 
-std::wstring DnsResolver::GetDomain(const std::wstring &ipAddress) const {
+void DnsResolver::AddAnswer(uint32_t pid, uint64_t timestamp,
+                            const std::wstring &queryName,
+                            const std::vector<std::wstring> &cnameChain,
+                            const std::vector<IpAddress> &addresses) {
+  std::wstring name = NormalizeName(queryName);
+  if (name.empty() || addresses.empty())
+    return;
+
   std::lock_guard<std::mutex> lock(m_mutex);
-  auto it = m_cache.find(ipAddress);
-  if (it != m_cache.end()) {
-    return it->second;
+  auto now = Clock::now();
+
+  auto &slot = m_domains[name];
+  if (!slot) {
+    slot = std::make_unique<DomainRecord>();
+    slot->Name = name;
+  }
+  DomainRecord *domain = slot.get();
+  domain->CnameChain.clear();
+  for (const auto &alias : cnameChain)
+    domain->CnameChain.push_back(NormalizeName(alias));
+
+  for (const IpAddress &ip : addresses) {
+    if (ip.IsUnspecified())
+      continue;
+
+    auto it = m_addresses.find(ip);
+    if (it != m_addresses.end() && it->second.Domain == domain) {
+      it->second.Expires = now + m_options.Ttl;
+      m_lru.splice(m_lru.begin(), m_lru, it->second.LruPos);
+      if (pid != 0)
+        AttributeLocked(pid, timestamp, ip, domain, now);
+      continue;
+    }
+
+    // Drop the domain's oldest address directly rather than through
+    // Remove(), which would free the record if that emptied it
+    if (domain->Addresses.size() >= m_options.MaxAddressesPerDomain) {
+      auto oldest = m_addresses.find(domain->Addresses.front());
+      domain->Addresses.erase(domain->Addresses.begin());
+      m_lru.erase(oldest->second.LruPos);
+      m_addresses.erase(oldest);
+      m_bytes -= kAddressBytes;
+      m_evicted++;
+    }
+
+    if (it != m_addresses.end()) {
+      // Re-resolved under another name; the latest answer wins
+      Unlink(ip, it->second.Domain);
+      it->second.Domain = domain;
+      it->second.Expires = now + m_options.Ttl;
+      m_lru.splice(m_lru.begin(), m_lru, it->second.LruPos);
+    } else {
+      m_lru.push_front(ip);
+      m_addresses.emplace(ip,
+                          AddressEntry{domain, now + m_options.Ttl,
+                                       m_lru.begin()});
+      m_bytes += kAddressBytes;
+    }
+    domain->Addresses.push_back(ip);
+    if (pid != 0)
+      AttributeLocked(pid, timestamp, ip, domain, now);
   }
+
+  ReleaseIfUnused(domain);
+  Trim(now);
+}
+
+std::wstring DnsResolver::GetDomain(const IpAddress &ip) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (AddressEntry *entry = Touch(ip))
+    return entry->Domain->Name;
   return L""; // Not found
 }
 
+std::wstring DnsResolver::GetDomain(const std::wstring &ipAddress) {
+  IpAddress ip;
+  if (!IpAddress::Parse(ipAddress, ip))
+    return L"";
+  return GetDomain(ip);
+}
+
+std::wstring DnsResolver::GetDomain(uint32_t pid, const IpAddress &ip) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_processAddresses.find(ProcessKey{pid, ip});
+  if (it != m_processAddresses.end()) {
+    auto now = Clock::now();
+    if (it->second.LastUsed + m_options.Ttl > now) {
+      it->second.LastUsed = now; // Requeued lazily, see PopProcessEntry
+      return it->second.Domain->Name;
+    }
+  }
+  if (AddressEntry *entry = Touch(ip))
+    return entry->Domain->Name;
+  return L"";
+}
+
+std::wstring DnsResolver::GetDomain(uint32_t pid,
+                                    const std::wstring &ipAddress) {
+  IpAddress ip;
+  if (!IpAddress::Parse(ipAddress, ip))
+    return L"";
+  return GetDomain(pid, ip);
+}
+
+std::vector<std::wstring> DnsResolver::GetCnameChain(const IpAddress &ip) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (AddressEntry *entry = Touch(ip))
+    return entry->Domain->CnameChain;
+  return {};
+}
+
+std::vector<IpAddress> DnsResolver::GetAddresses(const std::wstring &domain) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_domains.find(NormalizeName(domain));
+  if (it == m_domains.end())
+    return {};
+  return it->second->Addresses;
+}
+
+DnsResolver::Stats DnsResolver::GetStats() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  Stats stats;
+  stats.Addresses = m_addresses.size();
+  stats.ProcessAddresses = m_processAddresses.size();
+  stats.Domains = m_domains.size();
+  stats.Bytes = m_bytes;
+  stats.MaxBytes = m_options.MaxBytes;
+  stats.Evicted = m_evicted;
+  stats.Expired = m_expired;
+  return stats;
+}
+
 std::wstring DnsResolver::IPv4ToString(uint32_t ip) {
-  std::wstringstream ss;
-  ss << ((ip >> 0) & 0xFF) << L"." << ((ip >> 8) & 0xFF) << L"."
-     << ((ip >> 16) & 0xFF) << L"." << ((ip >> 24) & 0xFF);
-  return ss.str();
+  return IpAddress::FromV4(ip).ToString();
 }
 
 std::wstring DnsResolver::IPv6ToString(const uint8_t *ip) {
-  std::wstringstream ss;
-  for (int i = 0; i < 16; i += 2) {
-    if (i > 0)
-      ss << L":";
-    ss << std::hex << std::setw(2) << std::setfill(L'0') << (int)ip[i]
-       << std::setw(2) << std::setfill(L'0') << (int)ip[i + 1];
-  }
-  return ss.str();
+  return IpAddress::FromV6(ip).ToString();
 }
 
 } // namespace monitor
@@ -1,24 +1,77 @@
 #pragma once
 
+#include "IpAddress.h"
+#include <chrono>
 #include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
-
+#include <vector>
 
 namespace monitor {
 
-// Caches IP address to domain name mappings from DNS queries
+// Caches IP address to domain name mappings from DNS queries.
+//
+// Every answer address is kept in binary form and points at a shared record
+// for the name that was queried, so traffic to a CDN edge still shows the
+// name the application asked for rather than the end of the CNAME chain.
+// Entries expire 'Ttl' after they were last resolved or looked up and the
+// least recently used ones are evicted once the estimated footprint exceeds
+// 'MaxBytes'. The DNS-Client events carry no record TTL, hence the fixed
+// one: it only bounds how long an idle mapping is trusted.
+//
+// A CDN address is often shared by many names, so answers are also indexed
+// by the querying process: a (pid, ip) lookup returns that process's most
+// recent answer and only falls back to the global, last-writer-wins mapping
+// if the process never resolved the address itself.
 class DnsResolver {
 public:
-  DnsResolver() = default;
+  struct Options {
+    size_t MaxBytes = 8 * 1024 * 1024;
+    std::chrono::seconds Ttl{3600};
+    size_t MaxAddressesPerDomain = 64;
+  };
+
+  struct Stats {
+    size_t Addresses = 0;
+    size_t ProcessAddresses = 0; // (pid, ip) attributions
+    size_t Domains = 0;
+    size_t Bytes = 0; // Estimated
+    size_t MaxBytes = 0;
+    uint64_t Evicted = 0; // Dropped for space, not age
+    uint64_t Expired = 0;
+  };
+
+  DnsResolver();
+  explicit DnsResolver(const Options &options);
+
+  // Called when a DNS query result is observed. 'cnameChain' lists the
+  // aliases between 'queryName' and the addresses, in resolution order.
+  // 'pid' is the querying process (0 if unknown) and 'timestamp' the event
+  // time, used to keep the most recent answer if events arrive out of order.
+  void AddAnswer(uint32_t pid, uint64_t timestamp,
+                 const std::wstring &queryName,
+                 const std::vector<std::wstring> &cnameChain,
+                 const std::vector<IpAddress> &addresses);
+
+  // Lookup the queried (origin) domain name for an IP address
+  std::wstring GetDomain(const IpAddress &ip);
+  std::wstring GetDomain(const std::wstring &ipAddress);
 
-  // Called when a DNS query result is observed
-  void AddMapping(const std::wstring &ipAddress,
-                  const std::wstring &domainName);
+  // Same, preferring what 'pid' itself resolved the address as
+  std::wstring GetDomain(uint32_t pid, const IpAddress &ip);
+  std::wstring GetDomain(uint32_t pid, const std::wstring &ipAddress);
 
-  // Lookup domain name for an IP address
-  std::wstring GetDomain(const std::wstring &ipAddress) const;
+  // Aliases the origin name resolved through, empty if none or unknown
+  std::vector<std::wstring> GetCnameChain(const IpAddress &ip);
+
+  // Addresses currently cached for a queried name
+  std::vector<IpAddress> GetAddresses(const std::wstring &domain);
+
+  Stats GetStats() const;
 
   // Convert IPv4 bytes to string
   static std::wstring IPv4ToString(uint32_t ip);
@@ -27,8 +80,82 @@ public:
   static std::wstring IPv6ToString(const uint8_t *ip);
 
 private:
+  using Clock = std::chrono::steady_clock;
+
+  struct DomainRecord {
+    std::wstring Name;
+    std::vector<std::wstring> CnameChain;
+    std::vector<IpAddress> Addresses; // Cached addresses pointing here
+    uint32_t ProcessRefs = 0;         // Process entries pointing here
+    size_t Bytes = 0;                 // Last accounted footprint
+  };
+
+  struct AddressEntry {
+    DomainRecord *Domain;
+    Clock::time_point Expires;
+    std::list<IpAddress>::iterator LruPos;
+  };
+
+  // Map node, bucket pointer and LRU list node of one cached address
+  static constexpr size_t kAddressBytes =
+      sizeof(IpAddress) * 2 + sizeof(AddressEntry) + sizeof(void *) * 5;
+
+  struct ProcessKey {
+    uint32_t Pid;
+    IpAddress Ip;
+    bool operator==(const ProcessKey &other) const {
+      return Pid == other.Pid && Ip == other.Ip;
+    }
+  };
+
+  struct ProcessKeyHash {
+    size_t operator()(const ProcessKey &key) const {
+      return IpAddressHash()(key.Ip) ^ (key.Pid * 0x9E3779B97F4A7C15ull);
+    }
+  };
+
+  struct ProcessEntry {
+    DomainRecord *Domain;
+    uint64_t Timestamp; // Event time of the answer
+    Clock::time_point LastUsed;
+  };
+
+  // The queue holds one record per process entry, in the order they were
+  // (re)queued. Entries used since are requeued when they reach the front
+  // instead of being moved on every lookup.
+  struct QueuedKey {
+    ProcessKey Key;
+    Clock::time_point QueuedAt;
+  };
+
+  static constexpr size_t kProcessEntryBytes =
+      sizeof(ProcessKey) + sizeof(ProcessEntry) + sizeof(void *) * 3 +
+      sizeof(QueuedKey);
+
+  // Callers hold m_mutex
+  AddressEntry *Touch(const IpAddress &ip);
+  void Unlink(const IpAddress &ip, DomainRecord *domain);
+  void Remove(std::unordered_map<IpAddress, AddressEntry,
+                                 IpAddressHash>::iterator it);
+  void Account(DomainRecord &domain);
+  void ReleaseIfUnused(DomainRecord *domain);
+  void AttributeLocked(uint32_t pid, uint64_t timestamp, const IpAddress &ip,
+                       DomainRecord *domain, Clock::time_point now);
+  bool PopProcessEntry(Clock::time_point now, bool force);
+  void Trim(Clock::time_point now);
+  static size_t Footprint(const DomainRecord &domain);
+
+  Options m_options;
   mutable std::mutex m_mutex;
-  std::unordered_map<std::wstring, std::wstring> m_cache; // IP -> Domain
+  std::unordered_map<IpAddress, AddressEntry, IpAddressHash> m_addresses;
+  std::unordered_map<std::wstring, std::unique_ptr<DomainRecord>> m_domains;
+  std::list<IpAddress> m_lru; // Most recently used first
+  std::unordered_map<ProcessKey, ProcessEntry, ProcessKeyHash>
+      m_processAddresses;
+  std::deque<QueuedKey> m_processQueue;
+  size_t m_bytes = 0;
+  uint64_t m_evicted = 0;
+  uint64_t m_expired = 0;
 };
 
 } // namespace monitor
@@ -134,6 +134,14 @@ bool ETWController::EnableProviders() {
       0x5329,
       0x4832,
       {0x8d, 0xfd, 0x43, 0xd9, 0x79, 0x15, 0x3a, 0x88}};
+  // Microsoft-Windows-Kernel-Process
+  static const GUID KernelProcGuid = {
+      0x22fb2cd6,
+      0x0e7b,
+      0x422b,
+      {0xa0, 0xc7, 0x2f, 0xad, 0x1f, 0xd0, 0xe7, 0x16}};
+  // WINEVENT_KEYWORD_PROCESS only; thread and image events are too chatty
+  static const ULONGLONG KernelProcProcessKeyword = 0x10;
 
   EnableTraceEx2(m_sessionHandle, &TcpipGuid,
                  EVENT_CONTROL_CODE_ENABLE_PROVIDER, TRACE_LEVEL_INFORMATION,
@@ -143,6 +151,9 @@ bool ETWController::EnableProviders() {
   EnableTraceEx2(m_sessionHandle, &KernelNetGuid,
                  EVENT_CONTROL_CODE_ENABLE_PROVIDER, TRACE_LEVEL_INFORMATION,
                  0xFFFFFFFFFFFFFFFF, 0, 0, nullptr);
+  EnableTraceEx2(m_sessionHandle, &KernelProcGuid,
+                 EVENT_CONTROL_CODE_ENABLE_PROVIDER, TRACE_LEVEL_INFORMATION,
+                 KernelProcProcessKeyword, 0, 0, nullptr);
 
   return true;
 }
@@ -151,8 +162,11 @@ void ETWController::ProcessTraceLoop() {
   LOG("ETWController::ProcessTraceLoop starting");
   EVENT_TRACE_LOGFILEW logFile = {0};
   logFile.LoggerName = const_cast<LPWSTR>(m_sessionName.c_str());
-  logFile.ProcessTraceMode =
-      PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+  // Raw timestamps stay in the session's QPC clock, see EventClock;
+  // otherwise ETW converts them to FILETIME system time
+  logFile.ProcessTraceMode = PROCESS_TRACE_MODE_REAL_TIME |
+                             PROCESS_TRACE_MODE_EVENT_RECORD |
+                             PROCESS_TRACE_MODE_RAW_TIMESTAMP;
   logFile.Context = this;
   logFile.EventRecordCallback = ProcessEventThunk;
 
@@ -0,0 +1,47 @@
+#include "EventClock.h"
+#include <windows.h>
+
+namespace monitor {
+
+// 100 ns FILETIME ticks between 1601 and 1970
+static const int64_t kUnixEpochFiletime = 116444736000000000LL;
+
+static int64_t FiletimeToUnixMicros(const FILETIME &ft) {
+  ULARGE_INTEGER t;
+  t.LowPart = ft.dwLowDateTime;
+  t.HighPart = ft.dwHighDateTime;
+  return ((int64_t)t.QuadPart - kUnixEpochFiletime) / 10;
+}
+
+EventClock::EventClock() {
+  LARGE_INTEGER frequency;
+  QueryPerformanceFrequency(&frequency);
+  m_frequency = frequency.QuadPart > 0 ? frequency.QuadPart : 1;
+  Anchor();
+}
+
+void EventClock::Anchor() {
+  LARGE_INTEGER qpc;
+  FILETIME now;
+  QueryPerformanceCounter(&qpc);
+  GetSystemTimePreciseAsFileTime(&now);
+  m_anchorQpc = qpc.QuadPart;
+  m_anchorUs = FiletimeToUnixMicros(now);
+}
+
+int64_t EventClock::ToUnixMicros(int64_t qpc) {
+  if (qpc - m_anchorQpc > 5 * m_frequency)
+    Anchor();
+  // Split so the multiplication cannot overflow for old events
+  int64_t delta = qpc - m_anchorQpc;
+  return m_anchorUs + delta / m_frequency * 1000000 +
+         delta % m_frequency * 1000000 / m_frequency;
+}
+
+int64_t EventClock::NowUnixMicros() {
+  FILETIME now;
+  GetSystemTimePreciseAsFileTime(&now);
+  return FiletimeToUnixMicros(now);
+}
+
+} // namespace monitor
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+namespace monitor {
+
+// Maps ETW event timestamps to Unix time. The session is opened with
+// ClientContext 1 and consumed with PROCESS_TRACE_MODE_RAW_TIMESTAMP, so
+// timestamps are QueryPerformanceCounter ticks.
+//
+// The mapping is anchored on a (QPC, system time) pair taken together and
+// re-anchored every few seconds of event time, so QPC drift and system
+// clock adjustments never accumulate. Not thread-safe: owned by the ETW
+// callback thread.
+class EventClock {
+public:
+  EventClock();
+
+  // Microseconds since 1970 for a QPC value
+  int64_t ToUnixMicros(int64_t qpc);
+
+  static int64_t NowUnixMicros();
+
+private:
+  void Anchor();
+
+  int64_t m_frequency = 1;
+  int64_t m_anchorQpc = 0;
+  int64_t m_anchorUs = 0;
+};
+
+} // namespace monitor
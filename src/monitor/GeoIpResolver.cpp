@@ -1,5 +1,7 @@
 #include "GeoIpResolver.h"
 #include "../utils/Logger.h"
+#include <algorithm>
+#include <ctime>
 #include <iostream>
 #include <windows.h>
 #include <winhttp.h>
@@ -8,7 +10,14 @@
 
 namespace monitor {
 
-GeoIpResolver::GeoIpResolver() {
+GeoIpResolver::GeoIpResolver(db::Database &db,
+                             const NetworkClassifier &networks)
+    : GeoIpResolver(db, networks, Options()) {}
+
+GeoIpResolver::GeoIpResolver(db::Database &db,
+                             const NetworkClassifier &networks,
+                             const Options &options)
+    : m_db(db), m_networks(networks), m_options(options) {
   LOG("GeoIpResolver initializing");
   m_workerThread = std::thread(&GeoIpResolver::WorkerLoop, this);
 }
@@ -24,69 +33,168 @@ GeoIpResolver::~GeoIpResolver() {
   }
 }
 
-std::wstring GeoIpResolver::GetCountryCode(const std::wstring &ipAddress) {
-  if (ipAddress.empty() || IsLocal(ipAddress)) {
+std::wstring GeoIpResolver::GetCountryCode(const std::wstring &ipAddress,
+                                           uint64_t bytes) {
+  IpAddress ip;
+  if (!IpAddress::Parse(ipAddress, ip) ||
+      m_networks.GetClass(ip) != NetworkClass::Internet)
     return L"Local";
-  }
+
+  std::wstring code;
+  if (LookupOffline(ip, code))
+    return code;
 
   std::lock_guard<std::mutex> lock(m_mutex);
   auto it = m_cache.find(ipAddress);
   if (it != m_cache.end()) {
-    return it->second;
+    if (it->second.Expires > (int64_t)std::time(nullptr))
+      return it->second.Country.empty() ? L"??" : it->second.Country;
+    m_cache.erase(it);
   }
+  if (!m_onlineFallback)
+    return L"??";
 
-  // Not in cache, queue for lookup if not already requested
-  if (m_requested.find(ipAddress) == m_requested.end()) {
-    m_requested[ipAddress] = true;
-    m_pendingIps.push(ipAddress);
-    m_cv.notify_one();
+  // Not resolved yet: queue it, or raise its priority if already queued
+  if (m_inFlight.count(ipAddress) == 0) {
+    auto [pending, inserted] = m_pending.try_emplace(ipAddress, 0);
+    pending->second += bytes;
+    if (inserted) {
+      if (m_pending.size() > m_options.MaxPending)
+        DropQuietest();
+      m_cv.notify_one();
+    }
   }
 
   return L".."; // Indicates lookup in progress
 }
 
-bool GeoIpResolver::IsLocal(const std::wstring &ip) {
-  if (ip == L"127.0.0.1" || ip == L"::1")
-    return true;
-  if (ip.find(L"192.168.") == 0)
-    return true;
-  if (ip.find(L"10.") == 0)
-    return true;
-  if (ip.find(L"172.") == 0 && ip.length() >= 7) {
-    // Very basic check for 172.16.x.x - 172.31.x.x
-    try {
-      int second = std::stoi(ip.substr(4, 2));
-      if (second >= 16 && second <= 31)
-        return true;
-    } catch (...) {
-    }
+bool GeoIpResolver::LookupOffline(const IpAddress &ip,
+                                  std::wstring &code) const {
+  if (!m_tableReady.load(std::memory_order_acquire))
+    return false;
+  std::string_view value = m_table.Lookup(ip);
+  if (value.empty())
+    return false;
+  code.assign(value.begin(), value.end());
+  return true;
+}
+
+void GeoIpResolver::LoadDatabase(const std::string &binPath,
+                                 const std::string &csvPath) {
+  std::string error;
+  if (!m_table.OpenOrCompile(binPath, csvPath, IpRangeTable::CsvLayout(),
+                             error)) {
+    LOG("No offline GeoIP database (" + error + "), using ip-api.com");
+    return;
+  }
+  LOG("GeoIP database loaded: " + std::to_string(m_table.NodeCount()) +
+      " nodes, " + std::to_string(m_table.ValueCount()) + " values");
+  m_tableReady.store(true, std::memory_order_release);
+}
+
+void GeoIpResolver::LoadCache() {
+  auto records = m_db.LoadGeoIpCache();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (const auto &record : records)
+    m_cache[record.Ip] = {record.Country, record.Expires};
+  LOG("GeoIP cache: " + std::to_string(records.size()) + " entries loaded");
+}
+
+std::vector<GeoIpResolver::Pending> GeoIpResolver::TakeBatch() {
+  std::vector<Pending> all;
+  all.reserve(m_pending.size());
+  for (const auto &[ip, bytes] : m_pending)
+    all.push_back({ip, bytes});
+
+  size_t n = std::min(all.size(), m_options.BatchSize);
+  std::partial_sort(all.begin(), all.begin() + n, all.end(),
+                    [](const Pending &a, const Pending &b) {
+                      return a.Bytes > b.Bytes;
+                    });
+  all.resize(n);
+  for (const auto &p : all) {
+    m_pending.erase(p.Ip);
+    m_inFlight.insert(p.Ip);
   }
-  return false;
+  return all;
+}
+
+void GeoIpResolver::DropQuietest() {
+  // Drop the bottom tenth at once so a scan does not pay this per address
+  std::vector<std::pair<uint64_t, const std::wstring *>> order;
+  order.reserve(m_pending.size());
+  for (const auto &[ip, bytes] : m_pending)
+    order.push_back({bytes, &ip});
+  size_t drop = std::max<size_t>(1, order.size() / 10);
+  std::nth_element(order.begin(), order.begin() + drop, order.end());
+  std::vector<std::wstring> victims;
+  for (size_t i = 0; i < drop; i++)
+    victims.push_back(*order[i].second);
+  for (const auto &ip : victims)
+    m_pending.erase(ip);
 }
 
 void GeoIpResolver::WorkerLoop() {
   LOG("GeoIpResolver::WorkerLoop starting");
   try {
+    // Off the UI thread: compiling a large CSV takes a few seconds
+    LoadDatabase(m_db.PathNextTo("geoip.bin"), m_db.PathNextTo("geoip.csv"));
+    LoadCache();
+
     while (!m_stop) {
-      std::wstring ip;
+      std::vector<Pending> batch;
       {
         std::unique_lock<std::mutex> lock(m_mutex);
-        m_cv.wait(lock, [this] { return m_stop || !m_pendingIps.empty(); });
+        m_cv.wait(lock, [this] { return m_stop || !m_pending.empty(); });
         if (m_stop)
           break;
-        ip = m_pendingIps.front();
-        m_pendingIps.pop();
+        batch = TakeBatch();
+      }
+
+      // Queued before the database was loaded, or the fallback was turned
+      // off since
+      std::vector<Pending> online;
+      for (auto &p : batch) {
+        std::wstring code;
+        IpAddress parsed;
+        if (!(IpAddress::Parse(p.Ip, parsed) && LookupOffline(parsed, code)) &&
+            m_onlineFallback)
+          online.push_back(std::move(p));
       }
 
-      std::wstring code = FetchFromApi(ip);
+      std::vector<std::wstring> countries;
+      bool ok = !online.empty() && FetchBatch(online, countries);
 
+      std::vector<db::GeoIpRecord> records;
       {
         std::lock_guard<std::mutex> lock(m_mutex);
-        m_cache[ip] = code;
+        for (const auto &p : batch)
+          m_inFlight.erase(p.Ip);
+        int64_t now = (int64_t)std::time(nullptr);
+        for (size_t i = 0; i < online.size(); i++) {
+          if (!ok) {
+            m_pending[online[i].Ip] += online[i].Bytes; // Retry later
+            continue;
+          }
+          const std::wstring &country = countries[i];
+          auto ttl = country.empty() ? m_options.NegativeTtl
+                                     : m_options.PositiveTtl;
+          int64_t expires =
+              now + std::chrono::duration_cast<std::chrono::seconds>(ttl)
+                        .count();
+          m_cache[online[i].Ip] = {country, expires};
+          records.push_back({online[i].Ip, country, expires});
+        }
       }
+      m_db.StoreGeoIp(records);
 
-      // Slow down to respect API limits (ip-api.com is 45 req/min)
-      std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+      if (online.empty())
+        continue;
+      // Stay under the API rate limit; a failure waits longer
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cv.wait_for(lock,
+                    ok ? m_options.BatchInterval : m_options.RetryInterval,
+                    [this] { return m_stop.load(); });
     }
   } catch (const std::exception &e) {
     LOG("Error: Exception in GeoIpResolver::WorkerLoop: " +
@@ -97,39 +205,70 @@ void GeoIpResolver::WorkerLoop() {
   LOG("GeoIpResolver::WorkerLoop exiting");
 }
 
-std::wstring GeoIpResolver::FetchFromApi(const std::wstring &ip) {
+// Returns the string value of "key" in a flat JSON object, or ""
+static std::string JsonString(const std::string &object, const char *key) {
+  std::string quoted = std::string("\"") + key + "\"";
+  size_t pos = object.find(quoted);
+  if (pos == std::string::npos)
+    return "";
+  pos = object.find_first_not_of(" \t\r\n", pos + quoted.size());
+  if (pos == std::string::npos || object[pos] != ':')
+    return "";
+  pos = object.find_first_not_of(" \t\r\n", pos + 1);
+  if (pos == std::string::npos || object[pos] != '"')
+    return "";
+  std::string value;
+  for (pos++; pos < object.size() && object[pos] != '"'; pos++) {
+    if (object[pos] == '\\' && pos + 1 < object.size())
+      pos++;
+    value += object[pos];
+  }
+  return value;
+}
+
+bool GeoIpResolver::FetchBatch(const std::vector<Pending> &batch,
+                               std::vector<std::wstring> &countries) {
+  std::string body = "[";
+  for (size_t i = 0; i < batch.size(); i++) {
+    if (i > 0)
+      body += ",";
+    body += "\"" + std::string(batch[i].Ip.begin(), batch[i].Ip.end()) + "\"";
+  }
+  body += "]";
+
+  std::string response;
+  DWORD status = 0;
   HINTERNET hSession =
       WinHttpOpen(L"InetMonitor/1.0", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
                   WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
-  std::wstring result = L"??";
-
   if (hSession) {
-    HINTERNET hConnect =
-        WinHttpConnect(hSession, L"ip-api.com", INTERNET_DEFAULT_HTTP_PORT, 0);
+    WinHttpSetTimeouts(hSession, 5000, 5000, 10000, 10000);
+    HINTERNET hConnect = WinHttpConnect(hSession, m_options.Host.c_str(),
+                                        m_options.Port, 0);
     if (hConnect) {
-      std::wstring path = L"/line/" + ip + L"?fields=countryCode";
-      HINTERNET hRequest = WinHttpOpenRequest(hConnect, L"GET", path.c_str(),
-                                              nullptr, WINHTTP_NO_REFERER,
-                                              WINHTTP_DEFAULT_ACCEPT_TYPES, 0);
+      HINTERNET hRequest = WinHttpOpenRequest(
+          hConnect, L"POST", m_options.BatchPath.c_str(), nullptr,
+          WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, 0);
       if (hRequest) {
-        if (WinHttpSendRequest(hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-                               WINHTTP_NO_REQUEST_DATA, 0, 0, 0)) {
-          if (WinHttpReceiveResponse(hRequest, nullptr)) {
-            DWORD dwSize = 0;
-            if (WinHttpQueryDataAvailable(hRequest, &dwSize) && dwSize > 0) {
-              std::vector<char> buffer(dwSize + 1, 0);
-              DWORD dwRead = 0;
-              if (WinHttpReadData(hRequest, buffer.data(), dwSize, &dwRead)) {
-                std::string s(buffer.data(), dwRead);
-                // Remove newline
-                while (!s.empty() && (s.back() == '\n' || s.back() == '\r'))
-                  s.pop_back();
-
-                if (!s.empty()) {
-                  result = std::wstring(s.begin(), s.end());
-                }
-              }
-            }
+        const wchar_t *headers = L"Content-Type: application/json\r\n";
+        if (WinHttpSendRequest(hRequest, headers, (DWORD)-1L,
+                               (LPVOID)body.data(), (DWORD)body.size(),
+                               (DWORD)body.size(), 0) &&
+            WinHttpReceiveResponse(hRequest, nullptr)) {
+          DWORD statusSize = sizeof(status);
+          WinHttpQueryHeaders(hRequest,
+                              WINHTTP_QUERY_STATUS_CODE |
+                                  WINHTTP_QUERY_FLAG_NUMBER,
+                              WINHTTP_HEADER_NAME_BY_INDEX, &status,
+                              &statusSize, WINHTTP_NO_HEADER_INDEX);
+          DWORD dwSize = 0;
+          while (WinHttpQueryDataAvailable(hRequest, &dwSize) && dwSize > 0) {
+            std::vector<char> buffer(dwSize);
+            DWORD dwRead = 0;
+            if (!WinHttpReadData(hRequest, buffer.data(), dwSize, &dwRead) ||
+                dwRead == 0)
+              break;
+            response.append(buffer.data(), dwRead);
           }
         }
         WinHttpCloseHandle(hRequest);
@@ -139,7 +278,43 @@ std::wstring GeoIpResolver::FetchFromApi(const std::wstring &ip) {
     WinHttpCloseHandle(hSession);
   }
 
-  return result;
+  if (status != 200) {
+    LOG("Warning: GeoIP batch lookup failed (HTTP " + std::to_string(status) +
+        ")");
+    return false;
+  }
+
+  // An array of flat objects, one per address in request order. Match on
+  // "query" and fall back to the position if the API reformatted it.
+  std::vector<std::pair<std::wstring, std::wstring>> results;
+  std::unordered_map<std::wstring, size_t> byIp;
+  size_t pos = 0;
+  while ((pos = response.find('{', pos)) != std::string::npos) {
+    size_t end = response.find('}', pos);
+    if (end == std::string::npos)
+      break;
+    std::string object = response.substr(pos, end - pos + 1);
+    pos = end + 1;
+    std::string ip = JsonString(object, "query");
+    std::string country = JsonString(object, "status") == "success"
+                              ? JsonString(object, "countryCode")
+                              : "";
+    byIp[std::wstring(ip.begin(), ip.end())] = results.size();
+    results.push_back({std::wstring(ip.begin(), ip.end()),
+                       std::wstring(country.begin(), country.end())});
+  }
+
+  countries.clear();
+  for (size_t i = 0; i < batch.size(); i++) {
+    auto it = byIp.find(batch[i].Ip);
+    if (it != byIp.end())
+      countries.push_back(results[it->second].second);
+    else if (results.size() == batch.size())
+      countries.push_back(results[i].second);
+    else
+      countries.push_back(L"");
+  }
+  return true;
 }
 
 } // namespace monitor
@@ -1,41 +1,108 @@
 #pragma once
 
+#include "../db/Database.h"
+#include "IpAddress.h"
+#include "IpRangeTable.h"
+#include "NetworkClassifier.h"
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
-#include <queue>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 
 namespace monitor {
 
-// Resolves IP addresses to country codes using a web API
+// Resolves IP addresses to country codes.
+//
+// A local range database answers synchronously: geoip.bin next to the
+// database, compiled at startup from geoip.csv ("first,last,country"
+// rows, e.g. the DB-IP country lite CSV) whenever the CSV is newer. The
+// ip-api.com web API is only a fallback for addresses the database does
+// not cover and can be switched off.
+//
+// Online lookups go out in batches, highest traffic volume first, so a
+// busy download host is resolved before a one-packet scanner. Answers and
+// failures are kept in the database with an expiry and survive restarts.
 class GeoIpResolver {
 public:
-  GeoIpResolver();
+  struct Options {
+    // Batch endpoint; point it at a local stub server for testing
+    std::wstring Host = L"ip-api.com";
+    uint16_t Port = 80;
+    std::wstring BatchPath = L"/batch?fields=status,countryCode,query";
+    size_t BatchSize = 100; // ip-api.com maximum
+    std::chrono::milliseconds BatchInterval{4000}; // 15 requests/min limit
+    std::chrono::milliseconds RetryInterval{60000}; // After a failed batch
+    std::chrono::hours PositiveTtl{24 * 30};
+    std::chrono::hours NegativeTtl{24};
+    size_t MaxPending = 20000; // The quietest pending addresses go first
+  };
+
+  // Addresses 'networks' does not classify as internet are never looked up
+  GeoIpResolver(db::Database &db, const NetworkClassifier &networks);
+  GeoIpResolver(db::Database &db, const NetworkClassifier &networks,
+                const Options &options);
   ~GeoIpResolver();
 
-  // Returns country code (e.g., "US", "UA") if known, else ".." or "Local"
-  std::wstring GetCountryCode(const std::wstring &ipAddress);
+  // Returns country code (e.g., "US", "UA") if known, else ".." or "Local".
+  // 'bytes' is traffic seen for the address since the last call and
+  // raises its priority while the lookup is pending.
+  std::wstring GetCountryCode(const std::wstring &ipAddress,
+                              uint64_t bytes = 0);
+
+  void SetOnlineFallback(bool enabled) { m_onlineFallback = enabled; }
+  bool GetOnlineFallback() const { return m_onlineFallback; }
+
+  // False until the database is loaded, or if there is none
+  bool HasOfflineDatabase() const { return m_tableReady; }
 
 private:
+  void LoadDatabase(const std::string &binPath, const std::string &csvPath);
+  bool LookupOffline(const IpAddress &ip, std::wstring &code) const;
+  void LoadCache();
   void WorkerLoop();
-  std::wstring FetchFromApi(const std::wstring &ip);
-  bool IsLocal(const std::wstring &ip);
 
-  std::mutex m_mutex;
-  std::unordered_map<std::wstring, std::wstring> m_cache;
+  struct Pending {
+    std::wstring Ip;
+    uint64_t Bytes;
+  };
+
+  // Callers hold m_mutex
+  std::vector<Pending> TakeBatch();
+  void DropQuietest();
 
-  std::queue<std::wstring> m_pendingIps;
-  std::unordered_map<std::wstring, bool>
-      m_requested; // To avoid duplicate requests
+  // Countries in request order, empty where the lookup failed. Returns
+  // false if the request itself failed.
+  bool FetchBatch(const std::vector<Pending> &batch,
+                  std::vector<std::wstring> &countries);
+
+  struct CacheEntry {
+    std::wstring Country; // Empty = lookup failed
+    int64_t Expires;      // Unix time
+  };
+
+  db::Database &m_db;
+  const NetworkClassifier &m_networks;
+  Options m_options;
+
+  std::mutex m_mutex;
+  std::unordered_map<std::wstring, CacheEntry> m_cache;
+  std::unordered_map<std::wstring, uint64_t> m_pending; // IP -> bytes seen
+  std::unordered_set<std::wstring> m_inFlight;
 
   std::condition_variable m_cv;
   std::thread m_workerThread;
   std::atomic<bool> m_stop{false};
+
+  // Written once by the worker before m_tableReady is set
+  IpRangeTable m_table;
+  std::atomic<bool> m_tableReady{false};
+  std::atomic<bool> m_onlineFallback{true};
 };
 
 } // namespace monitor
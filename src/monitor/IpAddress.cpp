@@ -0,0 +1,168 @@
+#include "IpAddress.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace monitor {
+
+static const uint8_t kV4MappedPrefix[12] = {0, 0, 0, 0, 0,    0,
+                                            0, 0, 0, 0, 0xff, 0xff};
+
+IpAddress IpAddress::FromV4(uint32_t networkOrder) {
+  IpAddress ip;
+  memcpy(ip.Bytes, kV4MappedPrefix, sizeof(kV4MappedPrefix));
+  ip.Bytes[12] = (uint8_t)(networkOrder >> 0);
+  ip.Bytes[13] = (uint8_t)(networkOrder >> 8);
+  ip.Bytes[14] = (uint8_t)(networkOrder >> 16);
+  ip.Bytes[15] = (uint8_t)(networkOrder >> 24);
+  return ip;
+}
+
+IpAddress IpAddress::FromV6(const uint8_t *bytes) {
+  IpAddress ip;
+  memcpy(ip.Bytes, bytes, sizeof(ip.Bytes));
+  return ip;
+}
+
+bool IpAddress::IsV4() const {
+  return memcmp(Bytes, kV4MappedPrefix, sizeof(kV4MappedPrefix)) == 0;
+}
+
+uint32_t IpAddress::V4() const {
+  return ((uint32_t)Bytes[12] << 24) | ((uint32_t)Bytes[13] << 16) |
+         ((uint32_t)Bytes[14] << 8) | Bytes[15];
+}
+
+bool IpAddress::IsUnspecified() const {
+  static const uint8_t zero[16] = {};
+  return memcmp(Bytes, zero, sizeof(zero)) == 0 || (IsV4() && V4() == 0);
+}
+
+// Parses a dotted quad from [p, end) into 4 bytes
+static bool ParseDotted(const wchar_t *p, const wchar_t *end, uint8_t *out) {
+  for (int part = 0; part < 4; part++) {
+    if (part > 0) {
+      if (p == end || *p != L'.')
+        return false;
+      p++;
+    }
+    uint32_t value = 0;
+    int digits = 0;
+    while (p != end && *p >= L'0' && *p <= L'9' && digits < 4) {
+      value = value * 10 + (*p - L'0');
+      p++;
+      digits++;
+    }
+    if (digits == 0 || digits > 3 || value > 255)
+      return false;
+    out[part] = (uint8_t)value;
+  }
+  return p == end;
+}
+
+static int HexValue(wchar_t c) {
+  if (c >= L'0' && c <= L'9')
+    return c - L'0';
+  if (c >= L'a' && c <= L'f')
+    return c - L'a' + 10;
+  if (c >= L'A' && c <= L'F')
+    return c - L'A' + 10;
+  return -1;
+}
+
+bool IpAddress::Parse(const std::wstring &text, IpAddress &out) {
+  const wchar_t *p = text.c_str();
+  const wchar_t *end = p + text.size();
+  // Trim surrounding whitespace, DNS answer lists are loosely formatted
+  while (p != end && (*p == L' ' || *p == L'\t'))
+    p++;
+  while (end != p && (end[-1] == L' ' || end[-1] == L'\t'))
+    end--;
+  if (p == end)
+    return false;
+
+  IpAddress ip;
+  if (std::find(p, end, L':') == end) {
+    memcpy(ip.Bytes, kV4MappedPrefix, sizeof(kV4MappedPrefix));
+    if (!ParseDotted(p, end, ip.Bytes + 12))
+      return false;
+    out = ip;
+    return true;
+  }
+
+  // IPv6: up to 8 groups, one '::' gap, optional dotted quad at the end
+  uint8_t head[16], tail[16];
+  int headLen = 0, tailLen = 0;
+  bool gap = false;
+  if (p + 1 < end && p[0] == L':' && p[1] == L':') {
+    gap = true;
+    p += 2;
+  }
+  while (p != end) {
+    uint8_t *dst = gap ? tail : head;
+    int &len = gap ? tailLen : headLen;
+
+    const wchar_t *groupEnd = p;
+    while (groupEnd != end && *groupEnd != L':')
+      groupEnd++;
+    if (std::find(p, groupEnd, L'.') != groupEnd) {
+      if (groupEnd != end || headLen + tailLen + 4 > 16)
+        return false;
+      if (!ParseDotted(p, groupEnd, dst + len))
+        return false;
+      len += 4;
+      p = groupEnd;
+      break;
+    }
+
+    if (groupEnd == p || groupEnd - p > 4 || headLen + tailLen + 2 > 16)
+      return false;
+    uint32_t value = 0;
+    for (const wchar_t *c = p; c != groupEnd; c++) {
+      int h = HexValue(*c);
+      if (h < 0)
+        return false;
+      value = (value << 4) | (uint32_t)h;
+    }
+    dst[len++] = (uint8_t)(value >> 8);
+    dst[len++] = (uint8_t)value;
+
+    p = groupEnd;
+    if (p == end)
+      break;
+    p++; // ':'
+    if (p != end && *p == L':') {
+      if (gap)
+        return false;
+      gap = true;
+      p++;
+    } else if (p == end) {
+      return false; // Trailing single ':'
+    }
+  }
+
+  if (gap ? headLen + tailLen > 14 : headLen != 16)
+    return false;
+  memcpy(ip.Bytes, head, headLen);
+  memcpy(ip.Bytes + 16 - tailLen, tail, tailLen);
+  out = ip;
+  return true;
+}
+
+std::wstring IpAddress::ToString() const {
+  std::wstringstream ss;
+  if (IsV4()) {
+    ss << (int)Bytes[12] << L"." << (int)Bytes[13] << L"." << (int)Bytes[14]
+       << L"." << (int)Bytes[15];
+    return ss.str();
+  }
+  for (int i = 0; i < 16; i += 2) {
+    if (i > 0)
+      ss << L":";
+    ss << std::hex << std::setw(2) << std::setfill(L'0') << (int)Bytes[i]
+       << std::setw(2) << std::setfill(L'0') << (int)Bytes[i + 1];
+  }
+  return ss.str();
+}
+
+} // namespace monitor
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace monitor {
+
+// Binary IPv4/IPv6 address. IPv4 is kept in IPv4-mapped form
+// (::ffff:a.b.c.d) so both families share one fixed-width layout.
+struct IpAddress {
+  uint8_t Bytes[16] = {};
+
+  // 'networkOrder' as read from an ETW payload: first octet in the low byte
+  static IpAddress FromV4(uint32_t networkOrder);
+  static IpAddress FromV6(const uint8_t *bytes);
+
+  // Accepts dotted IPv4, IPv6 (with :: compression and an optional
+  // trailing dotted quad) and IPv4-mapped IPv6
+  static bool Parse(const std::wstring &text, IpAddress &out);
+
+  bool IsV4() const;
+  uint32_t V4() const; // Host order, only meaningful if IsV4()
+  bool IsUnspecified() const;
+
+  // Same formats as DnsResolver::IPv4ToString / IPv6ToString
+  std::wstring ToString() const;
+
+  bool operator==(const IpAddress &other) const {
+    return memcmp(Bytes, other.Bytes, sizeof(Bytes)) == 0;
+  }
+  bool operator!=(const IpAddress &other) const { return !(*this == other); }
+  bool operator<(const IpAddress &other) const {
+    return memcmp(Bytes, other.Bytes, sizeof(Bytes)) < 0;
+  }
+};
+
+struct IpAddressHash {
+  size_t operator()(const IpAddress &ip) const {
+    uint64_t lo, hi;
+    memcpy(&lo, ip.Bytes, 8);
+    memcpy(&hi, ip.Bytes + 8, 8);
+    uint64_t h = (lo ^ (hi * 0x9E3779B97F4A7C15ull)) * 0xC2B2AE3D27D4EB4Full;
+    return (size_t)(h ^ (h >> 29));
+  }
+};
+
+} // namespace monitor
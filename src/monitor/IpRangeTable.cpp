@@ -0,0 +1,499 @@
+#include "IpRangeTable.h"
+#include "../utils/Logger.h"
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+
+namespace monitor {
+
+namespace {
+
+// File layout, all little-endian:
+//   FileHeader
+//   uint32_t V4Root[kRootSize], V6Root[kRootSize]
+//   uint32_t Nodes[NodeCount][kStride]
+//   uint32_t ValueOffsets[ValueCount + 1]
+//   char Strings[StringBytes]
+// A trie entry is either a node index or kLeaf | value index. Value 0 is
+// the empty string and means "not covered".
+struct FileHeader {
+  char Magic[8];
+  uint32_t Version;
+  uint32_t NodeCount;
+  uint32_t ValueCount;
+  uint32_t StringBytes;
+};
+
+constexpr char kMagic[8] = {'I', 'P', 'R', 'T', 'B', 'L', '\0', '\0'};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kRootBits = 16;
+constexpr uint32_t kRootSize = 1u << kRootBits;
+constexpr uint32_t kStrideBits = 4; // One 64-byte node per 4 address bits
+constexpr uint32_t kStride = 1u << kStrideBits;
+constexpr uint32_t kLeaf = 0x80000000u;
+constexpr int kV4Depth = 96; // Bits above an IPv4-mapped address
+
+// 128-bit address arithmetic without compiler extensions
+struct U128 {
+  uint64_t Hi = 0, Lo = 0;
+};
+
+U128 ToU128(const IpAddress &ip) {
+  U128 v;
+  for (int i = 0; i < 8; i++) {
+    v.Hi = (v.Hi << 8) | ip.Bytes[i];
+    v.Lo = (v.Lo << 8) | ip.Bytes[i + 8];
+  }
+  return v;
+}
+
+bool Less(const U128 &a, const U128 &b) {
+  return a.Hi != b.Hi ? a.Hi < b.Hi : a.Lo < b.Lo;
+}
+
+U128 Sub(const U128 &a, const U128 &b) {
+  U128 r;
+  r.Lo = a.Lo - b.Lo;
+  r.Hi = a.Hi - b.Hi - (a.Lo < b.Lo ? 1 : 0);
+  return r;
+}
+
+// 'prefix' with every bit below the first 'depth' set
+U128 FillBelow(U128 prefix, int depth) {
+  if (depth < 64) {
+    prefix.Hi |= depth == 0 ? ~0ull : (~0ull >> depth);
+    prefix.Lo = ~0ull;
+  } else if (depth < 128) {
+    prefix.Lo |= ~0ull >> (depth - 64);
+  }
+  return prefix;
+}
+
+U128 SetBit(U128 v, int bit) {
+  if (bit < 64)
+    v.Hi |= 1ull << (63 - bit);
+  else
+    v.Lo |= 1ull << (127 - bit);
+  return v;
+}
+
+struct BuildNode {
+  uint32_t Child[2] = {0, 0}; // 0 = absent; index 0 is never a child
+  uint32_t Value = 0;         // 0 = inherit from the parent
+};
+
+class TrieBuilder {
+public:
+  TrieBuilder() : m_nodes(2) {} // [0] unused, [1] root
+
+  void Insert(const U128 &first, const U128 &last, uint32_t value) {
+    Insert(kRoot, 0, U128(), first, last, value);
+  }
+
+  bool Write(const std::vector<std::string> &values, const std::string &path,
+             std::string &error) {
+    std::vector<uint32_t> v4Root(kRootSize), v6Root(kRootSize);
+
+    // Follow ::ffff:0:0/96 down to where the IPv4 root table starts
+    uint32_t node = kRoot;
+    uint32_t inherited = 0;
+    for (int bit = 0; bit < kV4Depth && node; bit++) {
+      if (m_nodes[node].Value)
+        inherited = m_nodes[node].Value;
+      node = m_nodes[node].Child[bit >= 80 ? 1 : 0];
+    }
+    Expand(node, kRootBits, inherited, 0, v4Root.data());
+    // Lookups of mapped addresses start at the IPv4 root, so the v6 trie
+    // never reaches that subtree again; emitting it twice would double
+    // the file for the usual IPv4-heavy tables
+    m_skip = node;
+    Expand(kRoot, kRootBits, 0, 0, v6Root.data());
+    if (m_out.size() / kStride >= kLeaf) {
+      error = "Too many trie nodes";
+      return false;
+    }
+
+    std::vector<uint32_t> offsets;
+    std::string strings;
+    for (const auto &value : values) {
+      offsets.push_back((uint32_t)strings.size());
+      strings += value;
+    }
+    offsets.push_back((uint32_t)strings.size());
+
+    FileHeader header;
+    memcpy(header.Magic, kMagic, sizeof(kMagic));
+    header.Version = kVersion;
+    header.NodeCount = (uint32_t)(m_out.size() / kStride);
+    header.ValueCount = (uint32_t)values.size();
+    header.StringBytes = (uint32_t)strings.size();
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+      error = "Cannot create " + path;
+      return false;
+    }
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)v4Root.data(), kRootSize * sizeof(uint32_t));
+    file.write((const char *)v6Root.data(), kRootSize * sizeof(uint32_t));
+    file.write((const char *)m_out.data(), m_out.size() * sizeof(uint32_t));
+    file.write((const char *)offsets.data(),
+               offsets.size() * sizeof(uint32_t));
+    file.write(strings.data(), strings.size());
+    if (!file) {
+      error = "Write failed for " + path;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  static constexpr uint32_t kRoot = 1;
+
+  void Insert(uint32_t node, int depth, const U128 &lo, const U128 &first,
+              const U128 &last, uint32_t value) {
+    U128 hi = FillBelow(lo, depth);
+    if (!Less(lo, first) && !Less(last, hi)) {
+      // Fully covered: this range replaces whatever was below
+      m_nodes[node].Value = value;
+      m_nodes[node].Child[0] = m_nodes[node].Child[1] = 0;
+      return;
+    }
+    for (int b = 0; b < 2; b++) {
+      U128 childLo = b ? SetBit(lo, depth) : lo;
+      U128 childHi = FillBelow(childLo, depth + 1);
+      if (Less(last, childLo) || Less(childHi, first))
+        continue;
+      if (!m_nodes[node].Child[b]) {
+        m_nodes.emplace_back();
+        m_nodes[node].Child[b] = (uint32_t)(m_nodes.size() - 1);
+      }
+      Insert(m_nodes[node].Child[b], depth + 1, childLo, first, last, value);
+    }
+  }
+
+  // Turns the binary subtree at 'node' into kStride-way nodes. Leaf
+  // pushing moves values down to the leaves, so the reader never needs to
+  // remember the last value it passed.
+  uint32_t Emit(uint32_t node, uint32_t inherited) {
+    if (!node)
+      return kLeaf | inherited;
+    if (node == m_skip)
+      return kLeaf; // Unreachable, see Write()
+    const BuildNode &n = m_nodes[node];
+    uint32_t value = n.Value ? n.Value : inherited;
+    if (!n.Child[0] && !n.Child[1])
+      return kLeaf | value;
+
+    uint32_t entries[kStride];
+    Expand(node, kStrideBits, inherited, 0, entries);
+    if (std::all_of(entries, entries + kStride,
+                    [&](uint32_t e) { return e == entries[0]; }) &&
+        (entries[0] & kLeaf))
+      return entries[0]; // The whole block has one value, no need to branch
+    m_out.insert(m_out.end(), entries, entries + kStride);
+    return (uint32_t)(m_out.size() / kStride - 1);
+  }
+
+  // Fills the 2^bits entries below 'node', starting at 'index'
+  void Expand(uint32_t node, uint32_t bits, uint32_t inherited,
+                uint32_t index, uint32_t *root) {
+    if (!node || bits == 0) {
+      uint32_t entry = Emit(node, inherited);
+      std::fill(root + (index << bits), root + ((index + 1) << bits), entry);
+      return;
+    }
+    const BuildNode &n = m_nodes[node];
+    uint32_t value = n.Value ? n.Value : inherited;
+    uint32_t left = n.Child[0], right = n.Child[1];
+    if (!left && !right) {
+      std::fill(root + (index << bits), root + ((index + 1) << bits),
+                kLeaf | value);
+      return;
+    }
+    Expand(left, bits - 1, value, index * 2, root);
+    Expand(right, bits - 1, value, index * 2 + 1, root);
+  }
+
+  std::vector<BuildNode> m_nodes;
+  std::vector<uint32_t> m_out; // Emitted nodes, kStride entries each
+  uint32_t m_skip = 0;         // Subtree Emit() leaves out
+};
+
+// Splits one line, honouring double quotes around fields
+std::vector<std::string> SplitLine(const std::string &line, char separator) {
+  std::vector<std::string> fields(1);
+  bool quoted = false;
+  for (char c : line) {
+    if (c == '"')
+      quoted = !quoted;
+    else if (c == separator && !quoted)
+      fields.emplace_back();
+    else if (c != '\r')
+      fields.back() += c;
+  }
+  return fields;
+}
+
+std::string Trim(const std::string &s) {
+  size_t begin = s.find_first_not_of(" \t");
+  if (begin == std::string::npos)
+    return "";
+  size_t end = s.find_last_not_of(" \t");
+  return s.substr(begin, end - begin + 1);
+}
+
+bool ParseAddressField(const std::string &field, IpAddress &out) {
+  std::string text = Trim(field);
+  if (text.empty())
+    return false;
+  if (std::all_of(text.begin(), text.end(),
+                  [](char c) { return c >= '0' && c <= '9'; })) {
+    // Decimal IPv4, as in IP2Location style files
+    if (text.size() > 10)
+      return false;
+    uint64_t v = std::stoull(text);
+    if (v > 0xFFFFFFFFull)
+      return false;
+    uint32_t host = (uint32_t)v;
+    out = IpAddress::FromV4(((host >> 24) & 0xFF) | ((host >> 8) & 0xFF00) |
+                            ((host << 8) & 0xFF0000) | (host << 24));
+    return true;
+  }
+  return IpAddress::Parse(std::wstring(text.begin(), text.end()), out);
+}
+
+} // namespace
+
+IpRangeTable::~IpRangeTable() { Close(); }
+
+bool IpRangeTable::Compile(std::vector<Range> ranges,
+                           const std::string &outPath, std::string &error) {
+  std::vector<std::string> values(1); // [0] = not covered
+  std::unordered_map<std::string, uint32_t> valueIds;
+
+  struct Pending {
+    U128 First, Last, Span;
+    uint32_t Value;
+  };
+  std::vector<Pending> pending;
+  pending.reserve(ranges.size());
+  for (auto &range : ranges) {
+    U128 first = ToU128(range.First), last = ToU128(range.Last);
+    if (Less(last, first) || range.Value.empty())
+      continue;
+    auto [it, inserted] =
+        valueIds.try_emplace(std::move(range.Value), (uint32_t)values.size());
+    if (inserted)
+      values.push_back(it->first);
+    pending.push_back({first, last, Sub(last, first), it->second});
+  }
+  if (values.size() >= kLeaf) {
+    error = "Too many distinct values";
+    return false;
+  }
+
+  // Widest first, so narrower ranges overwrite them where they overlap
+  std::stable_sort(pending.begin(), pending.end(),
+                   [](const Pending &a, const Pending &b) {
+                     return Less(b.Span, a.Span);
+                   });
+
+  TrieBuilder builder;
+  for (const auto &p : pending)
+    builder.Insert(p.First, p.Last, p.Value);
+  return builder.Write(values, outPath, error);
+}
+
+bool IpRangeTable::CompileCsv(const std::string &csvPath,
+                              const std::string &outPath,
+                              const CsvLayout &layout, std::string &error) {
+  std::ifstream file(csvPath);
+  if (!file) {
+    error = "Cannot open " + csvPath;
+    return false;
+  }
+
+  int needed = std::max(layout.FirstColumn, layout.LastColumn);
+  for (int column : layout.ValueColumns)
+    needed = std::max(needed, column);
+  std::vector<Range> ranges;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    auto fields = SplitLine(line, layout.Separator);
+    if ((int)fields.size() <= needed)
+      continue;
+    Range range;
+    if (!ParseAddressField(fields[layout.FirstColumn], range.First) ||
+        !ParseAddressField(fields[layout.LastColumn], range.Last))
+      continue; // Header or malformed line
+    for (int column : layout.ValueColumns) {
+      std::string value = Trim(fields[column]);
+      if (value.empty())
+        continue;
+      if (!range.Value.empty())
+        range.Value += ' ';
+      range.Value += value;
+    }
+    ranges.push_back(std::move(range));
+  }
+  if (ranges.empty()) {
+    error = "No ranges in " + csvPath;
+    return false;
+  }
+  return Compile(std::move(ranges), outPath, error);
+}
+
+bool IpRangeTable::Open(const std::string &path, std::string &error) {
+  Close();
+
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    error = "Cannot open " + path;
+    return false;
+  }
+  m_file = file;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) ||
+      size.QuadPart < (LONGLONG)sizeof(FileHeader)) {
+    error = "Truncated table " + path;
+    Close();
+    return false;
+  }
+  m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (m_mapping)
+    m_view = (const uint8_t *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!m_view) {
+    error = "Cannot map " + path;
+    Close();
+    return false;
+  }
+
+  FileHeader header;
+  memcpy(&header, m_view, sizeof(header));
+  uint64_t expected = sizeof(FileHeader) +
+                      2ull * kRootSize * sizeof(uint32_t) +
+                      (uint64_t)kStride * header.NodeCount * sizeof(uint32_t) +
+                      (header.ValueCount + 1ull) * sizeof(uint32_t) +
+                      header.StringBytes;
+  if (memcmp(header.Magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.Version != kVersion || header.ValueCount == 0 ||
+      (uint64_t)size.QuadPart != expected) {
+    error = "Not a valid table: " + path;
+    Close();
+    return false;
+  }
+
+  const uint32_t *p = (const uint32_t *)(m_view + sizeof(FileHeader));
+  const uint32_t *v4Root = p;
+  const uint32_t *v6Root = v4Root + kRootSize;
+  const uint32_t *nodes = v6Root + kRootSize;
+  const uint32_t *offsets = nodes + (uint64_t)kStride * header.NodeCount;
+
+  // Validate once so lookups can index without bounds checks
+  auto validEntry = [&](uint32_t e) {
+    return (e & kLeaf) ? (e & ~kLeaf) < header.ValueCount
+                       : e < header.NodeCount;
+  };
+  bool valid = std::all_of(v4Root, nodes, validEntry) &&
+               std::all_of(nodes, offsets, validEntry);
+  for (uint32_t i = 0; valid && i < header.ValueCount; i++)
+    valid = offsets[i] <= offsets[i + 1] &&
+            offsets[i + 1] <= header.StringBytes;
+  if (!valid) {
+    error = "Corrupt table: " + path;
+    Close();
+    return false;
+  }
+
+  m_v4Root = v4Root;
+  m_v6Root = v6Root;
+  m_nodes = nodes;
+  m_valueOffsets = offsets;
+  m_strings = (const char *)(offsets + header.ValueCount + 1);
+  m_nodeCount = header.NodeCount;
+  m_valueCount = header.ValueCount;
+  return true;
+}
+
+bool IpRangeTable::OpenOrCompile(const std::string &binPath,
+                                 const std::string &csvPath,
+                                 const CsvLayout &layout, std::string &error) {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  bool haveCsv = fs::exists(csvPath, ec);
+  bool haveBin = fs::exists(binPath, ec);
+  if (!haveCsv && !haveBin) {
+    error = "Neither " + binPath + " nor " + csvPath + " exists";
+    return false;
+  }
+
+  if (haveCsv && (!haveBin || fs::last_write_time(csvPath, ec) >
+                                  fs::last_write_time(binPath, ec))) {
+    LOG("Compiling " + binPath + " from " + csvPath);
+    // Build next to the old file so a failed compile leaves it intact
+    std::string tmpPath = binPath + ".tmp";
+    std::string compileError;
+    if (CompileCsv(csvPath, tmpPath, layout, compileError))
+      fs::rename(tmpPath, binPath, ec);
+    else
+      LOG("Error: compiling " + csvPath + " failed: " + compileError);
+  }
+  return Open(binPath, error);
+}
+
+void IpRangeTable::Close() {
+  if (m_view)
+    UnmapViewOfFile(m_view);
+  if (m_mapping)
+    CloseHandle(m_mapping);
+  if (m_file)
+    CloseHandle(m_file);
+  m_file = m_mapping = nullptr;
+  m_view = nullptr;
+  m_v4Root = m_v6Root = m_nodes = m_valueOffsets = nullptr;
+  m_strings = nullptr;
+  m_nodeCount = m_valueCount = 0;
+}
+
+std::string_view IpRangeTable::Lookup(const IpAddress &ip) const {
+  if (!m_nodes)
+    return {};
+
+  uint32_t entry;
+  int bit;
+  if (ip.IsV4()) {
+    entry = m_v4Root[(ip.Bytes[12] << 8) | ip.Bytes[13]];
+    bit = kV4Depth + kRootBits;
+  } else {
+    entry = m_v6Root[(ip.Bytes[0] << 8) | ip.Bytes[1]];
+    bit = kRootBits;
+  }
+  while (!(entry & kLeaf)) {
+    if (bit >= 128)
+      return {}; // Only a corrupt file branches below a single address
+    uint32_t nibble = (ip.Bytes[bit >> 3] >> (4 - (bit & 4))) & 0xF;
+    entry = m_nodes[entry * kStride + nibble];
+    bit += kStrideBits;
+  }
+
+  uint32_t value = entry & ~kLeaf;
+  if (value == 0)
+    return {};
+  return std::string_view(m_strings + m_valueOffsets[value],
+                          m_valueOffsets[value + 1] - m_valueOffsets[value]);
+}
+
+} // namespace monitor
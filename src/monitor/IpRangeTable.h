@@ -0,0 +1,79 @@
+#pragma once
+
+#include "IpAddress.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace monitor {
+
+// Read-only IP range -> string table compiled into a binary file and
+// memory-mapped, e.g. a GeoIP country database.
+//
+// The file holds a leaf-pushed trie over 128-bit addresses (IPv4 lives
+// under ::ffff:0:0/96). Two 65536-entry root tables index it by the first
+// 16 bits of the IPv4 or IPv6 address; below that every node consumes 4
+// bits and is one 64-byte cache line, so an IPv4 lookup is a table read
+// plus at most four node reads ending on a leaf that holds the value.
+class IpRangeTable {
+public:
+  struct Range {
+    IpAddress First;
+    IpAddress Last; // Inclusive
+    std::string Value;
+  };
+
+  // Column layout of a text range file. Addresses may be written as IP
+  // strings or as decimal IPv4 integers; quotes are ignored. Lines that do
+  // not parse (headers, comments) are skipped. The value is the listed
+  // columns joined by a space.
+  struct CsvLayout {
+    char Separator = ',';
+    int FirstColumn = 0;
+    int LastColumn = 1;
+    std::vector<int> ValueColumns{2};
+  };
+
+  IpRangeTable() = default;
+  ~IpRangeTable();
+  IpRangeTable(const IpRangeTable &) = delete;
+  IpRangeTable &operator=(const IpRangeTable &) = delete;
+
+  // Writes a table file. Where ranges overlap the narrower one wins.
+  static bool Compile(std::vector<Range> ranges, const std::string &outPath,
+                      std::string &error);
+  static bool CompileCsv(const std::string &csvPath, const std::string &outPath,
+                         const CsvLayout &layout, std::string &error);
+
+  bool Open(const std::string &path, std::string &error);
+
+  // Opens 'binPath', first recompiling it from 'csvPath' if the CSV is
+  // newer. A failed compile keeps the previous table.
+  bool OpenOrCompile(const std::string &binPath, const std::string &csvPath,
+                     const CsvLayout &layout, std::string &error);
+  void Close();
+  bool IsOpen() const { return m_nodes != nullptr; }
+
+  // Empty if the address is not covered. The view points into the mapping
+  // and stays valid until Close().
+  std::string_view Lookup(const IpAddress &ip) const;
+
+  uint32_t NodeCount() const { return m_nodeCount; }
+  uint32_t ValueCount() const { return m_valueCount; }
+
+private:
+  void *m_file = nullptr;
+  void *m_mapping = nullptr;
+  const uint8_t *m_view = nullptr;
+
+  const uint32_t *m_v4Root = nullptr;
+  const uint32_t *m_v6Root = nullptr;
+  const uint32_t *m_nodes = nullptr; // Pairs of children
+  const uint32_t *m_valueOffsets = nullptr;
+  const char *m_strings = nullptr;
+  uint32_t m_nodeCount = 0;
+  uint32_t m_valueCount = 0;
+};
+
+} // namespace monitor
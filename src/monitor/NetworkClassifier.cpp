@@ -0,0 +1,292 @@
+#include "NetworkClassifier.h"
+#include "../utils/Logger.h"
+#include <algorithm>
+#include <cwctype>
+#include <fstream>
+#include <sstream>
+#include <windows.h>
+
+namespace monitor {
+
+namespace {
+
+struct BuiltinRange {
+  const wchar_t *Cidr;
+  const wchar_t *Name;
+  NetworkClass Class;
+};
+
+const BuiltinRange kBuiltinRanges[] = {
+    {L"0.0.0.0/8", L"This network", NetworkClass::Reserved},
+    {L"10.0.0.0/8", L"Private network", NetworkClass::Lan},
+    {L"100.64.0.0/10", L"Shared address space (CGNAT)", NetworkClass::Lan},
+    {L"127.0.0.0/8", L"Loopback", NetworkClass::Loopback},
+    {L"169.254.0.0/16", L"Link-local", NetworkClass::Lan},
+    {L"172.16.0.0/12", L"Private network", NetworkClass::Lan},
+    {L"192.0.0.0/24", L"IETF protocol assignments", NetworkClass::Reserved},
+    {L"192.0.2.0/24", L"Documentation", NetworkClass::Reserved},
+    {L"192.168.0.0/16", L"Private network", NetworkClass::Lan},
+    {L"198.18.0.0/15", L"Benchmarking", NetworkClass::Reserved},
+    {L"198.51.100.0/24", L"Documentation", NetworkClass::Reserved},
+    {L"203.0.113.0/24", L"Documentation", NetworkClass::Reserved},
+    {L"224.0.0.0/4", L"Multicast", NetworkClass::Lan},
+    {L"240.0.0.0/4", L"Reserved", NetworkClass::Reserved},
+    {L"255.255.255.255/32", L"Broadcast", NetworkClass::Lan},
+    {L"::/128", L"Unspecified", NetworkClass::Reserved},
+    {L"::1/128", L"Loopback", NetworkClass::Loopback},
+    {L"100::/64", L"Discard-only", NetworkClass::Reserved},
+    {L"2001:db8::/32", L"Documentation", NetworkClass::Reserved},
+    {L"fc00::/7", L"Unique local", NetworkClass::Lan},
+    {L"fe80::/10", L"Link-local", NetworkClass::Lan},
+    {L"ff00::/8", L"Multicast", NetworkClass::Lan},
+};
+
+std::wstring Trim(const std::wstring &s) {
+  size_t b = 0, e = s.size();
+  while (b < e && std::iswspace(s[b]))
+    b++;
+  while (e > b && std::iswspace(s[e - 1]))
+    e--;
+  return s.substr(b, e - b);
+}
+
+} // namespace
+
+NetworkClassifier::NetworkClassifier() {
+  for (const auto &range : kBuiltinRanges) {
+    Subnet subnet;
+    ParseCidr(range.Cidr, subnet);
+    subnet.Name = range.Name;
+    subnet.Class = range.Class;
+    m_subnets.push_back(subnet);
+  }
+  m_builtinCount = m_subnets.size();
+  Compile();
+}
+
+bool NetworkClassifier::ParseCidr(const std::wstring &text, Subnet &subnet) {
+  std::wstring cidr = Trim(text);
+  size_t slash = cidr.find(L'/');
+  IpAddress ip;
+  if (!IpAddress::Parse(cidr.substr(0, slash), ip))
+    return false;
+
+  int maxLength = ip.IsV4() ? 32 : 128;
+  int length = maxLength;
+  if (slash != std::wstring::npos) {
+    std::wstring digits = cidr.substr(slash + 1);
+    if (digits.empty() || digits.size() > 3 ||
+        !std::all_of(digits.begin(), digits.end(),
+                     [](wchar_t c) { return c >= L'0' && c <= L'9'; }))
+      return false;
+    length = std::stoi(digits);
+    if (length > maxLength)
+      return false;
+  }
+  if (ip.IsV4())
+    length += 96;
+
+  for (int bit = length; bit < 128; bit++)
+    ip.Bytes[bit >> 3] &= (uint8_t) ~(0x80 >> (bit & 7));
+  subnet.Network = ip;
+  subnet.PrefixLength = length;
+  return true;
+}
+
+static bool ParseClass(const std::wstring &name, NetworkClass &out) {
+  std::wstring lower = name;
+  std::transform(lower.begin(), lower.end(), lower.begin(),
+                 [](wchar_t c) { return (wchar_t)towlower(c); });
+  for (size_t i = 0; i < kNetworkClassCount; i++) {
+    std::wstring candidate = NetworkClassifier::ClassName((NetworkClass)i);
+    std::transform(candidate.begin(), candidate.end(), candidate.begin(),
+                   [](wchar_t c) { return (wchar_t)towlower(c); });
+    if (lower == candidate) {
+      out = (NetworkClass)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool NetworkClassifier::LoadSubnets(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return false;
+  std::string utf8((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  if (utf8.size() >= 3 && utf8.compare(0, 3, "\xEF\xBB\xBF") == 0)
+    utf8.erase(0, 3);
+
+  std::wstring text;
+  int sz = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.length(),
+                               nullptr, 0);
+  if (sz > 0) {
+    text.resize(sz);
+    MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.length(), &text[0],
+                        sz);
+  }
+
+  // Sections are collected first since 'class' may follow 'subnet'
+  struct Section {
+    std::wstring Name;
+    NetworkClass Class = NetworkClass::Lan;
+    std::vector<Subnet> Subnets;
+  };
+  std::vector<Section> sections;
+  std::wstringstream lines(text);
+  std::wstring line;
+  int lineNo = 0;
+  while (std::getline(lines, line)) {
+    lineNo++;
+    line = Trim(line);
+    if (line.empty() || line.front() == L';' || line.front() == L'#')
+      continue;
+
+    if (line.front() == L'[' && line.back() == L']') {
+      sections.emplace_back();
+      sections.back().Name = Trim(line.substr(1, line.size() - 2));
+      continue;
+    }
+
+    size_t eq = line.find(L'=');
+    bool valid = !sections.empty() && eq != std::wstring::npos;
+    if (valid) {
+      std::wstring key = Trim(line.substr(0, eq));
+      std::wstring value = Trim(line.substr(eq + 1));
+      Section &section = sections.back();
+      if (key == L"class") {
+        valid = ParseClass(value, section.Class);
+      } else if (key == L"subnet") {
+        std::wstringstream list(value);
+        std::wstring item;
+        while (valid && std::getline(list, item, L',')) {
+          Subnet subnet;
+          valid = ParseCidr(item, subnet);
+          if (valid)
+            section.Subnets.push_back(subnet);
+        }
+      } else {
+        valid = false;
+      }
+    }
+    if (!valid)
+      LOG("Warning: Ignoring line " + std::to_string(lineNo) + " in " + path);
+  }
+
+  std::vector<Subnet> subnets;
+  for (const auto &section : sections) {
+    for (Subnet subnet : section.Subnets) {
+      subnet.Name = section.Name;
+      subnet.Class = section.Class;
+      subnets.push_back(subnet);
+    }
+  }
+  SetSubnets(std::move(subnets));
+  LOG("Loaded " + std::to_string(m_subnets.size() - m_builtinCount) +
+      " named subnets from " + path);
+  return true;
+}
+
+void NetworkClassifier::SetSubnets(std::vector<Subnet> subnets) {
+  m_subnets.resize(m_builtinCount);
+  m_subnets.insert(m_subnets.end(), subnets.begin(), subnets.end());
+  Compile();
+}
+
+NetworkClassifier::U128 NetworkClassifier::ToU128(const IpAddress &ip) {
+  U128 value{0, 0};
+  for (int i = 0; i < 8; i++) {
+    value.Hi = (value.Hi << 8) | ip.Bytes[i];
+    value.Lo = (value.Lo << 8) | ip.Bytes[i + 8];
+  }
+  return value;
+}
+
+bool NetworkClassifier::Less(const U128 &a, const U128 &b) {
+  return a.Hi != b.Hi ? a.Hi < b.Hi : a.Lo < b.Lo;
+}
+
+void NetworkClassifier::Compile() {
+  // Host bits of a prefix length as a 128-bit mask
+  auto hostMask = [](int length) {
+    U128 mask;
+    mask.Hi = length >= 64 ? 0 : (~0ull >> length);
+    mask.Lo = length >= 128  ? 0
+              : length <= 64 ? ~0ull
+                             : (~0ull >> (length - 64));
+    return mask;
+  };
+
+  struct Span {
+    U128 First, Last;
+  };
+  std::vector<Span> spans;
+  std::vector<U128> starts{{0, 0}};
+  for (const auto &subnet : m_subnets) {
+    U128 first = ToU128(subnet.Network);
+    U128 mask = hostMask(subnet.PrefixLength);
+    U128 last{first.Hi | mask.Hi, first.Lo | mask.Lo};
+    spans.push_back({first, last});
+    starts.push_back(first);
+    if (last.Hi != ~0ull || last.Lo != ~0ull) {
+      U128 next = last;
+      if (++next.Lo == 0)
+        next.Hi++;
+      starts.push_back(next);
+    }
+  }
+  std::sort(starts.begin(), starts.end(), Less);
+  starts.erase(std::unique(starts.begin(), starts.end(),
+                           [](const U128 &a, const U128 &b) {
+                             return a.Hi == b.Hi && a.Lo == b.Lo;
+                           }),
+               starts.end());
+
+  // Nothing changes inside a run, so its start decides for all of it
+  m_runs.clear();
+  for (const U128 &start : starts) {
+    uint32_t best = kNone;
+    for (uint32_t i = 0; i < m_subnets.size(); i++) {
+      if (Less(start, spans[i].First) || Less(spans[i].Last, start))
+        continue;
+      if (best == kNone ||
+          m_subnets[i].PrefixLength >= m_subnets[best].PrefixLength)
+        best = i; // Later (user) subnets win ties
+    }
+    if (m_runs.empty() || m_runs.back().Subnet != best)
+      m_runs.push_back({start, best});
+  }
+}
+
+const Subnet *NetworkClassifier::Classify(const IpAddress &ip) const {
+  U128 key = ToU128(ip);
+  auto it = std::upper_bound(
+      m_runs.begin(), m_runs.end(), key,
+      [](const U128 &k, const Run &run) { return Less(k, run.Start); });
+  uint32_t subnet = std::prev(it)->Subnet;
+  return subnet == kNone ? nullptr : &m_subnets[subnet];
+}
+
+NetworkClass NetworkClassifier::GetClass(const IpAddress &ip) const {
+  const Subnet *subnet = Classify(ip);
+  return subnet ? subnet->Class : NetworkClass::Internet;
+}
+
+const wchar_t *NetworkClassifier::ClassName(NetworkClass networkClass) {
+  switch (networkClass) {
+  case NetworkClass::Internet:
+    return L"Internet";
+  case NetworkClass::Loopback:
+    return L"Loopback";
+  case NetworkClass::Lan:
+    return L"LAN";
+  case NetworkClass::Vpn:
+    return L"VPN";
+  case NetworkClass::Reserved:
+    return L"Reserved";
+  }
+  return L"";
+}
+
+} // namespace monitor
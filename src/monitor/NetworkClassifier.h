@@ -0,0 +1,85 @@
+#pragma once
+
+#include "IpAddress.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace monitor {
+
+// Where traffic to an address goes, for accounting
+enum class NetworkClass : uint8_t {
+  Internet,
+  Loopback,
+  Lan,      // Private, link-local, CGNAT and multicast ranges
+  Vpn,      // Only from user-defined subnets
+  Reserved, // Documentation, benchmarking and other unroutable ranges
+};
+constexpr size_t kNetworkClassCount = 5;
+
+struct Subnet {
+  std::wstring Name;
+  NetworkClass Class = NetworkClass::Lan;
+  IpAddress Network;    // Host bits cleared
+  int PrefixLength = 0; // Of the 128-bit form: IPv4 /n is /96+n
+};
+
+// Maps addresses to the special-purpose (RFC 6890 and friends) or
+// user-named subnet they belong to.
+//
+// All subnets are flattened once into a sorted list of disjoint address
+// runs, each holding the most specific subnet covering it, so a lookup is
+// a binary search over 128-bit integers. A user subnet wins over a
+// built-in one of the same size, so e.g. the CGNAT block can be renamed
+// to a mesh VPN.
+class NetworkClassifier {
+public:
+  // Starts with the built-in ranges only
+  NetworkClassifier();
+
+  // "10.8.0.0/16", "fd00::/8" or a bare address (a single host)
+  static bool ParseCidr(const std::wstring &text, Subnet &subnet);
+
+  // Replaces the user subnets with those in an INI-style file, one
+  // section per network with its name as the section name:
+  //
+  //   [Office VPN]
+  //   class = vpn
+  //   subnet = 10.8.0.0/16, fd12:3456::/48
+  //
+  // 'class' is lan, vpn, loopback, reserved or internet (default lan).
+  // Returns false and keeps the current subnets if the file cannot be
+  // read. Not thread-safe; configure before the first lookup.
+  bool LoadSubnets(const std::string &path);
+  void SetSubnets(std::vector<Subnet> subnets);
+
+  // The most specific subnet containing 'ip', nullptr if it is an
+  // ordinary internet address
+  const Subnet *Classify(const IpAddress &ip) const;
+  NetworkClass GetClass(const IpAddress &ip) const;
+
+  static const wchar_t *ClassName(NetworkClass networkClass);
+
+private:
+  struct U128 {
+    uint64_t Hi, Lo;
+  };
+
+  // Start of a run of addresses that classify the same way
+  struct Run {
+    U128 Start;
+    uint32_t Subnet; // Index into m_subnets, kNone for internet
+  };
+
+  static constexpr uint32_t kNone = 0xFFFFFFFF;
+
+  static U128 ToU128(const IpAddress &ip);
+  static bool Less(const U128 &a, const U128 &b);
+  void Compile();
+
+  std::vector<Subnet> m_subnets; // Built-in ones first, then the user's
+  size_t m_builtinCount = 0;
+  std::vector<Run> m_runs;       // Sorted by start, first one starts at 0
+};
+
+} // namespace monitor
@@ -1,4 +1,5 @@
 #include "ProcessTracker.h"
+#include "../utils/Logger.h"
 
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
@@ -9,10 +10,165 @@
 #include <tlhelp32.h>
 
 #include <filesystem>
+#include <thread>
 
 namespace monitor {
 
-ProcessTracker::ProcessTracker() { RefreshAllProcesses(); }
+const std::wstring ProcessTracker::kUnnamed;
+
+ProcessTracker::ProcessTracker() : m_slots(new Slot[kCapacity]) {
+  RefreshAllProcesses();
+}
+
+uint32_t ProcessTracker::Home(uint32_t pid) {
+  // Fibonacci hashing; PIDs are multiples of 4 so the low bits are useless
+  return (pid * 0x9E3779B1u) >> (32 - kCapacityBits);
+}
+
+std::wstring ProcessTracker::Display(uint32_t pid, const std::wstring *name) {
+  if (name == &kUnnamed)
+    return L"[PID:" + std::to_wstring(pid) + L"]";
+  return *name;
+}
+
+void ProcessTracker::BeginWrite() {
+  m_seq.store(m_seq.load(std::memory_order_relaxed) + 1,
+              std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ProcessTracker::EndWrite() {
+  m_seq.store(m_seq.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+}
+
+const std::wstring *ProcessTracker::Find(uint32_t pid) const {
+  for (;;) {
+    uint32_t seq = m_seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      std::this_thread::yield(); // A start/exit is being applied
+      continue;
+    }
+
+    const std::wstring *found = nullptr;
+    for (uint32_t i = Home(pid), n = 0; n < kCapacity;
+         i = (i + 1) & (kCapacity - 1), n++) {
+      const std::wstring *name =
+          m_slots[i].Name.load(std::memory_order_relaxed);
+      if (!name)
+        break;
+      if (m_slots[i].Pid.load(std::memory_order_relaxed) == pid) {
+        found = name;
+        break;
+      }
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_seq.load(std::memory_order_relaxed) == seq)
+      return found;
+  }
+}
+
+const std::wstring *ProcessTracker::Intern(const std::wstring &name) {
+  if (name.empty())
+    return &kUnnamed;
+  auto it = m_names.find(name);
+  if (it != m_names.end())
+    return &*it;
+  if (m_names.size() >= kMaxNames) {
+    static bool warned = false;
+    if (!warned) {
+      LOG("Warning: ProcessTracker name set full; showing new names as PIDs");
+      warned = true;
+    }
+    return &kUnnamed;
+  }
+  return &*m_names.insert(name).first;
+}
+
+ProcessTracker::Slot *ProcessTracker::FindLocked(uint32_t pid) {
+  for (uint32_t i = Home(pid), n = 0; n < kCapacity;
+       i = (i + 1) & (kCapacity - 1), n++) {
+    if (!m_slots[i].Name.load(std::memory_order_relaxed))
+      return nullptr;
+    if (m_slots[i].Pid.load(std::memory_order_relaxed) == pid)
+      return &m_slots[i];
+  }
+  return nullptr;
+}
+
+void ProcessTracker::InsertLocked(uint32_t pid, uint64_t startTime,
+                                  const std::wstring *name) {
+  if (m_count >= kMaxEntries)
+    EvictLocked();
+  uint32_t i = Home(pid);
+  while (m_slots[i].Name.load(std::memory_order_relaxed))
+    i = (i + 1) & (kCapacity - 1);
+  m_slots[i].Pid.store(pid, std::memory_order_relaxed);
+  m_slots[i].StartTime.store(startTime, std::memory_order_relaxed);
+  m_slots[i].Exited.store(false, std::memory_order_relaxed);
+  m_slots[i].Name.store(name, std::memory_order_relaxed);
+  m_count++;
+}
+
+void ProcessTracker::EvictLocked() {
+  static bool warned = false;
+  if (!warned) {
+    LOG("Warning: ProcessTracker table full; evicting old entries");
+    warned = true;
+  }
+  // Exited processes first, even within their grace period
+  while (!m_exited.empty()) {
+    ProcessKey key = m_exited.front().Key;
+    m_exited.pop_front();
+    Slot *slot = FindLocked(key.Pid);
+    if (slot && slot->Exited.load(std::memory_order_relaxed) &&
+        slot->StartTime.load(std::memory_order_relaxed) == key.StartTime) {
+      EraseLocked((uint32_t)(slot - m_slots.get()));
+      return;
+    }
+  }
+  // Otherwise the one started longest ago; unknown start times go first
+  uint32_t oldest = kCapacity;
+  uint64_t oldestStart = UINT64_MAX;
+  for (uint32_t i = 0; i < kCapacity; i++) {
+    if (!m_slots[i].Name.load(std::memory_order_relaxed))
+      continue;
+    uint64_t start = m_slots[i].StartTime.load(std::memory_order_relaxed);
+    if (start < oldestStart) {
+      oldest = i;
+      oldestStart = start;
+    }
+  }
+  if (oldest != kCapacity)
+    EraseLocked(oldest);
+}
+
+void ProcessTracker::EraseLocked(uint32_t hole) {
+  // Backward-shift deletion keeps probe chains intact without tombstones
+  const uint32_t mask = kCapacity - 1;
+  for (uint32_t j = (hole + 1) & mask;; j = (j + 1) & mask) {
+    const std::wstring *name = m_slots[j].Name.load(std::memory_order_relaxed);
+    if (!name)
+      break;
+    uint32_t home = Home(m_slots[j].Pid.load(std::memory_order_relaxed));
+    // Move j into the hole unless its home lies cyclically in (hole, j]
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      Slot &dst = m_slots[hole];
+      Slot &src = m_slots[j];
+      dst.Pid.store(src.Pid.load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+      dst.StartTime.store(src.StartTime.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+      dst.Exited.store(src.Exited.load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+      dst.Name.store(name, std::memory_order_relaxed);
+      hole = j;
+    }
+  }
+  m_slots[hole].Name.store(nullptr, std::memory_order_relaxed);
+  m_count--;
+}
 
 void ProcessTracker::RefreshAllProcesses() {
   HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
@@ -24,9 +180,24 @@ void ProcessTracker::RefreshAllProcesses() {
 
   if (Process32FirstW(hSnapshot, &pe32)) {
     do {
-      std::lock_guard<std::mutex> lock(m_mutex);
-      if (m_cache.find(pe32.th32ProcessID) == m_cache.end()) {
-        m_cache[pe32.th32ProcessID] = pe32.szExeFile;
+      // Creation time makes the entry comparable with later exit events
+      uint64_t startTime = 0;
+      HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE,
+                                    pe32.th32ProcessID);
+      if (hProcess) {
+        FILETIME created, exited, kernel, user;
+        if (GetProcessTimes(hProcess, &created, &exited, &kernel, &user))
+          startTime = ((uint64_t)created.dwHighDateTime << 32) |
+                      created.dwLowDateTime;
+        CloseHandle(hProcess);
+      }
+
+      std::lock_guard<std::mutex> lock(m_writeMutex);
+      if (!FindLocked(pe32.th32ProcessID)) {
+        const std::wstring *name = Intern(pe32.szExeFile);
+        BeginWrite();
+        InsertLocked(pe32.th32ProcessID, startTime, name);
+        EndWrite();
       }
     } while (Process32NextW(hSnapshot, &pe32));
   }
@@ -34,28 +205,97 @@ void ProcessTracker::RefreshAllProcesses() {
   CloseHandle(hSnapshot);
 }
 
-std::wstring ProcessTracker::GetProcessName(uint32_t pid) {
-  std::lock_guard<std::mutex> lock(m_mutex);
+void ProcessTracker::OnProcessStart(uint32_t pid, uint64_t startTime,
+                                    const std::wstring &imageName) {
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  const std::wstring *name = Intern(imageName);
+  BeginWrite();
+  // Overwrites whatever held this PID before; that process is gone
+  if (Slot *slot = FindLocked(pid)) {
+    slot->StartTime.store(startTime, std::memory_order_relaxed);
+    slot->Exited.store(false, std::memory_order_relaxed);
+    slot->Name.store(name, std::memory_order_relaxed);
+  } else {
+    InsertLocked(pid, startTime, name);
+  }
+  EndWrite();
+}
+
+void ProcessTracker::OnProcessExit(uint32_t pid, uint64_t startTime) {
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  Slot *slot = FindLocked(pid);
+  if (!slot)
+    return;
+  // An unknown start time (0) on either side still counts as the same
+  // process; a different known one means the PID was already reused
+  uint64_t known = slot->StartTime.load(std::memory_order_relaxed);
+  if (known != 0 && startTime != 0 && known != startTime)
+    return;
+  // Readers never look at Exited, so no sequence bump is needed
+  slot->Exited.store(true, std::memory_order_relaxed);
+  m_exited.push_back({{pid, known}, Clock::now()});
+}
 
-  auto it = m_cache.find(pid);
-  if (it != m_cache.end()) {
-    return it->second;
+void ProcessTracker::AgeOut(std::chrono::seconds grace) {
+  auto cutoff = Clock::now() - grace;
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  bool writing = false;
+  while (!m_exited.empty() && m_exited.front().ExitedAt <= cutoff) {
+    const ProcessKey &key = m_exited.front().Key;
+    Slot *slot = FindLocked(key.Pid);
+    // Skip if the PID has been reused since
+    if (slot && slot->Exited.load(std::memory_order_relaxed) &&
+        slot->StartTime.load(std::memory_order_relaxed) == key.StartTime) {
+      if (!writing) {
+        BeginWrite();
+        writing = true;
+      }
+      EraseLocked((uint32_t)(slot - m_slots.get()));
+    }
+    m_exited.pop_front();
   }
+  if (writing)
+    EndWrite();
+}
+
+std::wstring ProcessTracker::GetProcessName(uint32_t pid) {
+  if (const std::wstring *name = Find(pid))
+    return Display(pid, name);
 
-  std::wstring name = ResolveName(pid);
-  m_cache[pid] = name;
-  return name;
+  // Miss: a process we have no start event for. Resolve without the lock.
+  std::wstring resolved;
+  uint64_t startTime = 0;
+  ResolveName(pid, resolved, startTime);
+
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  if (Slot *slot = FindLocked(pid))
+    return Display(pid, slot->Name.load(std::memory_order_relaxed));
+  const std::wstring *name = Intern(resolved);
+  BeginWrite();
+  InsertLocked(pid, startTime, name);
+  EndWrite();
+  return Display(pid, name);
 }
 
-std::wstring ProcessTracker::ResolveName(uint32_t pid) {
-  if (pid == 0)
-    return L"System Idle";
-  if (pid == 4)
-    return L"System";
+void ProcessTracker::ResolveName(uint32_t pid, std::wstring &name,
+                                 uint64_t &startTime) {
+  if (pid == 0) {
+    name = L"System Idle";
+    return;
+  }
+  if (pid == 4) {
+    name = L"System";
+    return;
+  }
 
   // Try to get full path
   HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
   if (hProcess) {
+    FILETIME created, exited, kernel, user;
+    if (GetProcessTimes(hProcess, &created, &exited, &kernel, &user))
+      startTime =
+          ((uint64_t)created.dwHighDateTime << 32) | created.dwLowDateTime;
+
     wchar_t buffer[MAX_PATH * 2];
     DWORD size = MAX_PATH * 2;
 
@@ -63,32 +303,15 @@ std::wstring ProcessTracker::ResolveName(uint32_t pid) {
       CloseHandle(hProcess);
       try {
         std::filesystem::path p(buffer);
-        return p.filename().wstring();
+        name = p.filename().wstring();
       } catch (...) {
-        return buffer;
+        name = buffer;
       }
+      return;
     }
     CloseHandle(hProcess);
   }
-
-  // Fallback: search snapshot
-  HANDLE hSnapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-  if (hSnapshot != INVALID_HANDLE_VALUE) {
-    PROCESSENTRY32W pe32;
-    pe32.dwSize = sizeof(PROCESSENTRY32W);
-
-    if (Process32FirstW(hSnapshot, &pe32)) {
-      do {
-        if (pe32.th32ProcessID == pid) {
-          CloseHandle(hSnapshot);
-          return pe32.szExeFile;
-        }
-      } while (Process32NextW(hSnapshot, &pe32));
-    }
-    CloseHandle(hSnapshot);
-  }
-
-  return L"[PID:" + std::to_wstring(pid) + L"]";
+  // Left empty: shown as "[PID:x]" without interning a name per PID
 }
 
 } // namespace monitor
@@ -1,22 +1,99 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <string>
-#include <unordered_map>
+#include <unordered_set>
 
 namespace monitor {
 
+// A PID is only unique while its process runs; together with the creation
+// time it identifies one process for the lifetime of the machine
+struct ProcessKey {
+  uint32_t Pid = 0;
+  uint64_t StartTime = 0; // FILETIME, 0 if unknown
+};
+
+// Tracks running processes from Kernel-Process start/exit events so name
+// lookups are a table hit. Only PIDs seen before the first event (or whose
+// start event was missed) are resolved through the OS, once.
+//
+// Lookups are lock-free: the PID table is an open-addressing array guarded
+// by a sequence counter, so readers never write shared memory and only
+// retry if a start/exit landed while they were probing. Names are interned
+// and never freed, so a name a reader found stays valid however long it
+// was preempted; past kMaxNames distinct names, new ones show as their PID.
+// When the table is full, the oldest exited process makes room, or else
+// the one started longest ago.
 class ProcessTracker {
 public:
   ProcessTracker();
+
   std::wstring GetProcessName(uint32_t pid);
+
+  void OnProcessStart(uint32_t pid, uint64_t startTime,
+                      const std::wstring &imageName);
+  void OnProcessExit(uint32_t pid, uint64_t startTime);
+
+  // Forgets processes that exited more than 'grace' ago. Late traffic from
+  // an exited process still resolves until then.
+  void AgeOut(std::chrono::seconds grace);
+
   void RefreshAllProcesses();
 
 private:
-  std::wstring ResolveName(uint32_t pid);
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr uint32_t kCapacityBits = 14;
+  static constexpr uint32_t kCapacity = 1u << kCapacityBits;
+  static constexpr uint32_t kMaxEntries = kCapacity / 4 * 3;
+  static constexpr size_t kMaxNames = 16384;
+
+  // Written only with m_writeMutex held and the sequence odd. Fields are
+  // atomics so the racing reads a seqlock allows are well defined.
+  struct Slot {
+    std::atomic<const std::wstring *> Name{nullptr}; // nullptr = empty
+    std::atomic<uint32_t> Pid{0};
+    std::atomic<uint64_t> StartTime{0};
+    std::atomic<bool> Exited{false};
+  };
+
+  struct ExitRecord {
+    ProcessKey Key;
+    Clock::time_point ExitedAt;
+  };
+
+  // Stands in for a name we could not (or would not) intern
+  static const std::wstring kUnnamed;
+
+  static uint32_t Home(uint32_t pid);
+  static std::wstring Display(uint32_t pid, const std::wstring *name);
+  static void ResolveName(uint32_t pid, std::wstring &name,
+                          uint64_t &startTime);
+
+  const std::wstring *Find(uint32_t pid) const;
+
+  // Callers hold m_writeMutex
+  const std::wstring *Intern(const std::wstring &name);
+  Slot *FindLocked(uint32_t pid);
+  void InsertLocked(uint32_t pid, uint64_t startTime,
+                    const std::wstring *name);
+  void EraseLocked(uint32_t index);
+  void EvictLocked(); // Frees one entry of a full table
+  void BeginWrite();
+  void EndWrite();
+
+  std::unique_ptr<Slot[]> m_slots;
+  uint32_t m_count = 0;
+  std::atomic<uint32_t> m_seq{0};
 
-  std::unordered_map<uint32_t, std::wstring> m_cache;
-  std::mutex m_mutex;
+  std::unordered_set<std::wstring> m_names; // Nodes never move
+  std::deque<ExitRecord> m_exited;          // In exit order
+  std::mutex m_writeMutex;
 };
 
 } // namespace monitor
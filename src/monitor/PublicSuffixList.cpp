@@ -0,0 +1,221 @@
+#include "PublicSuffixList.h"
+#include "../utils/Logger.h"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <windows.h>
+
+namespace monitor {
+
+namespace {
+
+// Generic TLDs and the second-level suffixes that matter most in
+// practice, plus hosting suffixes whose subdomains belong to different
+// owners. Drop the full list next to the database for everything else.
+const wchar_t *const kBuiltinRules[] = {
+    L"com", L"net", L"org", L"edu", L"gov", L"mil", L"int", L"info",
+    L"biz", L"name", L"pro", L"mobi", L"app", L"dev", L"io", L"ai",
+    L"co", L"me", L"tv", L"cc", L"xyz", L"online", L"site", L"cloud",
+    L"arpa", L"in-addr.arpa", L"ip6.arpa",
+    // Country codes with their common second levels
+    L"uk", L"co.uk", L"org.uk", L"ac.uk", L"gov.uk", L"ltd.uk", L"me.uk",
+    L"net.uk", L"plc.uk", L"jp", L"co.jp", L"ne.jp", L"or.jp", L"ac.jp",
+    L"go.jp", L"au", L"com.au", L"net.au", L"org.au", L"edu.au", L"gov.au",
+    L"nz", L"co.nz", L"net.nz", L"org.nz", L"br", L"com.br", L"net.br",
+    L"org.br", L"gov.br", L"cn", L"com.cn", L"net.cn", L"org.cn", L"gov.cn",
+    L"edu.cn", L"hk", L"com.hk", L"tw", L"com.tw", L"kr", L"co.kr",
+    L"or.kr", L"in", L"co.in", L"net.in", L"org.in", L"gov.in", L"za",
+    L"co.za", L"mx", L"com.mx", L"ar", L"com.ar", L"tr", L"com.tr", L"sg",
+    L"com.sg", L"my", L"com.my", L"id", L"co.id", L"th", L"co.th", L"il",
+    L"co.il", L"ua", L"com.ua", L"net.ua", L"org.ua", L"in.ua", L"kiev.ua",
+    L"ru", L"com.ru", L"su", L"by", L"kz", L"pl", L"com.pl", L"de", L"fr",
+    L"it", L"es", L"com.es", L"nl", L"be", L"ch", L"at", L"co.at", L"se",
+    L"no", L"dk", L"fi", L"cz", L"sk", L"hu", L"ro", L"bg", L"gr", L"pt",
+    L"ie", L"eu", L"ca", L"us", L"ws", L"to", L"ly", L"gg", L"fm", L"gl",
+    L"ms", L"vn", L"com.vn", L"ph", L"com.ph", L"pk", L"com.pk", L"eg",
+    L"com.eg", L"sa", L"com.sa", L"ae", L"ir", L"ng", L"com.ng", L"ke",
+    L"co.ke", L"cl", L"pe", L"com.pe", L"co.com", L"ve", L"uy", L"*.ck",
+    L"!www.ck",
+    // Private suffixes: every subdomain is a separate site
+    L"github.io", L"githubusercontent.com", L"gitlab.io", L"herokuapp.com",
+    L"appspot.com", L"blogspot.com", L"cloudfront.net", L"azurewebsites.net",
+    L"cloudapp.net", L"trafficmanager.net", L"web.app", L"firebaseapp.com",
+    L"netlify.app", L"vercel.app", L"pages.dev", L"workers.dev",
+    L"s3.amazonaws.com", L"elasticbeanstalk.com", L"fastly.net",
+    L"global.ssl.fastly.net", L"ngrok.io", L"duckdns.org", L"dyndns.org",
+    L"no-ip.org",
+};
+
+struct BuildNode {
+  std::map<std::wstring, std::unique_ptr<BuildNode>> Children;
+  bool IsRule = false;
+  bool IsException = false;
+  bool HasWildcard = false;
+};
+
+constexpr uint32_t kNoNode = 0xFFFFFFFF;
+
+} // namespace
+
+PublicSuffixList::PublicSuffixList() {
+  SetRules(std::vector<std::wstring>(std::begin(kBuiltinRules),
+                                     std::end(kBuiltinRules)));
+}
+
+bool PublicSuffixList::Load(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    return false;
+  std::string utf8((std::istreambuf_iterator<char>(file)),
+                   std::istreambuf_iterator<char>());
+  if (utf8.size() >= 3 && utf8.compare(0, 3, "\xEF\xBB\xBF") == 0)
+    utf8.erase(0, 3);
+
+  std::wstring text;
+  int sz = MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.length(),
+                               nullptr, 0);
+  if (sz > 0) {
+    text.resize(sz);
+    MultiByteToWideChar(CP_UTF8, 0, utf8.c_str(), (int)utf8.length(), &text[0],
+                        sz);
+  }
+
+  // One rule per line, up to the first whitespace; "//" starts a comment
+  std::vector<std::wstring> rules;
+  std::wstringstream lines(text);
+  std::wstring line;
+  while (std::getline(lines, line)) {
+    std::wstringstream fields(line);
+    std::wstring rule;
+    if (!(fields >> rule) || rule.compare(0, 2, L"//") == 0)
+      continue;
+    std::transform(rule.begin(), rule.end(), rule.begin(),
+                   [](wchar_t c) { return (wchar_t)towlower(c); });
+    rules.push_back(rule);
+  }
+  if (rules.empty()) {
+    LOG("Warning: No public suffix rules in " + path);
+    return false;
+  }
+  SetRules(rules);
+  LOG("Loaded " + std::to_string(rules.size()) + " public suffix rules (" +
+      std::to_string(m_nodes.size()) + " nodes) from " + path);
+  return true;
+}
+
+void PublicSuffixList::SetRules(const std::vector<std::wstring> &rules) {
+  BuildNode root;
+  for (const auto &text : rules) {
+    std::wstring rule = text;
+    bool exception = !rule.empty() && rule[0] == L'!';
+    if (exception)
+      rule.erase(0, 1);
+    if (rule.empty())
+      continue;
+
+    // Walk the labels right to left, creating nodes on the way
+    BuildNode *node = &root;
+    size_t end = rule.size();
+    while (true) {
+      size_t dot = end == 0 ? std::wstring::npos : rule.rfind(L'.', end - 1);
+      size_t start = dot == std::wstring::npos ? 0 : dot + 1;
+      std::wstring label = rule.substr(start, end - start);
+      if (label == L"*" && dot == std::wstring::npos && !exception) {
+        node->HasWildcard = true;
+        break;
+      }
+      auto &child = node->Children[label];
+      if (!child)
+        child = std::make_unique<BuildNode>();
+      node = child.get();
+      if (dot == std::wstring::npos) {
+        if (exception)
+          node->IsException = true;
+        else
+          node->IsRule = true;
+        break;
+      }
+      end = dot;
+    }
+  }
+
+  // Flatten breadth-first so every node's children are contiguous
+  m_nodes.assign(1, Node());
+  m_labels.clear();
+  std::vector<const BuildNode *> queue{&root};
+  for (size_t i = 0; i < queue.size(); i++) {
+    const BuildNode *build = queue[i];
+    m_nodes[i].IsRule = build->IsRule;
+    m_nodes[i].IsException = build->IsException;
+    m_nodes[i].HasWildcard = build->HasWildcard;
+    m_nodes[i].FirstChild = (uint32_t)m_nodes.size();
+    m_nodes[i].ChildCount = (uint32_t)build->Children.size();
+    for (const auto &[label, child] : build->Children) {
+      Node node;
+      node.LabelOffset = (uint32_t)m_labels.size();
+      node.LabelLength = (uint32_t)label.size();
+      m_labels += label;
+      m_nodes.push_back(node);
+      queue.push_back(child.get());
+    }
+  }
+}
+
+uint32_t PublicSuffixList::FindChild(const Node &node,
+                                     std::wstring_view label) const {
+  uint32_t lo = node.FirstChild, hi = node.FirstChild + node.ChildCount;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    int cmp = Label(m_nodes[mid]).compare(label);
+    if (cmp == 0)
+      return mid;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return kNoNode;
+}
+
+std::wstring
+PublicSuffixList::GetRegistrableDomain(const std::wstring &name) const {
+  std::wstring_view view(name);
+  size_t starts[128]; // Label start by depth; DNS names have at most 127
+  size_t depth = 0;
+  size_t suffixLabels = 1; // The implicit "*" rule
+  uint32_t node = 0;
+  size_t end = view.size();
+  while (depth < 128) {
+    size_t dot = end == 0 ? std::wstring::npos : view.rfind(L'.', end - 1);
+    size_t start = dot == std::wstring::npos ? 0 : dot + 1;
+    starts[depth] = start;
+
+    if (node != kNoNode) {
+      const Node &current = m_nodes[node];
+      if (current.HasWildcard)
+        suffixLabels = std::max(suffixLabels, depth + 1);
+      uint32_t child = FindChild(current, view.substr(start, end - start));
+      if (child != kNoNode && m_nodes[child].IsException) {
+        suffixLabels = depth; // Overrides any wildcard
+        child = kNoNode;
+      } else if (child != kNoNode && m_nodes[child].IsRule) {
+        suffixLabels = std::max(suffixLabels, depth + 1);
+      }
+      node = child;
+    }
+    depth++;
+
+    // Past the trie, only the label left of the suffix is still needed
+    if (dot == std::wstring::npos || (node == kNoNode && depth > suffixLabels))
+      break;
+    end = dot;
+  }
+
+  if (depth <= suffixLabels)
+    return name; // A public suffix itself
+  return name.substr(starts[suffixLabels]);
+}
+
+} // namespace monitor
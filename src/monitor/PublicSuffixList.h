@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace monitor {
+
+// Public suffix list (publicsuffix.org) for grouping host names by
+// registrable domain ("eTLD+1"): r3---sn-abc.googlevideo.com and
+// www.youtube.co.uk become googlevideo.com and youtube.co.uk.
+//
+// Rules are compiled into a trie keyed by reversed labels whose nodes and
+// sorted child ranges live in flat arrays, so a lookup is one walk from
+// the last label towards the first with a binary search per level.
+class PublicSuffixList {
+public:
+  // Starts with a built-in list of common suffixes
+  PublicSuffixList();
+
+  // Replaces the rules with a public_suffix_list.dat file. Returns false
+  // and keeps the current rules if it cannot be read or has no rules.
+  // Not thread-safe; load before the first lookup.
+  bool Load(const std::string &path);
+
+  // Rules in list syntax: "co.uk", "*.ck", "!www.ck"
+  void SetRules(const std::vector<std::wstring> &rules);
+
+  // The registrable domain of a lower-case name without a trailing dot.
+  // A name that is itself a public suffix is returned unchanged.
+  std::wstring GetRegistrableDomain(const std::wstring &name) const;
+
+  size_t NodeCount() const { return m_nodes.size(); }
+
+private:
+  struct Node {
+    uint32_t LabelOffset = 0; // Into m_labels
+    uint32_t LabelLength = 0;
+    uint32_t FirstChild = 0;  // Children are contiguous, sorted by label
+    uint32_t ChildCount = 0;
+    bool IsRule = false;      // A suffix ends here
+    bool IsException = false; // "!" rule: the parent is the suffix
+    bool HasWildcard = false; // "*" rule below this node
+  };
+
+  uint32_t FindChild(const Node &node, std::wstring_view label) const;
+  std::wstring_view Label(const Node &node) const {
+    return std::wstring_view(m_labels).substr(node.LabelOffset,
+                                              node.LabelLength);
+  }
+
+  std::vector<Node> m_nodes; // [0] is the root
+  std::wstring m_labels;
+};
+
+} // namespace monitor
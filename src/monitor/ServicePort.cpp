@@ -0,0 +1,99 @@
+#include "ServicePort.h"
+#include <algorithm>
+#include <iterator>
+
+namespace monitor {
+
+static bool IsEphemeral(uint16_t port) { return port >= 32768; }
+
+uint16_t ServicePort(uint16_t localPort, uint16_t remotePort) {
+  if (localPort == 0 || remotePort == 0)
+    return std::max(localPort, remotePort);
+  if (IsEphemeral(localPort) != IsEphemeral(remotePort))
+    return IsEphemeral(localPort) ? remotePort : localPort;
+  return std::min(localPort, remotePort);
+}
+
+namespace {
+struct KnownPort {
+  uint16_t Port;
+  Protocol Proto; // Unknown matches both
+  const wchar_t *Name;
+};
+
+// Sorted by port
+const KnownPort kKnownPorts[] = {
+    {20, Protocol::Tcp, L"ftp-data"},
+    {21, Protocol::Tcp, L"ftp"},
+    {22, Protocol::Tcp, L"ssh"},
+    {23, Protocol::Tcp, L"telnet"},
+    {25, Protocol::Tcp, L"smtp"},
+    {53, Protocol::Unknown, L"dns"},
+    {67, Protocol::Udp, L"dhcp"},
+    {68, Protocol::Udp, L"dhcp"},
+    {80, Protocol::Tcp, L"http"},
+    {88, Protocol::Unknown, L"kerberos"},
+    {110, Protocol::Tcp, L"pop3"},
+    {123, Protocol::Udp, L"ntp"},
+    {135, Protocol::Tcp, L"rpc"},
+    {137, Protocol::Udp, L"netbios"},
+    {138, Protocol::Udp, L"netbios"},
+    {139, Protocol::Tcp, L"netbios"},
+    {143, Protocol::Tcp, L"imap"},
+    {161, Protocol::Udp, L"snmp"},
+    {389, Protocol::Unknown, L"ldap"},
+    {443, Protocol::Tcp, L"https"},
+    {443, Protocol::Udp, L"quic"},
+    {445, Protocol::Tcp, L"smb"},
+    {465, Protocol::Tcp, L"smtps"},
+    {500, Protocol::Udp, L"ipsec"},
+    {514, Protocol::Udp, L"syslog"},
+    {587, Protocol::Tcp, L"submission"},
+    {636, Protocol::Tcp, L"ldaps"},
+    {853, Protocol::Unknown, L"dns-tls"},
+    {993, Protocol::Tcp, L"imaps"},
+    {995, Protocol::Tcp, L"pop3s"},
+    {1194, Protocol::Unknown, L"openvpn"},
+    {1433, Protocol::Tcp, L"mssql"},
+    {1900, Protocol::Udp, L"ssdp"},
+    {3268, Protocol::Tcp, L"ldap-gc"},
+    {3306, Protocol::Tcp, L"mysql"},
+    {3389, Protocol::Unknown, L"rdp"},
+    {3478, Protocol::Udp, L"stun"},
+    {4500, Protocol::Udp, L"ipsec-nat"},
+    {5060, Protocol::Unknown, L"sip"},
+    {5353, Protocol::Udp, L"mdns"},
+    {5355, Protocol::Udp, L"llmnr"},
+    {5432, Protocol::Tcp, L"postgres"},
+    {5938, Protocol::Unknown, L"teamviewer"},
+    {5985, Protocol::Tcp, L"winrm"},
+    {5986, Protocol::Tcp, L"winrm-https"},
+    {6379, Protocol::Tcp, L"redis"},
+    {8080, Protocol::Tcp, L"http-alt"},
+    {8443, Protocol::Tcp, L"https-alt"},
+    {9418, Protocol::Tcp, L"git"},
+    {51820, Protocol::Udp, L"wireguard"},
+};
+} // namespace
+
+std::wstring ServiceLabel(uint16_t port, Protocol protocol) {
+  if (port == 0)
+    return L"";
+  std::wstring label = std::to_wstring(port);
+  if (protocol == Protocol::Tcp)
+    label += L"/tcp";
+  else if (protocol == Protocol::Udp)
+    label += L"/udp";
+
+  auto it = std::lower_bound(
+      std::begin(kKnownPorts), std::end(kKnownPorts), port,
+      [](const KnownPort &known, uint16_t p) { return known.Port < p; });
+  for (; it != std::end(kKnownPorts) && it->Port == port; ++it) {
+    if (it->Proto == Protocol::Unknown || protocol == Protocol::Unknown ||
+        it->Proto == protocol)
+      return label + L" (" + it->Name + L")";
+  }
+  return label;
+}
+
+} // namespace monitor
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace monitor {
+
+// IP protocol numbers as used in flow keys
+enum class Protocol : uint8_t { Unknown = 0, Tcp = 6, Udp = 17 };
+
+// Picks the port that names the service on a connection: the one outside
+// the ephemeral range (49152+ on Windows, 32768+ elsewhere), or failing
+// that the lower one. Works for inbound and outbound alike.
+uint16_t ServicePort(uint16_t localPort, uint16_t remotePort);
+
+// "443/tcp (https)", "51820/udp" for ports without a well-known name, or
+// empty for port 0
+std::wstring ServiceLabel(uint16_t port, Protocol protocol);
+
+} // namespace monitor
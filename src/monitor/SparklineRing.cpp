@@ -0,0 +1,44 @@
+#include "SparklineRing.h"
+#include <algorithm>
+#include <cmath>
+
+namespace monitor {
+
+// Codes per doubling; 65535 codes reach 2^32 bytes per second
+static constexpr double kScale = 2048.0;
+
+uint16_t SparklineRing::Encode(double rate) {
+  if (!(rate > 0))
+    return 0;
+  double code = std::round(std::log2(1.0 + rate) * kScale);
+  return (uint16_t)std::min(code, 65535.0);
+}
+
+double SparklineRing::Decode(uint16_t code) {
+  return std::exp2(code / kScale) - 1.0;
+}
+
+void SparklineRing::Set(uint64_t sequence, double rate) {
+  if (sequence + kSamples <= m_last)
+    return; // Scrolled out already
+  if (sequence > m_last) {
+    // Intervals skipped since the newest one read as zero
+    uint64_t skipped = std::min<uint64_t>(sequence - m_last - 1, kSamples);
+    for (uint64_t k = 1; k <= skipped; k++)
+      m_codes[(m_last + k) % kSamples] = 0;
+    m_last = sequence;
+  }
+  m_codes[sequence % kSamples] = Encode(rate);
+}
+
+double SparklineRing::At(uint64_t sequence, size_t i) const {
+  uint64_t s = sequence + i + 1;
+  if (s < kSamples)
+    return 0; // Before the first interval
+  s -= kSamples;
+  if (s > m_last || s + kSamples <= m_last)
+    return 0;
+  return Decode(m_codes[s % kSamples]);
+}
+
+} // namespace monitor
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace monitor {
+
+// The rates of the last kSamples flush intervals of one flow, for a
+// sparkline. Each rate is a 16-bit code on a log scale, accurate to 0.04%
+// up to 4 GB/s, so the ring takes 128 bytes. Intervals are numbered by
+// snapshot sequence; one that was never set reads as zero, so a quiet
+// flow needs no update to scroll.
+class SparklineRing {
+public:
+  static constexpr size_t kSamples = 60;
+
+  // Bytes per second in interval 'sequence'
+  void Set(uint64_t sequence, double rate);
+  // Sample 'i' of the kSamples intervals ending at 'sequence', oldest first
+  double At(uint64_t sequence, size_t i) const;
+
+  static uint16_t Encode(double rate);
+  static double Decode(uint16_t code);
+
+private:
+  uint64_t m_last = 0; // Newest interval set
+  uint16_t m_codes[kSamples] = {};
+};
+
+} // namespace monitor
@@ -0,0 +1,154 @@
+#include "ThroughputSeries.h"
+#include <algorithm>
+#include <cmath>
+
+namespace monitor {
+
+static int64_t FloorTo(int64_t timeUs, int64_t width) {
+  int64_t start = timeUs - timeUs % width;
+  return timeUs % width < 0 ? start - width : start;
+}
+
+ThroughputSeries::ThroughputSeries(int64_t binUs)
+    : m_binUs(std::max<int64_t>(1, binUs)) {
+  // One spare bucket each, as the oldest one may be lapped by the newest
+  const int64_t second = 1000000;
+  m_levels.push_back({second, std::vector<Bucket>(600 + 1)});
+  m_levels.push_back({10 * second, std::vector<Bucket>(6 * 360 + 1)});
+  m_levels.push_back({60 * second, std::vector<Bucket>(7 * 24 * 60 + 1)});
+}
+
+void ThroughputSeries::Add(int64_t startUs, uint64_t bytesUp,
+                           uint64_t bytesDown) {
+  float up = (float)(bytesUp * 1e6 / m_binUs);
+  float down = (float)(bytesDown * 1e6 / m_binUs);
+  for (Level &level : m_levels) {
+    int64_t start = FloorTo(startUs, level.WidthUs);
+    int64_t size = (int64_t)level.Ring.size();
+    int64_t index = (start / level.WidthUs) % size;
+    Bucket &bucket = level.Ring[index < 0 ? index + size : index];
+    if (bucket.Start > start)
+      continue; // Older than the ring reaches back
+    if (bucket.Start < start) {
+      bucket = Bucket();
+      bucket.Start = start;
+      bucket.MinUp = up;
+      bucket.MinDown = down;
+    }
+    bucket.BytesUp += bytesUp;
+    bucket.BytesDown += bytesDown;
+    bucket.MinUp = std::min(bucket.MinUp, up);
+    bucket.MaxUp = std::max(bucket.MaxUp, up);
+    bucket.MinDown = std::min(bucket.MinDown, down);
+    bucket.MaxDown = std::max(bucket.MaxDown, down);
+    bucket.Bins++;
+  }
+}
+
+void ThroughputSeries::Close(int64_t timeUs) {
+  m_closed = std::max(m_closed, timeUs);
+}
+
+ThroughputSeries::Series
+ThroughputSeries::Query(int64_t fromUs, int64_t toUs, size_t maxPoints) const {
+  Series series;
+  toUs = std::min(toUs, m_closed);
+  if (m_closed == INT64_MIN || fromUs >= toUs)
+    return series;
+
+  auto reach = [this](const Level &level) {
+    return m_closed - level.WidthUs * ((int64_t)level.Ring.size() - 1);
+  };
+  const Level *level = &m_levels.back();
+  for (const Level &candidate : m_levels) {
+    if (fromUs >= reach(candidate)) {
+      level = &candidate;
+      break;
+    }
+  }
+  int64_t width = level->WidthUs;
+  int64_t size = (int64_t)level->Ring.size();
+  fromUs = std::max(fromUs, reach(*level));
+  uint32_t binsPerBucket = (uint32_t)std::max<int64_t>(1, width / m_binUs);
+  series.BucketUs = width;
+
+  for (int64_t start = FloorTo(fromUs, width); start < toUs; start += width) {
+    int64_t index = (start / width) % size;
+    const Bucket &bucket = level->Ring[index < 0 ? index + size : index];
+    Point up, down;
+    up.TimeUs = down.TimeUs = start;
+    if (bucket.Start == start) {
+      up.Avg = bucket.BytesUp * 1e6 / width;
+      down.Avg = bucket.BytesDown * 1e6 / width;
+      // A bin without traffic is a zero the bucket never saw
+      bool full = bucket.Bins >= binsPerBucket;
+      up.Min = full ? bucket.MinUp : 0;
+      down.Min = full ? bucket.MinDown : 0;
+      up.Max = bucket.MaxUp;
+      down.Max = bucket.MaxDown;
+    }
+    series.Up.push_back(up);
+    series.Down.push_back(down);
+  }
+  series.Up = Downsample(series.Up, maxPoints);
+  series.Down = Downsample(series.Down, maxPoints);
+  return series;
+}
+
+std::vector<ThroughputSeries::Point>
+ThroughputSeries::Downsample(const std::vector<Point> &points,
+                             size_t maxPoints) {
+  size_t n = points.size();
+  if (maxPoints >= n || maxPoints < 3)
+    return points;
+
+  // The ends stay; each of the maxPoints - 2 groups between them keeps
+  // the point forming the largest triangle with the previously kept point
+  // and the average of the next group. Min and Max span the whole group.
+  std::vector<Point> result;
+  result.reserve(maxPoints);
+  result.push_back(points[0]);
+  double every = (double)(n - 2) / (maxPoints - 2);
+  size_t kept = 0;
+  for (size_t group = 0; group < maxPoints - 2; group++) {
+    size_t begin = (size_t)(group * every) + 1;
+    size_t end = std::min((size_t)((group + 1) * every) + 1, n - 1);
+    size_t nextEnd = std::min((size_t)((group + 2) * every) + 1, n);
+
+    double avgX = 0, avgY = 0;
+    for (size_t i = end; i < nextEnd; i++) {
+      avgX += (double)points[i].TimeUs;
+      avgY += points[i].Avg;
+    }
+    if (nextEnd > end) {
+      avgX /= (double)(nextEnd - end);
+      avgY /= (double)(nextEnd - end);
+    }
+
+    const Point &a = points[kept];
+    double best = -1;
+    size_t chosen = begin;
+    Point span = points[begin];
+    for (size_t i = begin; i < end; i++) {
+      double x = (double)(points[i].TimeUs - a.TimeUs);
+      double area = std::abs((avgX - (double)a.TimeUs) *
+                                 (points[i].Avg - a.Avg) -
+                             x * (avgY - a.Avg));
+      if (area > best) {
+        best = area;
+        chosen = i;
+      }
+      span.Min = std::min(span.Min, points[i].Min);
+      span.Max = std::max(span.Max, points[i].Max);
+    }
+    Point point = points[chosen];
+    point.Min = span.Min;
+    point.Max = span.Max;
+    result.push_back(point);
+    kept = chosen;
+  }
+  result.push_back(points[n - 1]);
+  return result;
+}
+
+} // namespace monitor
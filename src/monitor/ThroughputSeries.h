@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace monitor {
+
+// Total throughput at three resolutions, each in a ring allocated up
+// front: 1 s buckets for 10 minutes, 10 s for 6 hours and 1 min for 7
+// days, about 600 KB in all. A bucket holds its bytes and the lowest and
+// highest rate among the sample bins that fed it, so a coarse bucket
+// still shows a one-second spike. Not thread-safe; times are Unix
+// microseconds.
+class ThroughputSeries {
+public:
+  struct Point {
+    int64_t TimeUs = 0; // Bucket start
+    double Avg = 0;     // Bytes per second over the bucket
+    // Lowest and highest bin rate among the buckets this point stands for
+    double Min = 0;
+    double Max = 0;
+  };
+
+  struct Series {
+    std::vector<Point> Up;
+    std::vector<Point> Down;
+    int64_t BucketUs = 0; // Resolution the points were taken from
+  };
+
+  // Samples are bins 'binUs' wide; a bucket missing any has a Min of 0
+  explicit ThroughputSeries(int64_t binUs);
+
+  void Add(int64_t startUs, uint64_t bytesUp, uint64_t bytesDown);
+  // No sample starting before 'timeUs' will arrive any more
+  void Close(int64_t timeUs);
+  int64_t Closed() const { return m_closed; } // INT64_MIN before any Close
+
+  // [fromUs, toUs), cut off at the last closed time, from the finest
+  // resolution that still holds 'fromUs'. Past 'maxPoints' buckets the
+  // curve is downsampled with LTTB (largest triangle, three buckets),
+  // which keeps its shape and peaks.
+  Series Query(int64_t fromUs, int64_t toUs, size_t maxPoints) const;
+
+private:
+  struct Bucket {
+    int64_t Start = INT64_MIN; // Anything else is a stale lap of the ring
+    uint64_t BytesUp = 0;
+    uint64_t BytesDown = 0;
+    float MinUp = 0, MaxUp = 0;
+    float MinDown = 0, MaxDown = 0;
+    uint32_t Bins = 0;
+  };
+
+  struct Level {
+    int64_t WidthUs;
+    std::vector<Bucket> Ring;
+  };
+
+  static std::vector<Point> Downsample(const std::vector<Point> &points,
+                                       size_t maxPoints);
+
+  int64_t m_binUs;
+  std::vector<Level> m_levels; // Finest first
+  int64_t m_closed = INT64_MIN;
+};
+
+} // namespace monitor
@@ -1,5 +1,4 @@
 #include "TraceParser.h"
-#include "DnsResolver.h"
 #include "ETWHeaders.h"
 #include <map>
 #include <vector>
@@ -12,8 +11,12 @@ namespace monitor {
 struct EventSchema {
   bool IsRelevant = false;
   bool IsUpload = false;
+  Protocol Proto = Protocol::Unknown;
   std::wstring SizePropName;
   std::wstring AddrPropName;
+  std::wstring LocalAddrPropName;
+  std::wstring PortPropName; // Remote
+  std::wstring LocalPortPropName;
 };
 
 static std::map<uint64_t, EventSchema> g_cache;
@@ -87,21 +90,47 @@ bool TraceParser::Parse(PEVENT_RECORD pEv, TrafficEvent &out,
     out.ProcessId = pEv->EventHeader.ProcessId;
     out.Timestamp = pEv->EventHeader.TimeStamp.QuadPart;
     out.RemoteIP = L"";
+    out.Remote = IpAddress();
 
-    if (!s.AddrPropName.empty()) {
-      d.PropertyName = (ULONGLONG)s.AddrPropName.c_str();
-      if (TdhGetPropertySize(pEv, 0, nullptr, 1, &d, &pSize) == ERROR_SUCCESS) {
-        if (pSize == 4) {
-          uint32_t v4 = 0;
-          TdhGetProperty(pEv, 0, nullptr, 1, &d, 4, (BYTE *)&v4);
-          out.RemoteIP = DnsResolver::IPv4ToString(v4);
-        } else if (pSize == 16) {
-          uint8_t v6[16];
-          TdhGetProperty(pEv, 0, nullptr, 1, &d, 16, v6);
-          out.RemoteIP = DnsResolver::IPv6ToString(v6);
-        }
+    // Addresses are 4 bytes in IPv4 events and 16 in IPv6 ones
+    auto readAddress = [&](const std::wstring &name, IpAddress &ip) {
+      if (name.empty())
+        return false;
+      d.PropertyName = (ULONGLONG)name.c_str();
+      if (TdhGetPropertySize(pEv, 0, nullptr, 1, &d, &pSize) != ERROR_SUCCESS)
+        return false;
+      if (pSize == 4) {
+        uint32_t v4 = 0;
+        TdhGetProperty(pEv, 0, nullptr, 1, &d, 4, (BYTE *)&v4);
+        ip = IpAddress::FromV4(v4);
+        return true;
       }
-    }
+      if (pSize == 16) {
+        uint8_t v6[16];
+        TdhGetProperty(pEv, 0, nullptr, 1, &d, 16, v6);
+        ip = IpAddress::FromV6(v6);
+        return true;
+      }
+      return false;
+    };
+    // Ports are logged in network byte order
+    auto readPort = [&](const std::wstring &name) -> uint16_t {
+      uint8_t port[2] = {};
+      if (name.empty())
+        return 0;
+      d.PropertyName = (ULONGLONG)name.c_str();
+      if (TdhGetProperty(pEv, 0, nullptr, 1, &d, 2, port) != ERROR_SUCCESS)
+        return 0;
+      return (uint16_t)(port[0] << 8 | port[1]);
+    };
+
+    if (readAddress(s.AddrPropName, out.Remote))
+      out.RemoteIP = out.Remote.ToString();
+    out.Local = IpAddress();
+    readAddress(s.LocalAddrPropName, out.Local);
+    out.RemotePort = readPort(s.PortPropName);
+    out.LocalPort = readPort(s.LocalPortPropName);
+    out.Proto = s.Proto;
     return true;
   }
 
@@ -134,6 +163,11 @@ bool TraceParser::Parse(PEVENT_RECORD pEv, TrafficEvent &out,
 
   if (send || recv) {
     s.IsUpload = send;
+    // Kernel-Network has separate TCPIP and UDPIP tasks
+    if (task.find(L"UDP") != std::wstring::npos)
+      s.Proto = Protocol::Udp;
+    else if (task.find(L"TCP") != std::wstring::npos)
+      s.Proto = Protocol::Tcp;
     for (ULONG i = 0; i < pInfo->PropertyCount; i++) {
       std::wstring n = SafeGetWStr(
           pInfo, pInfo->EventPropertyInfoArray[i].NameOffset, buffSize);
@@ -141,9 +175,20 @@ bool TraceParser::Parse(PEVENT_RECORD pEv, TrafficEvent &out,
           (n == L"size" || n == L"Size" || n == L"datalen" ||
            n.find(L"Bytes") != std::wstring::npos))
         s.SizePropName = n;
-      if (s.AddrPropName.empty() && (n.find(L"Addr") != std::wstring::npos ||
-                                     n == L"daddr" || n == L"RemoteAddress"))
+      // saddr/sport and Local* are this host's end
+      bool local = n == L"saddr" || n == L"sport" ||
+                   n.find(L"Local") != std::wstring::npos;
+      if (n == L"daddr" || n == L"RemoteAddress" ||
+          (s.AddrPropName.empty() && !local &&
+           n.find(L"Addr") != std::wstring::npos))
         s.AddrPropName = n;
+      else if (s.LocalAddrPropName.empty() && local &&
+               (n == L"saddr" || n.find(L"Addr") != std::wstring::npos))
+        s.LocalAddrPropName = n;
+      if (n == L"dport" || n == L"RemotePort")
+        s.PortPropName = n;
+      else if (n == L"sport" || n == L"LocalPort")
+        s.LocalPortPropName = n;
     }
     if (!s.SizePropName.empty())
       s.IsRelevant = true;
@@ -157,6 +202,32 @@ bool TraceParser::Parse(PEVENT_RECORD pEv, TrafficEvent &out,
   return false;
 }
 
+// QueryResults is a ';'-separated answer list: plain addresses (IPv4 as
+// "::ffff:a.b.c.d") and "type:  N name" for other records, CNAME being 5
+static void ParseDnsResults(const std::wstring &results, DnsEvent &out) {
+  size_t pos = 0;
+  while (pos < results.size()) {
+    size_t end = results.find(L';', pos);
+    if (end == std::wstring::npos)
+      end = results.size();
+    std::wstring item = results.substr(pos, end - pos);
+    pos = end + 1;
+
+    if (item.compare(0, 5, L"type:") == 0) {
+      wchar_t *rest = nullptr;
+      unsigned long type = wcstoul(item.c_str() + 5, &rest, 10);
+      while (*rest == L' ')
+        rest++;
+      if (type == 5 && *rest)
+        out.CnameChain.push_back(rest);
+      continue;
+    }
+    IpAddress ip;
+    if (IpAddress::Parse(item, ip))
+      out.Addresses.push_back(ip);
+  }
+}
+
 bool TraceParser::ParseDns(PEVENT_RECORD pEv, DnsEvent &out,
                            std::wstring &err) {
   static const GUID DnsGuid = {
@@ -202,12 +273,140 @@ bool TraceParser::ParseDns(PEVENT_RECORD pEv, DnsEvent &out,
     TdhGetProperty(pEv, 0, nullptr, 1, &d, psz, (BYTE *)b.data());
     if (n == L"QueryName")
       out.QueryName = b.data();
-    else if (n == L"QueryResults" || n == L"Address") {
-      if (out.ResultIP.empty())
-        out.ResultIP = b.data();
-    }
+    else if (n == L"QueryResults" || n == L"Address")
+      ParseDnsResults(b.data(), out);
+  }
+  // DNS-Client logs in the context of the process that called the resolver
+  out.ProcessId = pEv->EventHeader.ProcessId;
+  out.Timestamp = pEv->EventHeader.TimeStamp.QuadPart;
+  return !out.QueryName.empty() && !out.Addresses.empty();
+}
+
+// Reads a named property into 'out'. Caller holds s_tdhMutex.
+static bool ReadProperty(PEVENT_RECORD pEv, const wchar_t *name,
+                         std::vector<BYTE> &out) {
+  PROPERTY_DATA_DESCRIPTOR d;
+  d.PropertyName = (ULONGLONG)name;
+  d.ArrayIndex = ULONG_MAX;
+  d.Reserved = 0;
+  DWORD size = 0;
+  if (TdhGetPropertySize(pEv, 0, nullptr, 1, &d, &size) != ERROR_SUCCESS ||
+      size == 0)
+    return false;
+  out.assign(size + sizeof(wchar_t), 0);
+  return TdhGetProperty(pEv, 0, nullptr, 1, &d, size, out.data()) ==
+         ERROR_SUCCESS;
+}
+
+bool TraceParser::ParseProcess(PEVENT_RECORD pEv, ProcessEvent &out,
+                               std::wstring &err) {
+  static const GUID KernelProcGuid = {
+      0x22fb2cd6,
+      0x0e7b,
+      0x422b,
+      {0xa0, 0xc7, 0x2f, 0xad, 0x1f, 0xd0, 0xe7, 0x16}};
+  if (memcmp(&pEv->EventHeader.ProviderId, &KernelProcGuid, sizeof(GUID)) !=
+      0)
+    return false;
+  uint16_t id = pEv->EventHeader.EventDescriptor.Id;
+  if (id != 1 && id != 2)
+    return false;
+
+  out.IsStart = (id == 1);
+  std::vector<BYTE> value;
+  std::lock_guard<std::mutex> tdhLock(s_tdhMutex);
+  if (!ReadProperty(pEv, L"ProcessID", value) || value.size() < 4) {
+    err = L"Kernel-Process event without ProcessID";
+    return false;
+  }
+  memcpy(&out.ProcessId, value.data(), 4);
+
+  if (ReadProperty(pEv, L"CreateTime", value) && value.size() >= 8)
+    memcpy(&out.CreateTime, value.data(), 8);
+
+  if (ReadProperty(pEv, L"ImageName", value)) {
+    // Start events carry the full device path, stop events the file name
+    std::wstring image = (const wchar_t *)value.data();
+    size_t slash = image.find_last_of(L"\\/");
+    out.ImageName =
+        slash == std::wstring::npos ? image : image.substr(slash + 1);
   }
-  return !out.QueryName.empty() && !out.ResultIP.empty();
+  return true;
+}
+
+// Kernel-Network addresses: 4 bytes in the IPv4 events, 16 in the IPv6 ones.
+// Caller holds s_tdhMutex.
+static bool ReadAddress(PEVENT_RECORD pEv, const wchar_t *name,
+                        IpAddress &out) {
+  std::vector<BYTE> value;
+  if (!ReadProperty(pEv, name, value))
+    return false;
+  size_t size = value.size() - sizeof(wchar_t);
+  if (size == 4) {
+    uint32_t v4 = 0;
+    memcpy(&v4, value.data(), 4);
+    out = IpAddress::FromV4(v4);
+    return true;
+  }
+  if (size == 16) {
+    out = IpAddress::FromV6(value.data());
+    return true;
+  }
+  return false;
+}
+
+// Ports are logged in network byte order. Caller holds s_tdhMutex.
+static uint16_t ReadPort(PEVENT_RECORD pEv, const wchar_t *name) {
+  std::vector<BYTE> value;
+  if (!ReadProperty(pEv, name, value) || value.size() < 2 + sizeof(wchar_t))
+    return 0;
+  return (uint16_t)(value[0] << 8 | value[1]);
+}
+
+bool TraceParser::ParseConnection(PEVENT_RECORD pEv, ConnectionEvent &out,
+                                  std::wstring &err) {
+  static const GUID KernelNetGuid = {
+      0x7dd42a49,
+      0x5329,
+      0x4832,
+      {0x8d, 0xfd, 0x43, 0xd9, 0x79, 0x15, 0x3a, 0x88}};
+  if (memcmp(&pEv->EventHeader.ProviderId, &KernelNetGuid, sizeof(GUID)) != 0)
+    return false;
+  switch (pEv->EventHeader.EventDescriptor.Id) {
+  case 12:
+  case 28:
+    out.Type = ConnectionEvent::Kind::Connect;
+    break;
+  case 15:
+  case 31:
+    out.Type = ConnectionEvent::Kind::Accept;
+    break;
+  case 13:
+  case 29:
+    out.Type = ConnectionEvent::Kind::Disconnect;
+    break;
+  default:
+    return false;
+  }
+
+  std::lock_guard<std::mutex> tdhLock(s_tdhMutex);
+  // saddr is the local end, also for accepted connections
+  if (!ReadAddress(pEv, L"daddr", out.Remote) ||
+      !ReadAddress(pEv, L"saddr", out.Local)) {
+    err = L"Kernel-Network connection event without addresses";
+    return false;
+  }
+  out.RemotePort = ReadPort(pEv, L"dport");
+  out.LocalPort = ReadPort(pEv, L"sport");
+
+  // The header PID is whoever was running when the event fired
+  std::vector<BYTE> value;
+  if (ReadProperty(pEv, L"PID", value) && value.size() >= 4)
+    memcpy(&out.ProcessId, value.data(), 4);
+  else
+    out.ProcessId = pEv->EventHeader.ProcessId;
+  out.Timestamp = pEv->EventHeader.TimeStamp.QuadPart;
+  return true;
 }
 
 } // namespace monitor
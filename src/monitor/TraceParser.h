@@ -1,5 +1,7 @@
 #pragma once
 
+#include "IpAddress.h"
+#include "ServicePort.h"
 #include <cstdint>
 #include <mutex>
 #include <string>
@@ -15,11 +17,40 @@ struct TrafficEvent {
   uint64_t Bytes;
   bool IsUpload;
   std::wstring RemoteIP;
+  IpAddress Remote; // Binary form of RemoteIP, unspecified if unknown
+  IpAddress Local;  // Unspecified if unknown
+  uint16_t LocalPort = 0; // Host order, 0 if unknown
+  uint16_t RemotePort = 0;
+  Protocol Proto = Protocol::Unknown;
 };
 
 struct DnsEvent {
+  uint64_t Timestamp = 0;
+  uint32_t ProcessId = 0; // The process that issued the query
   std::wstring QueryName;
-  std::wstring ResultIP;
+  std::vector<std::wstring> CnameChain; // Aliases, in resolution order
+  std::vector<IpAddress> Addresses;     // Every A/AAAA answer
+};
+
+// Process start (Kernel-Process event 1) or exit (event 2)
+struct ProcessEvent {
+  bool IsStart = false;
+  uint32_t ProcessId = 0;
+  uint64_t CreateTime = 0; // FILETIME, identifies the process with its PID
+  std::wstring ImageName;  // File name only
+};
+
+// TCP connect (Kernel-Network events 12/28), accept (15/31) or disconnect
+// (13/29), IPv4/IPv6
+struct ConnectionEvent {
+  enum class Kind : uint8_t { Connect, Accept, Disconnect };
+  Kind Type = Kind::Connect;
+  uint64_t Timestamp = 0;
+  uint32_t ProcessId = 0;
+  IpAddress Local;
+  IpAddress Remote;
+  uint16_t LocalPort = 0; // Host order
+  uint16_t RemotePort = 0;
 };
 
 class TraceParser {
@@ -29,6 +60,10 @@ public:
 
   bool Parse(PEVENT_RECORD pEvent, TrafficEvent &outEvent, std::wstring &error);
   bool ParseDns(PEVENT_RECORD pEvent, DnsEvent &outEvent, std::wstring &error);
+  bool ParseProcess(PEVENT_RECORD pEvent, ProcessEvent &outEvent,
+                    std::wstring &error);
+  bool ParseConnection(PEVENT_RECORD pEvent, ConnectionEvent &outEvent,
+                       std::wstring &error);
 
 private:
   static std::mutex s_cacheMutex;
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+
+namespace monitor {
+
+// Sums values per key into event-time tumbling windows of a fixed width.
+//
+// A window is emitted once the watermark passes its end. The watermark is
+// the later of the newest event time and the caller's clock, minus the
+// allowed lateness, so quiet periods still close windows. Data for a
+// window that was already emitted goes into the oldest open one and is
+// counted as late: totals stay exact, only its timing is approximate.
+//
+// 'Value' needs operator+=. Not thread-safe. Times are microseconds.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class TumblingWindows {
+public:
+  using Window = std::unordered_map<Key, Value, Hash>;
+
+  TumblingWindows(int64_t widthUs, int64_t latenessUs)
+      : m_width(std::max<int64_t>(1, widthUs)), m_lateness(latenessUs) {}
+
+  int64_t WidthUs() const { return m_width; }
+
+  int64_t WindowStart(int64_t timeUs) const {
+    int64_t start = timeUs - timeUs % m_width;
+    return timeUs % m_width < 0 ? start - m_width : start;
+  }
+
+  Value &At(int64_t timeUs, const Key &key) {
+    m_newest = std::max(m_newest, timeUs);
+    int64_t start = WindowStart(timeUs);
+    if (start < m_emittedUntil) {
+      start = m_emittedUntil;
+      m_late++;
+    }
+    // Nearly every event falls into the same window as the previous one
+    if (!m_current || start != m_currentStart) {
+      m_current = &m_windows[start];
+      m_currentStart = start;
+    }
+    return (*m_current)[key];
+  }
+
+  void Add(int64_t timeUs, const Key &key, const Value &value) {
+    At(timeUs, key) += value;
+  }
+
+  // Merges a whole window, e.g. one taken from another instance
+  void Add(int64_t startUs, const Window &window) {
+    for (const auto &[key, value] : window)
+      At(startUs, key) += value;
+  }
+
+  // Calls emit(startUs, window) for every window that ended at or before
+  // the watermark, oldest first
+  template <typename Fn> void Emit(int64_t nowUs, Fn &&emit) {
+    int64_t watermark = std::max(m_newest, nowUs) - m_lateness;
+    int64_t closeBefore = WindowStart(watermark);
+    for (auto it = m_windows.begin();
+         it != m_windows.end() && it->first < closeBefore;) {
+      emit(it->first, it->second);
+      it = m_windows.erase(it);
+    }
+    m_emittedUntil = std::max(m_emittedUntil, closeBefore);
+    m_current = nullptr;
+  }
+
+  // Every open window, oldest first; nothing is counted as emitted
+  std::map<int64_t, Window> Take() {
+    m_current = nullptr;
+    std::map<int64_t, Window> windows;
+    windows.swap(m_windows);
+    return windows;
+  }
+
+  // Start of the oldest window still open: all before it was emitted
+  int64_t EmittedUntil() const { return m_emittedUntil; }
+  size_t OpenWindows() const { return m_windows.size(); }
+  uint64_t LateCount() const { return m_late; }
+
+private:
+  int64_t m_width;
+  int64_t m_lateness;
+  std::map<int64_t, Window> m_windows; // By start time
+  int64_t m_emittedUntil = INT64_MIN;  // Windows before this are gone
+  int64_t m_newest = INT64_MIN;
+  uint64_t m_late = 0;
+
+  Window *m_current = nullptr;
+  int64_t m_currentStart = 0;
+};
+
+} // namespace monitor
@@ -0,0 +1,137 @@
+#include "HyperLogLog.h"
+#include "Varint.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace utils {
+
+// Layouts in the serialized form
+static constexpr uint64_t kSparse = 0;
+static constexpr uint64_t kDense = 1;
+
+HyperLogLog::HyperLogLog(int precision)
+    : m_precision(std::clamp(precision, 4, 16)) {}
+
+static uint64_t Hash(const void *data, size_t size) {
+  // FNV-1a, then the MurmurHash3 finalizer so the top bits are mixed too
+  const uint8_t *bytes = (const uint8_t *)data;
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (size_t i = 0; i < size; i++)
+    h = (h ^ bytes[i]) * 0x100000001B3ull;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ull;
+  return h ^ (h >> 33);
+}
+
+void HyperLogLog::Add(const void *data, size_t size) {
+  if (m_registers.empty())
+    m_registers.resize((size_t)1 << m_precision, 0);
+  uint64_t h = Hash(data, size);
+  size_t index = (size_t)(h >> (64 - m_precision));
+  uint64_t rest = h << m_precision;
+  uint8_t rank = rest ? (uint8_t)(std::countl_zero(rest) + 1)
+                      : (uint8_t)(64 - m_precision + 1);
+  m_registers[index] = std::max(m_registers[index], rank);
+}
+
+bool HyperLogLog::Merge(const HyperLogLog &other) {
+  if (other.m_precision != m_precision)
+    return false;
+  if (other.m_registers.empty())
+    return true;
+  if (m_registers.empty()) {
+    m_registers = other.m_registers;
+    return true;
+  }
+  for (size_t i = 0; i < m_registers.size(); i++)
+    m_registers[i] = std::max(m_registers[i], other.m_registers[i]);
+  return true;
+}
+
+void HyperLogLog::Clear() { m_registers.clear(); }
+
+uint64_t HyperLogLog::Estimate() const {
+  if (m_registers.empty())
+    return 0;
+  double m = (double)m_registers.size();
+  double sum = 0;
+  size_t zeros = 0;
+  for (uint8_t r : m_registers) {
+    sum += std::ldexp(1.0, -r);
+    zeros += r == 0;
+  }
+  double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  // Small counts leave registers empty; counting those is more accurate
+  if (estimate <= 2.5 * m && zeros > 0)
+    estimate = m * std::log(m / (double)zeros);
+  return (uint64_t)std::llround(estimate);
+}
+
+std::string HyperLogLog::Serialize() const {
+  std::string out;
+  PutVarint(out, (uint64_t)m_precision);
+  std::string sparse;
+  size_t previous = 0;
+  for (size_t i = 0; i < m_registers.size(); i++) {
+    if (m_registers[i] == 0)
+      continue;
+    PutVarint(sparse, i - previous);
+    sparse.push_back((char)m_registers[i]);
+    previous = i;
+  }
+  if (m_registers.empty() || sparse.size() < m_registers.size()) {
+    PutVarint(out, kSparse);
+    out += sparse;
+  } else {
+    PutVarint(out, kDense);
+    out.append((const char *)m_registers.data(), m_registers.size());
+  }
+  return out;
+}
+
+bool HyperLogLog::Deserialize(const std::string &data) {
+  Clear();
+  size_t pos = 0;
+  uint64_t precision, layout;
+  if (!GetVarint(data, pos, precision) || precision < 4 || precision > 16 ||
+      !GetVarint(data, pos, layout))
+    return false;
+  m_precision = (int)precision;
+  size_t size = (size_t)1 << m_precision;
+  uint8_t maxRank = (uint8_t)(64 - m_precision + 1);
+
+  if (layout == kDense) {
+    if (data.size() - pos != size)
+      return false;
+    m_registers.assign(data.begin() + pos, data.end());
+    for (uint8_t r : m_registers) {
+      if (r > maxRank) {
+        Clear();
+        return false;
+      }
+    }
+    return true;
+  }
+  if (layout != kSparse)
+    return false;
+  if (pos == data.size())
+    return true; // Nothing added
+  m_registers.resize(size, 0);
+  uint64_t index = 0;
+  while (pos < data.size()) {
+    uint64_t gap;
+    if (!GetVarint(data, pos, gap) || pos == data.size() ||
+        index + gap >= size || (uint8_t)data[pos] > maxRank) {
+      Clear();
+      return false;
+    }
+    index += gap;
+    m_registers[index] = (uint8_t)data[pos++];
+  }
+  return true;
+}
+
+} // namespace utils
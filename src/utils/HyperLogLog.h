@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace utils {
+
+// Approximate count of distinct items in 2^precision one-byte registers:
+// each item is hashed, the top bits pick a register and the register
+// keeps the longest run of leading zeros seen in the rest. The standard
+// error is 1.04 / sqrt(2^precision), 1.6% with the default 4 KB. Merging
+// two sketches of the same precision gives the sketch of the union, so
+// counts over a range come from merging its buckets.
+class HyperLogLog {
+public:
+  explicit HyperLogLog(int precision = 12);
+
+  void Add(const void *data, size_t size);
+  // False, and nothing merged, if the precisions differ
+  bool Merge(const HyperLogLog &other);
+  void Clear();
+
+  int Precision() const { return m_precision; }
+  bool Empty() const { return m_registers.empty(); }
+  uint64_t Estimate() const;
+  size_t Bytes() const { return m_registers.capacity(); }
+
+  // Compact form for storage: varints for the precision and the layout,
+  // then the registers, as (gap, value) pairs while few are set
+  std::string Serialize() const;
+  // False if 'data' is malformed; the sketch is then left empty
+  bool Deserialize(const std::string &data);
+
+private:
+  int m_precision;
+  std::vector<uint8_t> m_registers; // Allocated on the first Add
+};
+
+} // namespace utils
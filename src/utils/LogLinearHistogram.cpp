@@ -0,0 +1,116 @@
+#include "LogLinearHistogram.h"
+#include "Varint.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace utils {
+
+LogLinearHistogram::LogLinearHistogram(int subBits)
+    : m_subBits(std::clamp(subBits, 0, 16)) {}
+
+size_t LogLinearHistogram::BucketOf(uint64_t value) const {
+  uint64_t subBuckets = 1ull << m_subBits;
+  if (value < subBuckets)
+    return (size_t)value;
+  int exponent = 63 - std::countl_zero(value);
+  int shift = exponent - m_subBits;
+  uint64_t sub = (value >> shift) - subBuckets;
+  return (size_t)((shift + 1) * subBuckets + sub);
+}
+
+uint64_t LogLinearHistogram::BucketHigh(size_t bucket) const {
+  uint64_t subBuckets = 1ull << m_subBits;
+  if (bucket < subBuckets)
+    return bucket;
+  int shift = (int)(bucket / subBuckets) - 1;
+  uint64_t low = (subBuckets + bucket % subBuckets) << shift;
+  return low + ((1ull << shift) - 1);
+}
+
+void LogLinearHistogram::Record(uint64_t value, uint64_t count) {
+  if (count == 0)
+    return;
+  size_t bucket = BucketOf(value);
+  if (bucket >= m_counts.size())
+    m_counts.resize(bucket + 1, 0);
+  m_counts[bucket] += count;
+  m_count += count;
+  m_max = std::max(m_max, value);
+}
+
+bool LogLinearHistogram::Merge(const LogLinearHistogram &other) {
+  if (other.m_subBits != m_subBits)
+    return false;
+  if (other.m_counts.size() > m_counts.size())
+    m_counts.resize(other.m_counts.size(), 0);
+  for (size_t i = 0; i < other.m_counts.size(); i++)
+    m_counts[i] += other.m_counts[i];
+  m_count += other.m_count;
+  m_max = std::max(m_max, other.m_max);
+  return true;
+}
+
+void LogLinearHistogram::Clear() {
+  m_counts.clear();
+  m_count = 0;
+  m_max = 0;
+}
+
+uint64_t LogLinearHistogram::Quantile(double q) const {
+  if (m_count == 0)
+    return 0;
+  q = std::clamp(q, 0.0, 1.0);
+  uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * m_count));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < m_counts.size(); i++) {
+    seen += m_counts[i];
+    if (seen >= rank)
+      return std::min(BucketHigh(i), m_max);
+  }
+  return m_max;
+}
+
+std::string LogLinearHistogram::Serialize() const {
+  std::string out;
+  PutVarint(out, (uint64_t)m_subBits);
+  PutVarint(out, m_max);
+  size_t previous = 0;
+  for (size_t i = 0; i < m_counts.size(); i++) {
+    if (m_counts[i] == 0)
+      continue;
+    PutVarint(out, i - previous);
+    PutVarint(out, m_counts[i]);
+    previous = i;
+  }
+  return out;
+}
+
+bool LogLinearHistogram::Deserialize(const std::string &data) {
+  Clear();
+  size_t pos = 0;
+  uint64_t subBits, max;
+  if (!GetVarint(data, pos, subBits) || subBits > 16 ||
+      !GetVarint(data, pos, max))
+    return false;
+  m_subBits = (int)subBits;
+  size_t limit = BucketOf(max);
+  uint64_t bucket = 0;
+  while (pos < data.size()) {
+    uint64_t gap, count;
+    if (!GetVarint(data, pos, gap) || !GetVarint(data, pos, count) ||
+        bucket + gap > limit) {
+      Clear();
+      return false;
+    }
+    bucket += gap;
+    if (bucket >= m_counts.size())
+      m_counts.resize(bucket + 1, 0);
+    m_counts[bucket] += count;
+    m_count += count;
+  }
+  m_max = max;
+  return true;
+}
+
+} // namespace utils
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace utils {
+
+// Counts of non-negative integers in buckets that widen with the value:
+// exact below 2^subBits, then 2^subBits equal sub-buckets per power of
+// two, so a value is known to within 1/2^subBits of itself. Buckets are
+// only allocated up to the largest value seen; with the default 4 bits,
+// rates up to 1 GB/s need 433 counters. Merging two histograms of the
+// same precision gives exactly the histogram of both inputs.
+class LogLinearHistogram {
+public:
+  explicit LogLinearHistogram(int subBits = 4);
+
+  void Record(uint64_t value, uint64_t count = 1);
+  // False, and nothing merged, if the precisions differ
+  bool Merge(const LogLinearHistogram &other);
+  void Clear();
+
+  int SubBits() const { return m_subBits; }
+  uint64_t Count() const { return m_count; }
+  uint64_t Max() const { return m_max; }
+  // The value at quantile 'q' (0 to 1), rounded up to its bucket's upper
+  // edge but never above Max(). 0 if empty.
+  uint64_t Quantile(double q) const;
+  size_t Bytes() const { return m_counts.capacity() * sizeof(uint64_t); }
+
+  size_t BucketOf(uint64_t value) const;
+  uint64_t BucketHigh(size_t bucket) const; // Largest value in the bucket
+
+  // Compact form for storage: varints for the precision, the maximum and
+  // each non-empty bucket as (gap from the previous one, count)
+  std::string Serialize() const;
+  // False if 'data' is malformed; the histogram is then left empty
+  bool Deserialize(const std::string &data);
+
+private:
+  int m_subBits;
+  std::vector<uint64_t> m_counts;
+  uint64_t m_count = 0;
+  uint64_t m_max = 0;
+};
+
+} // namespace utils
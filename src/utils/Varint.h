@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace utils {
+
+// LEB128: seven bits per byte, low bits first, high bit set on all but
+// the last byte. Used by the sketches' storage formats.
+inline void PutVarint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((char)value);
+}
+
+// False if 'in' ends inside the varint or it is longer than 64 bits
+inline bool GetVarint(const std::string &in, size_t &pos, uint64_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+    uint8_t byte = (uint8_t)in[pos++];
+    value |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+} // namespace utils